@@ -34,6 +34,7 @@ Ported from Ardupilot AP_GPS_UBLOX.h & .cpp (version 4.5.7 2025-02-02)
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
 #define UBLOX_DEBUGGING 0
 #define UBLOX_MB_DEBUGGING 0 // use this to enable debugging of moving baseline configs
@@ -556,8 +557,22 @@ AP_GPS_UBLOX::read(void)
     bool parsed = false;
     uint32_t millis_now = I_millis();
 
+    // in push mode the receiver sends NAV-PVT by itself and is only polled when it stops
+    bool pushing = false;
+    if (push_timeout_ms && !_unconfigured_messages) {
+        if (millis_now - _last_pvt_ms < push_timeout_ms ||
+            millis_now - _last_config_time < push_timeout_ms) {
+            pushing = true;
+        } else {
+            Debug("no NAV-PVT for %u ms, verifying the rates", (unsigned)(millis_now - _last_pvt_ms));
+            _unconfigured_messages |= CONFIG_RATE_PVT | CONFIG_RATE_NAV;
+            _next_message = STEP_PVT;
+            push_restarts++;
+        }
+    }
+
     // walk through the gps configuration at 1 message per second
-    if (millis_now - _last_config_time >= _delay_time) {
+    if (!pushing && millis_now - _last_config_time >= _delay_time) {
         _request_next_config();
         _last_config_time = millis_now;
         if (_unconfigured_messages) { // send the updates faster until fully configured
@@ -579,12 +594,70 @@ AP_GPS_UBLOX::read(void)
     }
 
     const uint16_t numc = MIN(I_available(), 8192);
-    for (uint16_t i = 0; i < numc; i++) {        // Process bytes received
-        // read the next byte
-        uint8_t data;
-        if (!I_read(&data, 1)) {
+    uint16_t i = 0;
+    while (i < numc) {                          // Process bytes received
+        const uint8_t *span;
+        size_t n = I_peek(&span);
+        bool stop = false;
+        if (n == 0) {
+            // read the next byte
+            uint8_t data;
+            if (!I_read(&data, 1)) {
+                break;
+            }
+            _parse_bytes(&data, 1, parsed, stop);
+            i++;
+        } else {
+            // or parse what the interface has in place, as much as it has
+            n = MIN(n, (size_t)(numc - i));
+            size_t used = _parse_bytes(span, n, parsed, stop);
+            I_consume(used);
+            i += used;
+        }
+        if (stop) {
             break;
         }
+    }
+    return parsed;
+}
+
+// Run the frame state machine over len bytes, returns how many it took.
+// stop is set when it has to hand back early for an RTCMv3 packet.
+// Between frames, the frames that are whole in bytes go to _parse_frames;
+// the state machine takes the rest, a frame cut at the end of the span.
+// It copies and checksums the payload of a cut frame in bulk too, so a
+// frame longer than any span (RXM-RAWX) is not parsed byte by byte.
+size_t
+AP_GPS_UBLOX::_parse_bytes(const uint8_t *bytes, size_t len, bool &parsed, bool &stop)
+{
+    bool bulk = span_parse;
+#if GPS_MOVING_BASELINE
+    bulk = bulk && !rtcm3_parser;                   // it has to see every byte
+#endif
+    for (size_t i = 0; i < len; i++) {
+        if (bulk && _step == 0) {
+            i += _parse_frames(bytes + i, len - i, parsed);
+            if (i == len) {
+                break;
+            }
+        }
+        if (bulk && _step == 6) {
+            // the payload of a frame cut at a span boundary, as far as it goes
+            size_t n = MIN((size_t)(_payload_length - _payload_counter), len - i);
+            memcpy(&_buffer[_payload_counter], bytes + i, n);
+            _update_checksum(bytes + i, n, _ck_a, _ck_b);
+#if AP_GPS_DEBUG_LOGGING_ENABLED
+            log_data(bytes + i, n);
+#endif
+            _payload_counter += n;
+            if (_payload_counter == _payload_length) {
+                _step++;
+            }
+            i += n - 1;
+            continue;
+        }
+
+        const uint8_t data = bytes[i];
 #if AP_GPS_DEBUG_LOGGING_ENABLED
         log_data(&data, 1);
 #endif
@@ -598,7 +671,8 @@ AP_GPS_UBLOX::read(void)
                 // chance to send the RTCMv3 packet to another (rover)
                 // GPS
                 _step = 0;
-                break;
+                stop = true;
+                return i + 1;
             }
         }
 #endif
@@ -711,7 +785,70 @@ AP_GPS_UBLOX::read(void)
             break;
         }
     }
-    return parsed;
+    return len;
+}
+
+// Parse the whole frames at the start of len bytes in place: find the
+// preamble with memchr, check the length and the checksum over the frame
+// at once, then copy the payload to _buffer for _parse_gps. Resyncs where
+// the state machine would. Returns how many bytes it took, short of len
+// when a frame is not all there.
+size_t
+AP_GPS_UBLOX::_parse_frames(const uint8_t *bytes, size_t len, bool &parsed)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        const uint8_t *p = (const uint8_t *)memchr(bytes + pos, PREAMBLE1, len - pos);
+        if (p == nullptr) {
+            pos = len;
+            break;
+        }
+        pos = p - bytes;
+        if (len - pos < 6) {
+            break;
+        }
+        if (p[1] != PREAMBLE2) {
+            pos++;
+            continue;
+        }
+        const uint16_t payload_length = p[4] | (uint16_t)(p[5] << 8);
+        if (payload_length > sizeof(_buffer)) {
+            Debug("large payload %u", (unsigned)payload_length);
+            pos += 5;                       // the state machine restarts on the length high byte
+            continue;
+        }
+        if (len - pos < (size_t)payload_length + 8) {
+            break;
+        }
+
+        uint8_t ck_a = 0, ck_b = 0;
+        _update_checksum(p + 2, payload_length + 4, ck_a, ck_b);
+        if (p[6 + payload_length] != ck_a) {
+            Debug("bad cka %x should be %x", p[6 + payload_length], ck_a);
+            pos += 6 + payload_length;      // and on a bad CK_A
+            continue;
+        }
+        pos += payload_length + 8;
+        if (p[7 + payload_length] != ck_b) {
+            Debug("bad ckb %x should be %x", p[7 + payload_length], ck_b);
+            continue;
+        }
+
+        _class = p[2];
+        _msg_id = p[3];
+        _payload_length = payload_length;
+        _payload_counter = payload_length;
+        _ck_a = ck_a;
+        _ck_b = ck_b;
+        memcpy(&_buffer, p + 6, payload_length);
+        if (_parse_gps()) {
+            parsed = true;
+        }
+    }
+#if AP_GPS_DEBUG_LOGGING_ENABLED
+    log_data(bytes, pos);
+#endif
+    return pos;
 }
 
 // Private Methods /////////////////////////////////////////////////////////////
@@ -929,744 +1066,880 @@ int8_t AP_GPS_UBLOX::find_active_config_index(ConfigKey key) const
     return -1;
 }
 
+/*
+ *  message dispatch
+ *
+ *  _parse_gps looks a frame up by class and id in _ubx_index, a table made
+ *  at compile time from _ubx_msgs, so a new handler costs the other messages
+ *  nothing. Each entry counts its frames and times its handler.
+ */
+constexpr AP_GPS_UBLOX::ubx_msg_t AP_GPS_UBLOX::_ubx_msgs[] = {
+    { CLASS_NAV, MSG_PVT,              sizeof(ubx_nav_pvt),      &AP_GPS_UBLOX::_parse_nav_pvt,     "NAV-PVT" },
+    { CLASS_NAV, MSG_POSLLH,           sizeof(ubx_nav_posllh),   &AP_GPS_UBLOX::_parse_nav_posllh,  "NAV-POSLLH" },
+    { CLASS_NAV, MSG_STATUS,           sizeof(ubx_nav_status),   &AP_GPS_UBLOX::_parse_nav_status,  "NAV-STATUS" },
+    { CLASS_NAV, MSG_VELNED,           sizeof(ubx_nav_velned),   &AP_GPS_UBLOX::_parse_nav_velned,  "NAV-VELNED" },
+    { CLASS_NAV, MSG_DOP,              sizeof(ubx_nav_dop),      &AP_GPS_UBLOX::_parse_nav_dop,     "NAV-DOP" },
+    { CLASS_NAV, MSG_SOL,              sizeof(ubx_nav_solution), &AP_GPS_UBLOX::_parse_nav_sol,     "NAV-SOL" },
+    { CLASS_NAV, MSG_TIMEGPS,          sizeof(ubx_nav_timegps),  &AP_GPS_UBLOX::_parse_nav_timegps, "NAV-TIMEGPS" },
+    { CLASS_NAV, MSG_NAV_SVINFO,       sizeof(ubx_nav_svinfo_header), &AP_GPS_UBLOX::_parse_nav_svinfo, "NAV-SVINFO" },
+    { CLASS_MON, MSG_MON_HW,           0,                        &AP_GPS_UBLOX::_parse_mon,         "MON-HW" },
+    { CLASS_MON, MSG_MON_HW2,          0,                        &AP_GPS_UBLOX::_parse_mon,         "MON-HW2" },
+    { CLASS_MON, MSG_MON_VER,          0,                        &AP_GPS_UBLOX::_parse_mon,         "MON-VER" },
+    { CLASS_ACK, MSG_ACK_ACK,          sizeof(ubx_ack_ack),      &AP_GPS_UBLOX::_parse_ack,         "ACK-ACK" },
+    { CLASS_ACK, MSG_ACK_NACK,         sizeof(ubx_ack_nack),     &AP_GPS_UBLOX::_parse_ack,         "ACK-NAK" },
+    { CLASS_CFG, MSG_CFG_NAV_SETTINGS, 0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-NAV5" },
+#if UBLOX_GNSS_SETTINGS
+    { CLASS_CFG, MSG_CFG_GNSS,         0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-GNSS" },
+#endif
+    { CLASS_CFG, MSG_CFG_SBAS,         0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-SBAS" },
+    { CLASS_CFG, MSG_CFG_MSG,          0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-MSG" },
+    { CLASS_CFG, MSG_CFG_PRT,          0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-PRT" },
+    { CLASS_CFG, MSG_CFG_RATE,         0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-RATE" },
+#if CONFIGURE_PPS_PIN
+    { CLASS_CFG, MSG_CFG_TP5,          0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-TP5" },
+#endif
+    { CLASS_CFG, MSG_CFG_VALGET,       0,                        &AP_GPS_UBLOX::_parse_cfg,         "CFG-VALGET" },
+#if UBLOX_RXM_RAW_LOGGING
+    { CLASS_RXM, MSG_RXM_RAW,          0,                        &AP_GPS_UBLOX::_parse_rxm_raw,     "RXM-RAW" },
+    { CLASS_RXM, MSG_RXM_RAWX,         0,                        &AP_GPS_UBLOX::_parse_rxm_raw,     "RXM-RAWX" },
+#endif
+#if UBLOX_TIM_TM2_LOGGING
+    { CLASS_TIM, MSG_TIM_TM2,          0,                        &AP_GPS_UBLOX::_parse_tim_tm2,     "TIM-TM2" },
+#endif
+};
+
+constexpr size_t AP_GPS_UBLOX::_ubx_msg_count = sizeof(_ubx_msgs) / sizeof(_ubx_msgs[0]);
+
+constexpr AP_GPS_UBLOX::ubx_index_t
+AP_GPS_UBLOX::_make_ubx_index(void)
+{
+    ubx_index_t index {};
+    uint8_t rows = 0;
+    for (size_t i = 0; i < _ubx_msg_count; i++) {
+        const ubx_msg_t &m = _ubx_msgs[i];
+        if (index.row[m.msg_class] == 0) {
+            index.row[m.msg_class] = ++rows;
+        }
+        index.slot[index.row[m.msg_class]][m.msg_id] = (uint8_t)(i + 1);
+    }
+    return index;
+}
+
+constexpr AP_GPS_UBLOX::ubx_index_t AP_GPS_UBLOX::_ubx_index = _make_ubx_index();
+
 bool
 AP_GPS_UBLOX::_parse_gps(void)
 {
-    if (_class == CLASS_ACK) {
-        Debug("ACK %u", (unsigned)_msg_id);
-
-        if(_msg_id == MSG_ACK_ACK) {
-            switch(_buffer.ack.clsID) {
-            case CLASS_CFG:
-                switch(_buffer.ack.msgID) {
-                case MSG_CFG_CFG:
-                    _cfg_saved = true;
-                    _cfg_needs_save = false;
-                    break;
-                case MSG_CFG_GNSS:
-                    _unconfigured_messages &= ~CONFIG_GNSS;
-                    break;
-                case MSG_CFG_MSG:
-                    // There is no way to know what MSG config was ack'ed, assume it was the last
-                    // one requested. To verify it rerequest the last config we sent. If we miss
-                    // the actual ack we will catch it next time through the poll loop, but that
-                    // will be a good chunk of time later.
-                    break;
-                case MSG_CFG_NAV_SETTINGS:
-                    _unconfigured_messages &= ~CONFIG_NAV_SETTINGS;
-                    break;
-                case MSG_CFG_RATE:
-                    // The GPS will ACK a update rate that is invalid. in order to detect this
-                    // only accept the rate as configured by reading the settings back and
-                    // validating that they all match the target values
-                    break;
-                case MSG_CFG_SBAS:
-                    _unconfigured_messages &= ~CONFIG_SBAS;
-                    break;
-                case MSG_CFG_TP5:
-                    _unconfigured_messages &= ~CONFIG_TP5;
-                    break;
-                }
+    static_assert(_ubx_msg_count < UBX_MSG_HANDLERS_MAX, "raise UBX_MSG_HANDLERS_MAX");
+
+    const uint8_t slot = _ubx_index.slot[_ubx_index.row[_class]][_msg_id];
+    ubx_msg_stats_t &stats = _msg_stats[slot ? slot - 1 : _ubx_msg_count];
+    stats.count++;
+    if (slot == 0) {
+        if (_class == CLASS_NAV) {
+            Debug("Unexpected NAV message 0x%02x", (unsigned)_msg_id);
+            if (++_disable_counter == 0) {
+                Debug("Disabling NAV message 0x%02x", (unsigned)_msg_id);
+                _configure_message_rate(CLASS_NAV, _msg_id, 0);
+            }
+        } else if (_class != CLASS_ACK) {
+            unexpected_message();
+        }
+        return false;
+    }
+
+    const ubx_msg_t &msg = _ubx_msgs[slot - 1];
+    if (_payload_length < msg.min_length) {
+        Debug("short %s %u", msg.name, (unsigned)_payload_length);
+        stats.short_length++;
+        return false;
+    }
+    // config handlers answer with I_write round trips, keep those out of the decode time
+    const uint32_t write_us = _write_us;
+    const uint32_t start_us = I_micros();
+    (this->*msg.handler)();
+    const uint32_t blocked_us = _write_us - write_us;
+    const uint32_t us = I_micros() - start_us - blocked_us;
+    stats.write_us_total += blocked_us;
+    stats.us_total += us;
+    if (us > stats.us_max) {
+        stats.us_max = us;
+    }
+
+    if (_class != CLASS_NAV) {
+        return false;
+    }
+
+    // we only return true when we get new position and speed data
+    // this ensures we don't use stale data
+    if (_new_position && _new_speed && _last_vel_time == _last_pos_time) {
+        _new_speed = _new_position = false;
+        return true;
+    }
+    return false;
+}
+
+bool
+AP_GPS_UBLOX::msg_stats(size_t i, const char **name, ubx_msg_stats_t *stats) const
+{
+    if (i > _ubx_msg_count) {
+        return false;
+    }
+    *name = i < _ubx_msg_count ? _ubx_msgs[i].name : "other";
+    *stats = _msg_stats[i];
+    return true;
+}
 
+void
+AP_GPS_UBLOX::_parse_ack(void)
+{
+    Debug("ACK %u", (unsigned)_msg_id);
+
+    if(_msg_id == MSG_ACK_ACK) {
+        switch(_buffer.ack.clsID) {
+        case CLASS_CFG:
+            switch(_buffer.ack.msgID) {
+            case MSG_CFG_CFG:
+                _cfg_saved = true;
+                _cfg_needs_save = false;
+                break;
+            case MSG_CFG_GNSS:
+                _unconfigured_messages &= ~CONFIG_GNSS;
+                break;
+            case MSG_CFG_MSG:
+                // There is no way to know what MSG config was ack'ed, assume it was the last
+                // one requested. To verify it rerequest the last config we sent. If we miss
+                // the actual ack we will catch it next time through the poll loop, but that
+                // will be a good chunk of time later.
+                break;
+            case MSG_CFG_NAV_SETTINGS:
+                _unconfigured_messages &= ~CONFIG_NAV_SETTINGS;
+                break;
+            case MSG_CFG_RATE:
+                // The GPS will ACK a update rate that is invalid. in order to detect this
+                // only accept the rate as configured by reading the settings back and
+                // validating that they all match the target values
+                break;
+            case MSG_CFG_SBAS:
+                _unconfigured_messages &= ~CONFIG_SBAS;
+                break;
+            case MSG_CFG_TP5:
+                _unconfigured_messages &= ~CONFIG_TP5;
+                break;
+            }
+
+            break;
+        case CLASS_MON:
+            switch(_buffer.ack.msgID) {
+            case MSG_MON_HW:
+                _unconfigured_messages &= ~CONFIG_RATE_MON_HW;
+                break;
+            case MSG_MON_HW2:
+                _unconfigured_messages &= ~CONFIG_RATE_MON_HW2;
                 break;
-            case CLASS_MON:
-                switch(_buffer.ack.msgID) {
-                case MSG_MON_HW:
-                    _unconfigured_messages &= ~CONFIG_RATE_MON_HW;
-                    break;
-                case MSG_MON_HW2:
-                    _unconfigured_messages &= ~CONFIG_RATE_MON_HW2;
-                    break;
-                }
             }
         }
-        if(_msg_id == MSG_ACK_NACK) {
-            switch(_buffer.nack.clsID) {
-            case CLASS_CFG:
-                switch(_buffer.nack.msgID) {
-                case MSG_CFG_VALGET:
-                    CFG_Debug("NACK VALGET 0x%x", (unsigned)_buffer.nack.msgID);
-                    if (active_config.list != nullptr) {
-                        /*
-                          likely this device does not support fetching multiple keys at once, go one at a time
-                        */
-                        if (active_config.fetch_index == -1) {
-                            CFG_Debug("NACK starting %u", unsigned(active_config.count));
-                            active_config.fetch_index = 0;
-                        } else {
-                            // the device does not support the config key we asked for,
-                            // consider the bit as done
-                            active_config.done_mask |= (1U<<active_config.fetch_index);
-                            CFG_Debug("NACK %d 0x%x done=0x%x",
-                                     int(active_config.fetch_index),
-                                     unsigned(active_config.list[active_config.fetch_index].key),
-                                     unsigned(active_config.done_mask));
-                            if (active_config.done_mask == (1U<<active_config.count)-1) {
-                                // all done!
-                                _unconfigured_messages &= ~active_config.unconfig_bit;
-                            }
-                            active_config.fetch_index++;
-                        }
-                        if (active_config.fetch_index < active_config.count) {
-                            _configure_valget(active_config.list[active_config.fetch_index].key);
+    }
+    if(_msg_id == MSG_ACK_NACK) {
+        switch(_buffer.nack.clsID) {
+        case CLASS_CFG:
+            switch(_buffer.nack.msgID) {
+            case MSG_CFG_VALGET:
+                CFG_Debug("NACK VALGET 0x%x", (unsigned)_buffer.nack.msgID);
+                if (active_config.list != nullptr) {
+                    /*
+                      likely this device does not support fetching multiple keys at once, go one at a time
+                    */
+                    if (active_config.fetch_index == -1) {
+                        CFG_Debug("NACK starting %u", unsigned(active_config.count));
+                        active_config.fetch_index = 0;
+                    } else {
+                        // the device does not support the config key we asked for,
+                        // consider the bit as done
+                        active_config.done_mask |= (1U<<active_config.fetch_index);
+                        CFG_Debug("NACK %d 0x%x done=0x%x",
+                                 int(active_config.fetch_index),
+                                 unsigned(active_config.list[active_config.fetch_index].key),
+                                 unsigned(active_config.done_mask));
+                        if (active_config.done_mask == (1U<<active_config.count)-1) {
+                            // all done!
+                            _unconfigured_messages &= ~active_config.unconfig_bit;
                         }
+                        active_config.fetch_index++;
                     }
-                    break;
-                case MSG_CFG_VALSET:
-                    CFG_Debug("NACK VALSET 0x%x 0x%x", (unsigned)_buffer.nack.msgID,
-                            unsigned(active_config.list[active_config.set_index].key));
-                    if (is_gnss_key(active_config.list[active_config.set_index].key)) {
-                            interface_printf("GPS: unable to configure band 0x%02x", unsigned(active_config.list[active_config.set_index].key));
-
+                    if (active_config.fetch_index < active_config.count) {
+                        _configure_valget(active_config.list[active_config.fetch_index].key);
                     }
-                    break;
                 }
+                break;
+            case MSG_CFG_VALSET:
+                CFG_Debug("NACK VALSET 0x%x 0x%x", (unsigned)_buffer.nack.msgID,
+                        unsigned(active_config.list[active_config.set_index].key));
+                if (is_gnss_key(active_config.list[active_config.set_index].key)) {
+                        interface_printf("GPS: unable to configure band 0x%02x", unsigned(active_config.list[active_config.set_index].key));
+
+                }
+                break;
             }
         }
-        return false;
     }
+}
 
-    if (_class == CLASS_CFG) {
-        switch(_msg_id) {
-        case  MSG_CFG_NAV_SETTINGS:
+void
+AP_GPS_UBLOX::_parse_cfg(void)
+{
+    switch(_msg_id) {
+    case  MSG_CFG_NAV_SETTINGS:
 	    Debug("Got settings %u min_elev %d drLimit %u\n", 
-                  (unsigned)_buffer.nav_settings.dynModel,
-                  (int)_buffer.nav_settings.minElev,
-                  (unsigned)_buffer.nav_settings.drLimit);
-            _buffer.nav_settings.mask = 0;
-            if (_navfilter != GPS_ENGINE_NONE &&
-                _buffer.nav_settings.dynModel != _navfilter) {
-                // we've received the current nav settings, change the engine
-                // settings and send them back
-                Debug("Changing engine setting from %u to %u\n",
-                      (unsigned)_buffer.nav_settings.dynModel, (unsigned)_navfilter);
-                _buffer.nav_settings.dynModel = _navfilter;
-                _buffer.nav_settings.mask |= 1;
-            }
-            if (_min_elevation != -100 &&
-                _buffer.nav_settings.minElev != _min_elevation) {
-                Debug("Changing min elevation to %d\n", (int)_min_elevation);
-                _buffer.nav_settings.minElev = _min_elevation;
-                _buffer.nav_settings.mask |= 2;
-            }
-            if (_buffer.nav_settings.mask != 0) {
-                _send_message(CLASS_CFG, MSG_CFG_NAV_SETTINGS,
-                              &_buffer.nav_settings,
-                              sizeof(_buffer.nav_settings));
-                _unconfigured_messages |= CONFIG_NAV_SETTINGS;
-                _cfg_needs_save = true;
-            } else {
-                _unconfigured_messages &= ~CONFIG_NAV_SETTINGS;
-            }
-            return false;
+              (unsigned)_buffer.nav_settings.dynModel,
+              (int)_buffer.nav_settings.minElev,
+              (unsigned)_buffer.nav_settings.drLimit);
+        _buffer.nav_settings.mask = 0;
+        if (_navfilter != GPS_ENGINE_NONE &&
+            _buffer.nav_settings.dynModel != _navfilter) {
+            // we've received the current nav settings, change the engine
+            // settings and send them back
+            Debug("Changing engine setting from %u to %u\n",
+                  (unsigned)_buffer.nav_settings.dynModel, (unsigned)_navfilter);
+            _buffer.nav_settings.dynModel = _navfilter;
+            _buffer.nav_settings.mask |= 1;
+        }
+        if (_min_elevation != -100 &&
+            _buffer.nav_settings.minElev != _min_elevation) {
+            Debug("Changing min elevation to %d\n", (int)_min_elevation);
+            _buffer.nav_settings.minElev = _min_elevation;
+            _buffer.nav_settings.mask |= 2;
+        }
+        if (_buffer.nav_settings.mask != 0) {
+            _send_message(CLASS_CFG, MSG_CFG_NAV_SETTINGS,
+                          &_buffer.nav_settings,
+                          sizeof(_buffer.nav_settings));
+            _unconfigured_messages |= CONFIG_NAV_SETTINGS;
+            _cfg_needs_save = true;
+        } else {
+            _unconfigured_messages &= ~CONFIG_NAV_SETTINGS;
+        }
+        return;
 
 #if UBLOX_GNSS_SETTINGS
-        case MSG_CFG_GNSS:
-            if (gnss_mode != 0 && !supports_F9_config()) {
-                struct ubx_cfg_gnss start_gnss = _buffer.gnss;
-                uint8_t gnssCount = 0;
-                Debug("Got GNSS Settings %u %u %u %u:\n",
-                    (unsigned)_buffer.gnss.msgVer,
-                    (unsigned)_buffer.gnss.numTrkChHw,
-                    (unsigned)_buffer.gnss.numTrkChUse,
-                    (unsigned)_buffer.gnss.numConfigBlocks);
+    case MSG_CFG_GNSS:
+        if (gnss_mode != 0 && !supports_F9_config()) {
+            struct ubx_cfg_gnss start_gnss = _buffer.gnss;
+            uint8_t gnssCount = 0;
+            Debug("Got GNSS Settings %u %u %u %u:\n",
+                (unsigned)_buffer.gnss.msgVer,
+                (unsigned)_buffer.gnss.numTrkChHw,
+                (unsigned)_buffer.gnss.numTrkChUse,
+                (unsigned)_buffer.gnss.numConfigBlocks);
 #if UBLOX_DEBUGGING
-                for(int i = 0; i < _buffer.gnss.numConfigBlocks; i++) {
-                    Debug("  %u %u %u 0x%08x\n",
-                    (unsigned)_buffer.gnss.configBlock[i].gnssId,
-                    (unsigned)_buffer.gnss.configBlock[i].resTrkCh,
-                    (unsigned)_buffer.gnss.configBlock[i].maxTrkCh,
-                    (unsigned)_buffer.gnss.configBlock[i].flags);
-                }
+            for(int i = 0; i < _buffer.gnss.numConfigBlocks; i++) {
+                Debug("  %u %u %u 0x%08x\n",
+                (unsigned)_buffer.gnss.configBlock[i].gnssId,
+                (unsigned)_buffer.gnss.configBlock[i].resTrkCh,
+                (unsigned)_buffer.gnss.configBlock[i].maxTrkCh,
+                (unsigned)_buffer.gnss.configBlock[i].flags);
+            }
 #endif
 
-                for(int i = 0; i < UBLOX_MAX_GNSS_CONFIG_BLOCKS; i++) {
-                    if((gnss_mode & (1 << i)) && i != GNSS_SBAS) {
-                        gnssCount++;
-                    }
+            for(int i = 0; i < UBLOX_MAX_GNSS_CONFIG_BLOCKS; i++) {
+                if((gnss_mode & (1 << i)) && i != GNSS_SBAS) {
+                    gnssCount++;
                 }
-                for(int i = 0; i < _buffer.gnss.numConfigBlocks; i++) {
-                    // Reserve an equal portion of channels for all enabled systems that supports it
-                    if(gnss_mode & (1 << _buffer.gnss.configBlock[i].gnssId)) {
-                        if(GNSS_SBAS !=_buffer.gnss.configBlock[i].gnssId && (_hardware_generation > UBLOX_M8 || GNSS_GALILEO !=_buffer.gnss.configBlock[i].gnssId)) {
+            }
+            for(int i = 0; i < _buffer.gnss.numConfigBlocks; i++) {
+                // Reserve an equal portion of channels for all enabled systems that supports it
+                if(gnss_mode & (1 << _buffer.gnss.configBlock[i].gnssId)) {
+                    if(GNSS_SBAS !=_buffer.gnss.configBlock[i].gnssId && (_hardware_generation > UBLOX_M8 || GNSS_GALILEO !=_buffer.gnss.configBlock[i].gnssId)) {
+                        _buffer.gnss.configBlock[i].resTrkCh = (_buffer.gnss.numTrkChHw - 3) / (gnssCount * 2);
+                        _buffer.gnss.configBlock[i].maxTrkCh = _buffer.gnss.numTrkChHw;
+                    } else {
+                        if(GNSS_SBAS ==_buffer.gnss.configBlock[i].gnssId) {
+                            _buffer.gnss.configBlock[i].resTrkCh = 1;
+                            _buffer.gnss.configBlock[i].maxTrkCh = 3;
+                        }
+                        if(GNSS_GALILEO ==_buffer.gnss.configBlock[i].gnssId) {
                             _buffer.gnss.configBlock[i].resTrkCh = (_buffer.gnss.numTrkChHw - 3) / (gnssCount * 2);
-                            _buffer.gnss.configBlock[i].maxTrkCh = _buffer.gnss.numTrkChHw;
-                        } else {
-                            if(GNSS_SBAS ==_buffer.gnss.configBlock[i].gnssId) {
-                                _buffer.gnss.configBlock[i].resTrkCh = 1;
-                                _buffer.gnss.configBlock[i].maxTrkCh = 3;
-                            }
-                            if(GNSS_GALILEO ==_buffer.gnss.configBlock[i].gnssId) {
-                                _buffer.gnss.configBlock[i].resTrkCh = (_buffer.gnss.numTrkChHw - 3) / (gnssCount * 2);
-                                _buffer.gnss.configBlock[i].maxTrkCh = 8; //Per the M8 receiver description UBX-13003221 - R16, 4.1.1.3 it is not recommended to set the number of galileo channels higher then eight
-                            }
+                            _buffer.gnss.configBlock[i].maxTrkCh = 8; //Per the M8 receiver description UBX-13003221 - R16, 4.1.1.3 it is not recommended to set the number of galileo channels higher then eight
                         }
-                        _buffer.gnss.configBlock[i].flags = _buffer.gnss.configBlock[i].flags | 0x00000001;
-                    } else {
-                        _buffer.gnss.configBlock[i].resTrkCh = 0;
-                        _buffer.gnss.configBlock[i].maxTrkCh = 0;
-                        _buffer.gnss.configBlock[i].flags = _buffer.gnss.configBlock[i].flags & 0xFFFFFFFE;
                     }
-                }
-                if (memcmp(&start_gnss, &_buffer.gnss, sizeof(start_gnss))) {
-                    _send_message(CLASS_CFG, MSG_CFG_GNSS, &_buffer.gnss, 4 + (8 * _buffer.gnss.numConfigBlocks));
-                    _unconfigured_messages |= CONFIG_GNSS;
-                    _cfg_needs_save = true;
+                    _buffer.gnss.configBlock[i].flags = _buffer.gnss.configBlock[i].flags | 0x00000001;
                 } else {
-                    _unconfigured_messages &= ~CONFIG_GNSS;
+                    _buffer.gnss.configBlock[i].resTrkCh = 0;
+                    _buffer.gnss.configBlock[i].maxTrkCh = 0;
+                    _buffer.gnss.configBlock[i].flags = _buffer.gnss.configBlock[i].flags & 0xFFFFFFFE;
                 }
+            }
+            if (memcmp(&start_gnss, &_buffer.gnss, sizeof(start_gnss))) {
+                _send_message(CLASS_CFG, MSG_CFG_GNSS, &_buffer.gnss, 4 + (8 * _buffer.gnss.numConfigBlocks));
+                _unconfigured_messages |= CONFIG_GNSS;
+                _cfg_needs_save = true;
             } else {
                 _unconfigured_messages &= ~CONFIG_GNSS;
             }
-            return false;
+        } else {
+            _unconfigured_messages &= ~CONFIG_GNSS;
+        }
+        return;
 #endif
 
-        case MSG_CFG_SBAS:
-            if (_sbas_mode != SBAS_Mode::DoNotChange) {
+    case MSG_CFG_SBAS:
+        if (_sbas_mode != SBAS_Mode::DoNotChange) {
 	        Debug("Got SBAS settings %u %u %u 0x%x 0x%x\n", 
-                      (unsigned)_buffer.sbas.mode,
-                      (unsigned)_buffer.sbas.usage,
-                      (unsigned)_buffer.sbas.maxSBAS,
-                      (unsigned)_buffer.sbas.scanmode2,
-                      (unsigned)_buffer.sbas.scanmode1);
-                if (_buffer.sbas.mode != _sbas_mode) {
-                    _buffer.sbas.mode = _sbas_mode;
-                    _send_message(CLASS_CFG, MSG_CFG_SBAS,
-                                  &_buffer.sbas,
-                                  sizeof(_buffer.sbas));
-                    _unconfigured_messages |= CONFIG_SBAS;
-                    _cfg_needs_save = true;
-                } else {
-                    _unconfigured_messages &= ~CONFIG_SBAS;
-                }
-            } else {
-                    _unconfigured_messages &= ~CONFIG_SBAS;
-            }
-            return false;
-        case MSG_CFG_MSG:
-            if(_payload_length == sizeof(ubx_cfg_msg_rate_6)) {
-                // can't verify the setting without knowing the port
-                // request the port again
-                if(_ublox_port >= UBLOX_MAX_PORTS) {
-                    _request_port();
-                    return false;
-                }
-                _verify_rate(_buffer.msg_rate_6.msg_class, _buffer.msg_rate_6.msg_id,
-                             _buffer.msg_rate_6.rates[_ublox_port]);
-            } else {
-                _verify_rate(_buffer.msg_rate.msg_class, _buffer.msg_rate.msg_id,
-                             _buffer.msg_rate.rate);
-            }
-            return false;
-        case MSG_CFG_PRT:
-           _ublox_port = _buffer.prt.portID;
-           return false;
-        case MSG_CFG_RATE:
-            if(_buffer.nav_rate.measure_rate_ms != rate_ms ||
-               _buffer.nav_rate.nav_rate != 1 ||
-               _buffer.nav_rate.timeref != 0) {
-               _configure_rate();
-                _unconfigured_messages |= CONFIG_RATE_NAV;
+                  (unsigned)_buffer.sbas.mode,
+                  (unsigned)_buffer.sbas.usage,
+                  (unsigned)_buffer.sbas.maxSBAS,
+                  (unsigned)_buffer.sbas.scanmode2,
+                  (unsigned)_buffer.sbas.scanmode1);
+            if (_buffer.sbas.mode != _sbas_mode) {
+                _buffer.sbas.mode = _sbas_mode;
+                _send_message(CLASS_CFG, MSG_CFG_SBAS,
+                              &_buffer.sbas,
+                              sizeof(_buffer.sbas));
+                _unconfigured_messages |= CONFIG_SBAS;
                 _cfg_needs_save = true;
             } else {
-                _unconfigured_messages &= ~CONFIG_RATE_NAV;
+                _unconfigured_messages &= ~CONFIG_SBAS;
+            }
+        } else {
+                _unconfigured_messages &= ~CONFIG_SBAS;
+        }
+        return;
+    case MSG_CFG_MSG:
+        if(_payload_length == sizeof(ubx_cfg_msg_rate_6)) {
+            // can't verify the setting without knowing the port
+            // request the port again
+            if(_ublox_port >= UBLOX_MAX_PORTS) {
+                _request_port();
+                return;
             }
-            return false;
-            
+            _verify_rate(_buffer.msg_rate_6.msg_class, _buffer.msg_rate_6.msg_id,
+                         _buffer.msg_rate_6.rates[_ublox_port]);
+        } else {
+            _verify_rate(_buffer.msg_rate.msg_class, _buffer.msg_rate.msg_id,
+                         _buffer.msg_rate.rate);
+        }
+        return;
+    case MSG_CFG_PRT:
+       _ublox_port = _buffer.prt.portID;
+       return;
+    case MSG_CFG_RATE:
+        if(_buffer.nav_rate.measure_rate_ms != rate_ms ||
+           _buffer.nav_rate.nav_rate != 1 ||
+           _buffer.nav_rate.timeref != 0) {
+           _configure_rate();
+            _unconfigured_messages |= CONFIG_RATE_NAV;
+            _cfg_needs_save = true;
+        } else {
+            _unconfigured_messages &= ~CONFIG_RATE_NAV;
+        }
+        return;
+        
 #if CONFIGURE_PPS_PIN
-        case MSG_CFG_TP5: {
-            // configure the PPS pin for 1Hz, zero delay
-            Debug("Got TP5 ver=%u 0x%04x %u\n", 
-                  (unsigned)_buffer.nav_tp5.version,
-                  (unsigned)_buffer.nav_tp5.flags,
-                  (unsigned)_buffer.nav_tp5.freqPeriod);
+    case MSG_CFG_TP5: {
+        // configure the PPS pin for 1Hz, zero delay
+        Debug("Got TP5 ver=%u 0x%04x %u\n", 
+              (unsigned)_buffer.nav_tp5.version,
+              (unsigned)_buffer.nav_tp5.flags,
+              (unsigned)_buffer.nav_tp5.freqPeriod);
 #ifdef HAL_GPIO_PPS
-            hal.gpio->attach_interrupt(HAL_GPIO_PPS, FUNCTOR_BIND_MEMBER(&AP_GPS_UBLOX::pps_interrupt, void, uint8_t, bool, uint32_t), AP_HAL::GPIO::INTERRUPT_FALLING);
+        hal.gpio->attach_interrupt(HAL_GPIO_PPS, FUNCTOR_BIND_MEMBER(&AP_GPS_UBLOX::pps_interrupt, void, uint8_t, bool, uint32_t), AP_HAL::GPIO::INTERRUPT_FALLING);
 #endif
-            const uint16_t desired_flags = 0x003f;
-            const uint16_t desired_period_hz = _pps_freq;
-
-            if (_buffer.nav_tp5.flags != desired_flags ||
-                _buffer.nav_tp5.freqPeriod != desired_period_hz) {
-                _buffer.nav_tp5.tpIdx = 0;
-                _buffer.nav_tp5.reserved1[0] = 0;
-                _buffer.nav_tp5.reserved1[1] = 0;
-                _buffer.nav_tp5.antCableDelay = 0;
-                _buffer.nav_tp5.rfGroupDelay = 0;
-                _buffer.nav_tp5.freqPeriod = desired_period_hz;
-                _buffer.nav_tp5.freqPeriodLock = desired_period_hz;
-                _buffer.nav_tp5.pulseLenRatio = 1;
-                _buffer.nav_tp5.pulseLenRatioLock = 2;
-                _buffer.nav_tp5.userConfigDelay = 0;
-                _buffer.nav_tp5.flags = desired_flags;
-                _send_message(CLASS_CFG, MSG_CFG_TP5,
-                              &_buffer.nav_tp5,
-                              sizeof(_buffer.nav_tp5));
-                _unconfigured_messages |= CONFIG_TP5;
-                _cfg_needs_save = true;
-            } else {
-                _unconfigured_messages &= ~CONFIG_TP5;
-            }
-            return false;
+        const uint16_t desired_flags = 0x003f;
+        const uint16_t desired_period_hz = _pps_freq;
+
+        if (_buffer.nav_tp5.flags != desired_flags ||
+            _buffer.nav_tp5.freqPeriod != desired_period_hz) {
+            _buffer.nav_tp5.tpIdx = 0;
+            _buffer.nav_tp5.reserved1[0] = 0;
+            _buffer.nav_tp5.reserved1[1] = 0;
+            _buffer.nav_tp5.antCableDelay = 0;
+            _buffer.nav_tp5.rfGroupDelay = 0;
+            _buffer.nav_tp5.freqPeriod = desired_period_hz;
+            _buffer.nav_tp5.freqPeriodLock = desired_period_hz;
+            _buffer.nav_tp5.pulseLenRatio = 1;
+            _buffer.nav_tp5.pulseLenRatioLock = 2;
+            _buffer.nav_tp5.userConfigDelay = 0;
+            _buffer.nav_tp5.flags = desired_flags;
+            _send_message(CLASS_CFG, MSG_CFG_TP5,
+                          &_buffer.nav_tp5,
+                          sizeof(_buffer.nav_tp5));
+            _unconfigured_messages |= CONFIG_TP5;
+            _cfg_needs_save = true;
+        } else {
+            _unconfigured_messages &= ~CONFIG_TP5;
         }
+        return;
+    }
 #endif // CONFIGURE_PPS_PIN
-        case MSG_CFG_VALGET: {
-            uint8_t cfg_len = _payload_length - sizeof(ubx_cfg_valget);
-            const uint8_t *cfg_data = (const uint8_t *)(&_buffer) + sizeof(ubx_cfg_valget);
-            while (cfg_len >= 5) {
-                ConfigKey id;
-                memcpy(&id, cfg_data, sizeof(uint32_t));
-                cfg_len -= 4;
-                cfg_data += 4;
-                switch (id) {
-                    case ConfigKey::TMODE_MODE: {
-                        uint8_t mode = cfg_data[0];
-                        if (mode != 0) {
-                            // ask for mode 0, to disable TIME mode
-                            mode = 0;
-                            _configure_valset(ConfigKey::TMODE_MODE, &mode);
-                            _cfg_needs_save = true;
-                            _unconfigured_messages |= CONFIG_TMODE_MODE;
-                        } else {
-                            _unconfigured_messages &= ~CONFIG_TMODE_MODE;
-                        }
-                        break;
-                    }
-                    default:
-                        break;
-                }
-                // see if it is in active config list
-                int8_t cfg_idx = find_active_config_index(id);
-                if (cfg_idx >= 0) {
-                    CFG_Debug("valset(0x%lx): %u", uint32_t(id), (*cfg_data) & 0x1);
-                    const uint8_t key_size = config_key_size(id);
-                    if (cfg_len < key_size
-                        // for keys of length 1 only the LSB is significant
-                        || (key_size == 1 && (active_config.list[cfg_idx].value & 0x1) != (*cfg_data & 0x1))
-                        || memcmp(&active_config.list[cfg_idx].value, cfg_data, key_size) != 0) {
-                        _configure_valset(id, &active_config.list[cfg_idx].value, active_config.layers);
-                        _unconfigured_messages |= active_config.unconfig_bit;
-                        active_config.done_mask &= ~(1U << cfg_idx);
-                        active_config.set_index = cfg_idx;
+    case MSG_CFG_VALGET: {
+        uint8_t cfg_len = _payload_length - sizeof(ubx_cfg_valget);
+        const uint8_t *cfg_data = (const uint8_t *)(&_buffer) + sizeof(ubx_cfg_valget);
+        while (cfg_len >= 5) {
+            ConfigKey id;
+            memcpy(&id, cfg_data, sizeof(uint32_t));
+            cfg_len -= 4;
+            cfg_data += 4;
+            switch (id) {
+                case ConfigKey::TMODE_MODE: {
+                    uint8_t mode = cfg_data[0];
+                    if (mode != 0) {
+                        // ask for mode 0, to disable TIME mode
+                        mode = 0;
+                        _configure_valset(ConfigKey::TMODE_MODE, &mode);
                         _cfg_needs_save = true;
+                        _unconfigured_messages |= CONFIG_TMODE_MODE;
                     } else {
-                        active_config.done_mask |= (1U << cfg_idx);
-                        CFG_Debug("done %u mask=0x%x all_mask=0x%x",
-                                  unsigned(cfg_idx),
-                                  unsigned(active_config.done_mask),
-                                  (1U<<active_config.count)-1);
-                        if (active_config.done_mask == (1U<<active_config.count)-1) {
-                            // all done!
-                            _unconfigured_messages &= ~active_config.unconfig_bit;
-                        }
-                    }
-                    if (active_config.fetch_index >= 0 &&
-                        active_config.fetch_index < active_config.count &&
-                        id == active_config.list[active_config.fetch_index].key) {
-                        active_config.fetch_index++;
-                        if (active_config.fetch_index < active_config.count) {
-                            _configure_valget(active_config.list[active_config.fetch_index].key);
-                            CFG_Debug("valget %d 0x%x", int(active_config.fetch_index),
-                                  unsigned(active_config.list[active_config.fetch_index].key));
-                        }
+                        _unconfigured_messages &= ~CONFIG_TMODE_MODE;
                     }
+                    break;
+                }
+                default:
+                    break;
+            }
+            // see if it is in active config list
+            int8_t cfg_idx = find_active_config_index(id);
+            if (cfg_idx >= 0) {
+                CFG_Debug("valset(0x%lx): %u", uint32_t(id), (*cfg_data) & 0x1);
+                const uint8_t key_size = config_key_size(id);
+                if (cfg_len < key_size
+                    // for keys of length 1 only the LSB is significant
+                    || (key_size == 1 && (active_config.list[cfg_idx].value & 0x1) != (*cfg_data & 0x1))
+                    || memcmp(&active_config.list[cfg_idx].value, cfg_data, key_size) != 0) {
+                    _configure_valset(id, &active_config.list[cfg_idx].value, active_config.layers);
+                    _unconfigured_messages |= active_config.unconfig_bit;
+                    active_config.done_mask &= ~(1U << cfg_idx);
+                    active_config.set_index = cfg_idx;
+                    _cfg_needs_save = true;
                 } else {
-                    CFG_Debug("valget no active config for 0x%lx", (uint32_t)id);
+                    active_config.done_mask |= (1U << cfg_idx);
+                    CFG_Debug("done %u mask=0x%x all_mask=0x%x",
+                              unsigned(cfg_idx),
+                              unsigned(active_config.done_mask),
+                              (1U<<active_config.count)-1);
+                    if (active_config.done_mask == (1U<<active_config.count)-1) {
+                        // all done!
+                        _unconfigured_messages &= ~active_config.unconfig_bit;
+                    }
                 }
-
-                // step over the value
-                uint8_t step_size = config_key_size(id);
-                if (step_size == 0) {
-                    return false;
+                if (active_config.fetch_index >= 0 &&
+                    active_config.fetch_index < active_config.count &&
+                    id == active_config.list[active_config.fetch_index].key) {
+                    active_config.fetch_index++;
+                    if (active_config.fetch_index < active_config.count) {
+                        _configure_valget(active_config.list[active_config.fetch_index].key);
+                        CFG_Debug("valget %d 0x%x", int(active_config.fetch_index),
+                              unsigned(active_config.list[active_config.fetch_index].key));
+                    }
                 }
-                cfg_len -= step_size;
-                cfg_data += step_size;
+            } else {
+                CFG_Debug("valget no active config for 0x%lx", (uint32_t)id);
             }
+
+            // step over the value
+            uint8_t step_size = config_key_size(id);
+            if (step_size == 0) {
+                return;
+            }
+            cfg_len -= step_size;
+            cfg_data += step_size;
         }
-        }
+    }
     }
 
-    if (_class == CLASS_MON) {
-        switch(_msg_id) {
-        case MSG_MON_HW:
-            if (_payload_length == 60 || _payload_length == 68) {
-                log_mon_hw();
-            }
-            break;
-        case MSG_MON_HW2:
-            if (_payload_length == 28) {
-                log_mon_hw2();  
-            }
-            break;
-        case MSG_MON_VER: {
-            bool check_L1L5 = false;
-            _have_version = true;
-            strncpy(_version.hwVersion, _buffer.mon_ver.hwVersion, sizeof(_version.hwVersion));
-            strncpy(_version.swVersion, _buffer.mon_ver.swVersion, sizeof(_version.swVersion));
-            void* mod = memmem(_buffer.mon_ver.extension, sizeof(_buffer.mon_ver.extension), "MOD=", 4);
-            if (mod != nullptr) {
-                strncpy(_module, (char*)mod+4, UBLOX_MODULE_LEN-1);
-            }
+    // replies that fall out of the switch count as unexpected
+    unexpected_message();
+}
 
-            // check for F9 and M9. The F9 does not respond to SVINFO,
-            // so we need to use MON_VER for hardware generation
-            if (strncmp(_version.hwVersion, "00190000", 8) == 0) {
-                if (strncmp(_version.swVersion, "EXT CORE 1", 10) == 0) {
-                    // a F9
-                    if (_hardware_generation != UBLOX_F9) {
-                        // need to ensure time mode is correctly setup on F9
-                        _unconfigured_messages |= CONFIG_TMODE_MODE;
-                    }
-                    _hardware_generation = UBLOX_F9;
-                    _unconfigured_messages |= CONFIG_F9;
-                    _unconfigured_messages &= ~CONFIG_GNSS;
-                    if (strncmp(_module, "ZED-F9P", UBLOX_MODULE_LEN) == 0) {
-                        _hardware_variant = UBLOX_F9_ZED;
-                    } else if (strncmp(_module, "NEO-F9P", UBLOX_MODULE_LEN) == 0) {
-                        _hardware_variant = UBLOX_F9_NEO;
-                    }
+void
+AP_GPS_UBLOX::_parse_mon(void)
+{
+    switch(_msg_id) {
+    case MSG_MON_HW:
+        if (_payload_length == 60 || _payload_length == 68) {
+            log_mon_hw();
+        }
+        break;
+    case MSG_MON_HW2:
+        if (_payload_length == 28) {
+            log_mon_hw2();  
+        }
+        break;
+    case MSG_MON_VER: {
+        bool check_L1L5 = false;
+        _have_version = true;
+        strncpy(_version.hwVersion, _buffer.mon_ver.hwVersion, sizeof(_version.hwVersion));
+        strncpy(_version.swVersion, _buffer.mon_ver.swVersion, sizeof(_version.swVersion));
+        void* mod = memmem(_buffer.mon_ver.extension, sizeof(_buffer.mon_ver.extension), "MOD=", 4);
+        if (mod != nullptr) {
+            strncpy(_module, (char*)mod+4, UBLOX_MODULE_LEN-1);
+        }
+
+        // check for F9 and M9. The F9 does not respond to SVINFO,
+        // so we need to use MON_VER for hardware generation
+        if (strncmp(_version.hwVersion, "00190000", 8) == 0) {
+            if (strncmp(_version.swVersion, "EXT CORE 1", 10) == 0) {
+                // a F9
+                if (_hardware_generation != UBLOX_F9) {
+                    // need to ensure time mode is correctly setup on F9
+                    _unconfigured_messages |= CONFIG_TMODE_MODE;
                 }
-                if (strncmp(_version.swVersion, "EXT CORE 4", 10) == 0) {
-                    // a M9
-                    _hardware_generation = UBLOX_M9;
+                _hardware_generation = UBLOX_F9;
+                _unconfigured_messages |= CONFIG_F9;
+                _unconfigured_messages &= ~CONFIG_GNSS;
+                if (strncmp(_module, "ZED-F9P", UBLOX_MODULE_LEN) == 0) {
+                    _hardware_variant = UBLOX_F9_ZED;
+                } else if (strncmp(_module, "NEO-F9P", UBLOX_MODULE_LEN) == 0) {
+                    _hardware_variant = UBLOX_F9_NEO;
                 }
-                check_L1L5 = true;
             }
-            // check for M10
-            if (strncmp(_version.hwVersion, "000A0000", 8) == 0) {
-                _hardware_generation = UBLOX_M10;
-                _unconfigured_messages |= CONFIG_M10;
-                // M10 does not support CONFIG_GNSS
-                _unconfigured_messages &= ~CONFIG_GNSS;
-                check_L1L5 = true;
+            if (strncmp(_version.swVersion, "EXT CORE 4", 10) == 0) {
+                // a M9
+                _hardware_generation = UBLOX_M9;
             }
-            if (check_L1L5) {
-                // check if L1L5 in extension
-                if (memmem(_buffer.mon_ver.extension, sizeof(_buffer.mon_ver.extension), "L1L5", 4) != nullptr) {
-                    supports_l5 = true;
-                    interface_printf("u-blox supports L5 Band\n");
-                    _unconfigured_messages |= CONFIG_L5;
-                }
+            check_L1L5 = true;
+        }
+        // check for M10
+        if (strncmp(_version.hwVersion, "000A0000", 8) == 0) {
+            _hardware_generation = UBLOX_M10;
+            _unconfigured_messages |= CONFIG_M10;
+            // M10 does not support CONFIG_GNSS
+            _unconfigured_messages &= ~CONFIG_GNSS;
+            check_L1L5 = true;
+        }
+        if (check_L1L5) {
+            // check if L1L5 in extension
+            if (memmem(_buffer.mon_ver.extension, sizeof(_buffer.mon_ver.extension), "L1L5", 4) != nullptr) {
+                supports_l5 = true;
+                interface_printf("u-blox supports L5 Band\n");
+                _unconfigured_messages |= CONFIG_L5;
             }
+        }
 
-            char gen[40];
-            switch(_hardware_generation) {
-              case ANTARIS: strcpy(gen,"ANTARIS");break;
-              case UBLOX_5: strcpy(gen,"5");break;
-              case UBLOX_6: strcpy(gen,"6");break;
-              case UBLOX_7: strcpy(gen,"7");break;
-              case UBLOX_M8: strcpy(gen,"M8");break;
-              case UBLOX_F9: strcpy(gen,"F9");break;
-              case UBLOX_M9: strcpy(gen,"M9");break;
-              case UBLOX_M10: strcpy(gen,"M10");break;
-              case UBLOX_UNKNOWN_HARDWARE_GENERATION: strcpy(gen,"UNKNOWN");break;
-              default: strcpy(gen,"OTHER");
-            }
-            interface_printf("ublox-%s %s%s HW:%s SW:%s\n"
-                                             ,gen
-                                             ,_module
-                                             , mod != nullptr ? " " : ""
-                                             ,_version.hwVersion
-                                             ,_version.swVersion
-                                             );
+        char gen[40];
+        switch(_hardware_generation) {
+          case ANTARIS: strcpy(gen,"ANTARIS");break;
+          case UBLOX_5: strcpy(gen,"5");break;
+          case UBLOX_6: strcpy(gen,"6");break;
+          case UBLOX_7: strcpy(gen,"7");break;
+          case UBLOX_M8: strcpy(gen,"M8");break;
+          case UBLOX_F9: strcpy(gen,"F9");break;
+          case UBLOX_M9: strcpy(gen,"M9");break;
+          case UBLOX_M10: strcpy(gen,"M10");break;
+          case UBLOX_UNKNOWN_HARDWARE_GENERATION: strcpy(gen,"UNKNOWN");break;
+          default: strcpy(gen,"OTHER");
+        }
+        interface_printf("ublox-%s %s%s HW:%s SW:%s\n"
+                                         ,gen
+                                         ,_module
+                                         , mod != nullptr ? " " : ""
+                                         ,_version.hwVersion
+                                         ,_version.swVersion
+                                         );
 
-            break;
-        }
-        default:
-            unexpected_message();
-        }
-        return false;
+        break;
     }
+    default:
+        unexpected_message();
+    }
+}
 
 #if UBLOX_RXM_RAW_LOGGING
-    if (_class == CLASS_RXM && _msg_id == MSG_RXM_RAW && _raw_data != 0) {
+void
+AP_GPS_UBLOX::_parse_rxm_raw(void)
+{
+    if (_raw_data == 0) {
+        unexpected_message();
+    } else if (_msg_id == MSG_RXM_RAW) {
         log_rxm_raw(_buffer.rxm_raw);
-        return false;
-    } else if (_class == CLASS_RXM && _msg_id == MSG_RXM_RAWX && _raw_data != 0) {
+    } else {
         log_rxm_rawx(_buffer.rxm_rawx);
-        return false;
     }
+}
 #endif // UBLOX_RXM_RAW_LOGGING
 
 #if UBLOX_TIM_TM2_LOGGING
-    if ((_class == CLASS_TIM) && (_msg_id == MSG_TIM_TM2) && (_payload_length == 28)) {
-        log_tim_tm2();
-        return false;
+void
+AP_GPS_UBLOX::_parse_tim_tm2(void)
+{
+    if (_payload_length != 28) {
+        unexpected_message();
+        return;
     }
+    log_tim_tm2();
+}
 #endif // UBLOX_TIM_TM2_LOGGING
 
-    if (_class != CLASS_NAV) {
-        unexpected_message();
-        return false;
+void
+AP_GPS_UBLOX::_parse_nav_posllh(void)
+{
+    Debug("MSG_POSLLH next_fix=%u", next_fix);
+    if (havePvtMsg) {
+        _unconfigured_messages |= CONFIG_RATE_POSLLH;
+        return;
     }
-
-    switch (_msg_id) {
-    case MSG_POSLLH:
-        Debug("MSG_POSLLH next_fix=%u", next_fix);
-        if (havePvtMsg) {
-            _unconfigured_messages |= CONFIG_RATE_POSLLH;
-            break;
-        }
-        _check_new_itow(_buffer.posllh.itow);
-        _last_pos_time  = _buffer.posllh.itow;
-        state.lng    = _buffer.posllh.longitude;
-        state.lat    = _buffer.posllh.latitude;
-        state.have_undulation = true;
-        state.undulation = (_buffer.posllh.altitude_msl - _buffer.posllh.altitude_ellipsoid); //mm
-        state.alt = _buffer.posllh.altitude_msl;
-
-        state.status = next_fix;
-        _new_position = true;
-        state.horizontal_accuracy = _buffer.posllh.horizontal_accuracy; //mm
-        state.vertical_accuracy = _buffer.posllh.vertical_accuracy; //mm
-        state.have_horizontal_accuracy = true;
-        state.have_vertical_accuracy = true;
+    _check_new_itow(_buffer.posllh.itow);
+    _last_pos_time  = _buffer.posllh.itow;
+    state.lng    = _buffer.posllh.longitude;
+    state.lat    = _buffer.posllh.latitude;
+    state.have_undulation = true;
+    state.undulation = (_buffer.posllh.altitude_msl - _buffer.posllh.altitude_ellipsoid); //mm
+    state.alt = _buffer.posllh.altitude_msl;
+
+    state.status = next_fix;
+    _new_position = true;
+    state.horizontal_accuracy = _buffer.posllh.horizontal_accuracy; //mm
+    state.vertical_accuracy = _buffer.posllh.vertical_accuracy; //mm
+    state.have_horizontal_accuracy = true;
+    state.have_vertical_accuracy = true;
 #if UBLOX_FAKE_3DLOCK
-        state.lng = 1491652300L;
-        state.lat = -353632610L;
-        state.alt = 584000;
-        state.vertical_accuracy = 0;
-        state.horizontal_accuracy = 0;
+    state.lng = 1491652300L;
+    state.lat = -353632610L;
+    state.alt = 584000;
+    state.vertical_accuracy = 0;
+    state.horizontal_accuracy = 0;
 #endif
-        break;
-    case MSG_STATUS:
-        Debug("MSG_STATUS fix_status=%u fix_type=%u",
-              _buffer.status.fix_status,
-              _buffer.status.fix_type);
-        _check_new_itow(_buffer.status.itow);
-        if (havePvtMsg) {
-            _unconfigured_messages |= CONFIG_RATE_STATUS;
-            break;
-        }
-        if (_buffer.status.fix_status & NAV_STATUS_FIX_VALID) {
-            if( (_buffer.status.fix_type == AP_GPS_UBLOX::FIX_3D) &&
-                (_buffer.status.fix_status & AP_GPS_UBLOX::NAV_STATUS_DGPS_USED)) {
-                next_fix = GPS_OK_FIX_3D_DGPS;
-            }else if( _buffer.status.fix_type == AP_GPS_UBLOX::FIX_3D) {
-                next_fix = GPS_OK_FIX_3D;
-            }else if (_buffer.status.fix_type == AP_GPS_UBLOX::FIX_2D) {
-                next_fix = GPS_OK_FIX_2D;
-            }else{
-                next_fix = NO_FIX;
-                state.status = NO_FIX;
-            }
+}
+
+void
+AP_GPS_UBLOX::_parse_nav_status(void)
+{
+    Debug("MSG_STATUS fix_status=%u fix_type=%u",
+          _buffer.status.fix_status,
+          _buffer.status.fix_type);
+    _check_new_itow(_buffer.status.itow);
+    if (havePvtMsg) {
+        _unconfigured_messages |= CONFIG_RATE_STATUS;
+        return;
+    }
+    if (_buffer.status.fix_status & NAV_STATUS_FIX_VALID) {
+        if( (_buffer.status.fix_type == AP_GPS_UBLOX::FIX_3D) &&
+            (_buffer.status.fix_status & AP_GPS_UBLOX::NAV_STATUS_DGPS_USED)) {
+            next_fix = GPS_OK_FIX_3D_DGPS;
+        }else if( _buffer.status.fix_type == AP_GPS_UBLOX::FIX_3D) {
+            next_fix = GPS_OK_FIX_3D;
+        }else if (_buffer.status.fix_type == AP_GPS_UBLOX::FIX_2D) {
+            next_fix = GPS_OK_FIX_2D;
         }else{
             next_fix = NO_FIX;
             state.status = NO_FIX;
         }
+    }else{
+        next_fix = NO_FIX;
+        state.status = NO_FIX;
+    }
 #if UBLOX_FAKE_3DLOCK
-        state.status = GPS_OK_FIX_3D;
-        next_fix = state.status;
+    state.status = GPS_OK_FIX_3D;
+    next_fix = state.status;
 #endif
-        break;
-    case MSG_DOP:
-        Debug("MSG_DOP");
-        noReceivedHdop = false;
-        _check_new_itow(_buffer.dop.itow);
-        state.hdop        = _buffer.dop.hDOP;
-        state.vdop        = _buffer.dop.vDOP;
+}
+
+void
+AP_GPS_UBLOX::_parse_nav_dop(void)
+{
+    Debug("MSG_DOP");
+    noReceivedHdop = false;
+    _check_new_itow(_buffer.dop.itow);
+    state.hdop        = _buffer.dop.hDOP;
+    state.vdop        = _buffer.dop.vDOP;
 #if UBLOX_FAKE_3DLOCK
-        state.hdop = 130;
-        state.hdop = 170;
+    state.hdop = 130;
+    state.hdop = 170;
 #endif
-        break;
-    case MSG_SOL:
-        Debug("MSG_SOL fix_status=%u fix_type=%u",
-              _buffer.solution.fix_status,
-              _buffer.solution.fix_type);
-        _check_new_itow(_buffer.solution.itow);
-        if (havePvtMsg) {
-            state.time_week = _buffer.solution.week;
-            break;
-        }
-        if (_buffer.solution.fix_status & NAV_STATUS_FIX_VALID) {
-            if( (_buffer.solution.fix_type == AP_GPS_UBLOX::FIX_3D) &&
-                (_buffer.solution.fix_status & AP_GPS_UBLOX::NAV_STATUS_DGPS_USED)) {
-                next_fix = GPS_OK_FIX_3D_DGPS;
-            }else if( _buffer.solution.fix_type == AP_GPS_UBLOX::FIX_3D) {
-                next_fix = GPS_OK_FIX_3D;
-            }else if (_buffer.solution.fix_type == AP_GPS_UBLOX::FIX_2D) {
-                next_fix = GPS_OK_FIX_2D;
-            }else{
-                next_fix = NO_FIX;
-                state.status = NO_FIX;
-            }
+}
+
+void
+AP_GPS_UBLOX::_parse_nav_sol(void)
+{
+    Debug("MSG_SOL fix_status=%u fix_type=%u",
+          _buffer.solution.fix_status,
+          _buffer.solution.fix_type);
+    _check_new_itow(_buffer.solution.itow);
+    if (havePvtMsg) {
+        state.time_week = _buffer.solution.week;
+        return;
+    }
+    if (_buffer.solution.fix_status & NAV_STATUS_FIX_VALID) {
+        if( (_buffer.solution.fix_type == AP_GPS_UBLOX::FIX_3D) &&
+            (_buffer.solution.fix_status & AP_GPS_UBLOX::NAV_STATUS_DGPS_USED)) {
+            next_fix = GPS_OK_FIX_3D_DGPS;
+        }else if( _buffer.solution.fix_type == AP_GPS_UBLOX::FIX_3D) {
+            next_fix = GPS_OK_FIX_3D;
+        }else if (_buffer.solution.fix_type == AP_GPS_UBLOX::FIX_2D) {
+            next_fix = GPS_OK_FIX_2D;
         }else{
             next_fix = NO_FIX;
             state.status = NO_FIX;
         }
-        if(noReceivedHdop) {
-            state.hdop = _buffer.solution.position_DOP;
-        }
-        state.num_sats    = _buffer.solution.satellites;
-        if (next_fix >= GPS_OK_FIX_2D) {
-            state.last_gps_time_ms = I_millis();
-            state.time_week_ms    = _buffer.solution.itow;
-            state.time_week       = _buffer.solution.week;
-        }
-        break;
-    case MSG_PVT:
-        Debug("MSG_PVT");
-        havePvtMsg = true;
-        // position
-        _check_new_itow(_buffer.pvt.itow);
-        _last_pvt_itow = _buffer.pvt.itow;
-        _last_pos_time        = _buffer.pvt.itow;
-        state.lng    = _buffer.pvt.lon;
-        state.lat    = _buffer.pvt.lat;
-        state.have_undulation = true;
-        state.undulation = (_buffer.pvt.h_msl - _buffer.pvt.h_ellipsoid); //mm
-        state.alt =  _buffer.pvt.h_msl; //mm
-        switch (_buffer.pvt.fix_type)
-        {
-            case 0:
-                state.status = NO_FIX;
-                break;
-            case 1:
-                state.status = NO_FIX;
-                break;
-            case 2:
-                state.status = GPS_OK_FIX_2D;
-                break;
-            case 3:
-                state.status = GPS_OK_FIX_3D;
-                if (_buffer.pvt.flags & 0b00000010)  // diffsoln
-                    state.status = GPS_OK_FIX_3D_DGPS;
-                if (_buffer.pvt.flags & 0b01000000)  // carrsoln - float
-                    state.status = GPS_OK_FIX_3D_RTK_FLOAT;
-                if (_buffer.pvt.flags & 0b10000000)  // carrsoln - fixed
-                    state.status = GPS_OK_FIX_3D_RTK_FIXED;
-                break;
-            case 4:
-                interface_printf( "Unexpected state %d\n", _buffer.pvt.flags);
-                state.status = GPS_OK_FIX_3D;
-                break;
-            case 5:
-                state.status = NO_FIX;
-                break;
-            default:
-                state.status = NO_FIX;
-                break;
-        }
-        next_fix = state.status;
-        _new_position = true;
-        state.horizontal_accuracy = _buffer.pvt.h_acc; //mm
-        state.vertical_accuracy = _buffer.pvt.v_acc; //mm
-        state.have_horizontal_accuracy = true;
-        state.have_vertical_accuracy = true;
-        // SVs
-        state.num_sats    = _buffer.pvt.num_sv;
-        // velocity     
-        _last_vel_time         = _buffer.pvt.itow;
-        state.ground_speed     = _buffer.pvt.gspeed;          // mm/s
-        state.ground_course    = _buffer.pvt.head_mot;       // Heading 2D in deg / 100000
-        state.have_vertical_velocity = true;
-        state.vel_n = _buffer.pvt.velN; //mm
-        state.vel_e = _buffer.pvt.velE; //mm
-        state.vel_d = _buffer.pvt.velD; //mm
-        state.have_speed_accuracy = true;
-        state.speed_accuracy = _buffer.pvt.s_acc; //mm/s
-        _new_speed = true;
-        // dop
-        if(noReceivedHdop) {
-            state.hdop        = _buffer.pvt.p_dop;
-            state.vdop        = _buffer.pvt.p_dop;
-        }
-
-        if (_buffer.pvt.fix_type >= 2) {
-            state.last_gps_time_ms = I_millis();
-        }
-        
-        // time
-        state.time_week_ms    = _buffer.pvt.itow;
-#if UBLOX_FAKE_3DLOCK
-        state.lng = 1491652300L;
-        state.lat = -353632610L;
-        state.alt = 584000;
-        state.vertical_accuracy = 0;
-        state.horizontal_accuracy = 0;
-        state.status = GPS_OK_FIX_3D;
-        state.num_sats = 10;
-        state.time_week = 1721;
-        state.time_week_ms = I_millis() + 3*60*60*1000 + 37000;
+    }else{
+        next_fix = NO_FIX;
+        state.status = NO_FIX;
+    }
+    if(noReceivedHdop) {
+        state.hdop = _buffer.solution.position_DOP;
+    }
+    state.num_sats    = _buffer.solution.satellites;
+    if (next_fix >= GPS_OK_FIX_2D) {
         state.last_gps_time_ms = I_millis();
-        state.hdop = 130;
-        state.speed_accuracy = 0;
-        next_fix = state.status;
-#endif
-        break;
-    case MSG_TIMEGPS:
-        Debug("MSG_TIMEGPS");
-        _check_new_itow(_buffer.timegps.itow);
-        if (_buffer.timegps.valid & UBX_TIMEGPS_VALID_WEEK_MASK) {
-            state.time_week = _buffer.timegps.week;
-        }
-        break;
-    case MSG_VELNED:
-        Debug("MSG_VELNED");
-        if (havePvtMsg) {
-            _unconfigured_messages |= CONFIG_RATE_VELNED;
+        state.time_week_ms    = _buffer.solution.itow;
+        state.time_week       = _buffer.solution.week;
+    }
+}
+
+void
+AP_GPS_UBLOX::_parse_nav_pvt(void)
+{
+    Debug("MSG_PVT");
+    havePvtMsg = true;
+    // position
+    _check_new_itow(_buffer.pvt.itow);
+    _last_pvt_itow = _buffer.pvt.itow;
+    _last_pvt_ms = I_millis();
+    _last_pos_time        = _buffer.pvt.itow;
+    state.lng    = _buffer.pvt.lon;
+    state.lat    = _buffer.pvt.lat;
+    state.have_undulation = true;
+    state.undulation = (_buffer.pvt.h_msl - _buffer.pvt.h_ellipsoid); //mm
+    state.alt =  _buffer.pvt.h_msl; //mm
+    switch (_buffer.pvt.fix_type)
+    {
+        case 0:
+            state.status = NO_FIX;
             break;
-        }
-        _check_new_itow(_buffer.velned.itow);
-        _last_vel_time         = _buffer.velned.itow;
-        state.ground_speed     = _buffer.velned.speed_2d * 10;  // 10mm/s
-        state.ground_course    = _buffer.velned.heading_2d;       // Heading 2D in deg / 100000
-        state.have_vertical_velocity = true;
-        state.vel_n = _buffer.velned.ned_north * 10; //10mm
-        state.vel_e = _buffer.velned.ned_east * 10; //10mm
-        state.vel_d = _buffer.velned.ned_down * 10; //10mm
-        state.have_speed_accuracy = true;
-        state.speed_accuracy = _buffer.velned.speed_accuracy * 10;  //10mm/s
+        case 1:
+            state.status = NO_FIX;
+            break;
+        case 2:
+            state.status = GPS_OK_FIX_2D;
+            break;
+        case 3:
+            state.status = GPS_OK_FIX_3D;
+            if (_buffer.pvt.flags & 0b00000010)  // diffsoln
+                state.status = GPS_OK_FIX_3D_DGPS;
+            if (_buffer.pvt.flags & 0b01000000)  // carrsoln - float
+                state.status = GPS_OK_FIX_3D_RTK_FLOAT;
+            if (_buffer.pvt.flags & 0b10000000)  // carrsoln - fixed
+                state.status = GPS_OK_FIX_3D_RTK_FIXED;
+            break;
+        case 4:
+            interface_printf( "Unexpected state %d\n", _buffer.pvt.flags);
+            state.status = GPS_OK_FIX_3D;
+            break;
+        case 5:
+            state.status = NO_FIX;
+            break;
+        default:
+            state.status = NO_FIX;
+            break;
+    }
+    next_fix = state.status;
+    _new_position = true;
+    state.horizontal_accuracy = _buffer.pvt.h_acc; //mm
+    state.vertical_accuracy = _buffer.pvt.v_acc; //mm
+    state.have_horizontal_accuracy = true;
+    state.have_vertical_accuracy = true;
+    // SVs
+    state.num_sats    = _buffer.pvt.num_sv;
+    // velocity     
+    _last_vel_time         = _buffer.pvt.itow;
+    state.ground_speed     = _buffer.pvt.gspeed;          // mm/s
+    state.ground_course    = _buffer.pvt.head_mot;       // Heading 2D in deg / 100000
+    state.have_vertical_velocity = true;
+    state.vel_n = _buffer.pvt.velN; //mm
+    state.vel_e = _buffer.pvt.velE; //mm
+    state.vel_d = _buffer.pvt.velD; //mm
+    state.have_speed_accuracy = true;
+    state.speed_accuracy = _buffer.pvt.s_acc; //mm/s
+    _new_speed = true;
+    // dop
+    if(noReceivedHdop) {
+        state.hdop        = _buffer.pvt.p_dop;
+        state.vdop        = _buffer.pvt.p_dop;
+    }
+
+    if (_buffer.pvt.fix_type >= 2) {
+        state.last_gps_time_ms = I_millis();
+    }
+    
+    // time
+    state.time_week_ms    = _buffer.pvt.itow;
 #if UBLOX_FAKE_3DLOCK
-        state.speed_accuracy = 0;
-#endif
-        _new_speed = true;
-        break;
-    case MSG_NAV_SVINFO:
-        {
-        Debug("MSG_NAV_SVINFO\n");
-        static const uint8_t HardwareGenerationMask = 0x07;
-        _check_new_itow(_buffer.svinfo_header.itow);
-        _hardware_generation = _buffer.svinfo_header.globalFlags & HardwareGenerationMask;
-        switch (_hardware_generation) {
-            case UBLOX_5:
-            case UBLOX_6:
-                // only 7 and newer support CONFIG_GNSS
-                _unconfigured_messages &= ~CONFIG_GNSS;
-                break;
-            case UBLOX_7:
-            case UBLOX_M8:
-#if UBLOX_SPEED_CHANGE
-                port->begin(4000000U);
-                Debug("Changed speed to 4Mhz for SPI-driven UBlox\n");
+    state.lng = 1491652300L;
+    state.lat = -353632610L;
+    state.alt = 584000;
+    state.vertical_accuracy = 0;
+    state.horizontal_accuracy = 0;
+    state.status = GPS_OK_FIX_3D;
+    state.num_sats = 10;
+    state.time_week = 1721;
+    state.time_week_ms = I_millis() + 3*60*60*1000 + 37000;
+    state.last_gps_time_ms = I_millis();
+    state.hdop = 130;
+    state.speed_accuracy = 0;
+    next_fix = state.status;
 #endif
-                break;
-            default:
-                interface_printf("Wrong Ublox Hardware Version%u\n", _hardware_generation);
-                break;
-        };
-        _unconfigured_messages &= ~CONFIG_VERSION;
-        /* We don't need that anymore */
-        _configure_message_rate(CLASS_NAV, MSG_NAV_SVINFO, 0);
-        break;
-        }
-    default:
-        Debug("Unexpected NAV message 0x%02x", (unsigned)_msg_id);
-        if (++_disable_counter == 0) {
-            Debug("Disabling NAV message 0x%02x", (unsigned)_msg_id);
-            _configure_message_rate(CLASS_NAV, _msg_id, 0);
-        }
-        return false;
+}
+
+void
+AP_GPS_UBLOX::_parse_nav_timegps(void)
+{
+    Debug("MSG_TIMEGPS");
+    _check_new_itow(_buffer.timegps.itow);
+    if (_buffer.timegps.valid & UBX_TIMEGPS_VALID_WEEK_MASK) {
+        state.time_week = _buffer.timegps.week;
     }
+}
 
-    // we only return true when we get new position and speed data
-    // this ensures we don't use stale data
-    if (_new_position && _new_speed && _last_vel_time == _last_pos_time) {
-        _new_speed = _new_position = false;
-        return true;
+void
+AP_GPS_UBLOX::_parse_nav_velned(void)
+{
+    Debug("MSG_VELNED");
+    if (havePvtMsg) {
+        _unconfigured_messages |= CONFIG_RATE_VELNED;
+        return;
     }
-    return false;
+    _check_new_itow(_buffer.velned.itow);
+    _last_vel_time         = _buffer.velned.itow;
+    state.ground_speed     = _buffer.velned.speed_2d * 10;  // 10mm/s
+    state.ground_course    = _buffer.velned.heading_2d;       // Heading 2D in deg / 100000
+    state.have_vertical_velocity = true;
+    state.vel_n = _buffer.velned.ned_north * 10; //10mm
+    state.vel_e = _buffer.velned.ned_east * 10; //10mm
+    state.vel_d = _buffer.velned.ned_down * 10; //10mm
+    state.have_speed_accuracy = true;
+    state.speed_accuracy = _buffer.velned.speed_accuracy * 10;  //10mm/s
+#if UBLOX_FAKE_3DLOCK
+    state.speed_accuracy = 0;
+#endif
+    _new_speed = true;
+}
+
+void
+AP_GPS_UBLOX::_parse_nav_svinfo(void)
+{
+    Debug("MSG_NAV_SVINFO\n");
+    static const uint8_t HardwareGenerationMask = 0x07;
+    _check_new_itow(_buffer.svinfo_header.itow);
+    _hardware_generation = _buffer.svinfo_header.globalFlags & HardwareGenerationMask;
+    switch (_hardware_generation) {
+        case UBLOX_5:
+        case UBLOX_6:
+            // only 7 and newer support CONFIG_GNSS
+            _unconfigured_messages &= ~CONFIG_GNSS;
+            break;
+        case UBLOX_7:
+        case UBLOX_M8:
+#if UBLOX_SPEED_CHANGE
+            port->begin(4000000U);
+            Debug("Changed speed to 4Mhz for SPI-driven UBlox\n");
+#endif
+            break;
+        default:
+            interface_printf("Wrong Ublox Hardware Version%u\n", _hardware_generation);
+            break;
+    };
+    _unconfigured_messages &= ~CONFIG_VERSION;
+    /* We don't need that anymore */
+    _configure_message_rate(CLASS_NAV, MSG_NAV_SVINFO, 0);
 }
 
 /*
@@ -1694,13 +1967,20 @@ AP_GPS_UBLOX::set_pps_desired_freq(uint8_t freq)
  *  update checksum for a set of bytes
  */
 void
-AP_GPS_UBLOX::_update_checksum(uint8_t *data, uint16_t len, uint8_t &ck_a, uint8_t &ck_b)
+AP_GPS_UBLOX::_update_checksum(const uint8_t *data, uint16_t len, uint8_t &ck_a, uint8_t &ck_b)
 {
+    // four bytes a round: ck_b gains 4 ck_a plus the bytes weighted 4, 3, 2, 1
+    uint32_t a = ck_a, b = ck_b;
+    for (; len >= 4; len -= 4, data += 4) {
+        b += 4 * a + 4 * data[0] + 3 * data[1] + 2 * data[2] + data[3];
+        a += data[0] + data[1] + data[2] + data[3];
+    }
     while (len--) {
-        ck_a += *data;
-        ck_b += ck_a;
-        data++;
+        a += *data++;
+        b += a;
     }
+    ck_a = (uint8_t)a;
+    ck_b = (uint8_t)b;
 }
 
 
@@ -1747,7 +2027,9 @@ AP_GPS_UBLOX::_send_message(uint8_t msg_class, uint8_t msg_id, const void *msg,
 
     // Now write everything at once
     //I_print((char*)buf);
+    const uint32_t start_us = I_micros();
     I_write(buf, offset);
+    _write_us += I_micros() - start_us;
 
     // ORIGINAL:
 
@@ -2020,6 +2302,17 @@ AP_GPS_UBLOX::_configure_rate(void)
     _send_message(CLASS_CFG, MSG_CFG_RATE, &msg, sizeof(msg));
 }
 
+void
+AP_GPS_UBLOX::set_rate_ms(uint8_t ms)
+{
+    if (ms == rate_ms) {
+        return;
+    }
+    rate_ms = ms;
+    // the next CFG-RATE reply no longer matches and _configure_rate sends the new one
+    _unconfigured_messages |= CONFIG_RATE_NAV;
+}
+
 static const char *reasons[] = {"navigation rate",
                                 "posllh rate",
                                 "status rate",
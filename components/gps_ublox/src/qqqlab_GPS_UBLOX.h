@@ -71,6 +71,9 @@ class AP_GPS_Interface {
 #define UBLOX_MAX_PORTS 6
 #define UBLOX_MODULE_LEN 9
 
+#define UBX_MSG_HANDLERS_MAX 32 // entries of _ubx_msgs, plus one for the rest
+#define UBX_CLASS_ROWS 6        // message classes with handlers: ACK CFG MON NAV RXM TIM
+
 #define RATE_POSLLH 1
 #define RATE_STATUS 1
 #define RATE_SOL 1
@@ -132,7 +135,13 @@ public:
     virtual int I_available() = 0; //number of bytes that can be read from the serial port without blocking
     virtual int I_availableForWrite() = 0; //number of bytes that can be written to the serial port without blocking
     virtual uint32_t I_millis() = 0; //get millisecond time stamp
+    virtual uint32_t I_micros() { return I_millis() * 1000; } //get microsecond time stamp, for the message timing
     virtual void I_print(const char *str) = 0; //print to console
+    //optional span access: point data at bytes that can be read without blocking and return how
+    //many (0 if none or not supported), without consuming them; I_consume then drops len of them.
+    //read() parses whole spans this way and falls back to I_read one byte at a time.
+    virtual size_t I_peek(const uint8_t **data) { return 0; }
+    virtual void I_consume(size_t len) {}
 
     void update(); //update GPS instance. This should be called at 10Hz or greater
     
@@ -159,6 +168,27 @@ public:
     // @User: Advanced
     //AP_GROUPINFO("_SAVE_CFG", 11, AP_GPS, save_config, 2),
     uint8_t save_config = 2;
+    //parse whole frames in place (_parse_frames); false leaves it all to the byte at a time state
+    //machine, to cross-check the two
+    bool span_parse = true;
+    //push mode: once configured, leave the receiver alone while its periodic NAV-PVT keeps
+    //coming; after this long without one walk the configuration again from STEP_PVT, so
+    //_verify_rate puts the rate back. 0 polls the configuration every 2 s as before
+    uint32_t push_timeout_ms = 0;
+    uint32_t push_restarts = 0;         //walks started by push_timeout_ms
+    //change rate_ms, the CFG-RATE measurement period, and have the receiver reconfigured
+    void set_rate_ms(uint8_t ms);
+
+    //per message counters of the dispatch in _parse_gps
+    struct ubx_msg_stats_t {
+        uint32_t count;                 //frames with this class and id
+        uint32_t short_length;          //dropped, payload shorter than the handler reads
+        uint32_t us_max;                //longest handler run, I_write time excluded
+        uint64_t us_total;
+        uint64_t write_us_total;        //spent in I_write round trips sent from the handler
+    };
+    //counters of handler i, the last one counts the messages without a handler; false past it
+    bool msg_stats(size_t i, const char **name, ubx_msg_stats_t *stats) const;
 
 protected:
     //additions for this port
@@ -926,6 +956,7 @@ protected:
     uint8_t         _hardware_generation { UBLOX_UNKNOWN_HARDWARE_GENERATION };
     uint8_t         _hardware_variant;
     uint32_t        _last_pvt_itow;
+    uint32_t        _last_pvt_ms;       //I_millis() of the last NAV-PVT, see push_timeout_ms
     uint32_t        _last_relposned_itow;
     uint32_t        _last_relposned_ms;
 
@@ -941,6 +972,48 @@ protected:
 
     // Buffer parse & GPS state update
     bool        _parse_gps();
+    size_t      _parse_bytes(const uint8_t *bytes, size_t len, bool &parsed, bool &stop);
+    size_t      _parse_frames(const uint8_t *bytes, size_t len, bool &parsed);
+
+    // Message dispatch: a handler per class and id, looked up in constant time
+    typedef void (AP_GPS_UBLOX::*ubx_handler_t)(void);
+    struct ubx_msg_t {
+        uint8_t msg_class;
+        uint8_t msg_id;
+        uint16_t min_length;            // shorter payloads are dropped
+        ubx_handler_t handler;
+        const char *name;
+    };
+    // row[class] picks a row of slot, 0 for a class without handlers;
+    // slot[row][id] is 1 + the index into _ubx_msgs, 0 for no handler
+    struct ubx_index_t {
+        uint8_t row[256];
+        uint8_t slot[UBX_CLASS_ROWS + 1][256];
+    };
+    static const ubx_msg_t _ubx_msgs[];
+    static const size_t _ubx_msg_count;
+    static const ubx_index_t _ubx_index;
+    static constexpr ubx_index_t _make_ubx_index(void);
+    ubx_msg_stats_t _msg_stats[UBX_MSG_HANDLERS_MAX] {};
+    uint32_t        _write_us = 0;      //running total of _send_message time in I_write
+
+    void        _parse_ack(void);
+    void        _parse_cfg(void);
+    void        _parse_mon(void);
+#if UBLOX_RXM_RAW_LOGGING
+    void        _parse_rxm_raw(void);
+#endif
+#if UBLOX_TIM_TM2_LOGGING
+    void        _parse_tim_tm2(void);
+#endif
+    void        _parse_nav_posllh(void);
+    void        _parse_nav_status(void);
+    void        _parse_nav_dop(void);
+    void        _parse_nav_sol(void);
+    void        _parse_nav_pvt(void);
+    void        _parse_nav_timegps(void);
+    void        _parse_nav_velned(void);
+    void        _parse_nav_svinfo(void);
 
     // used to update fix between status and position packets
     GPS_Status next_fix { NO_FIX };
@@ -965,7 +1038,7 @@ protected:
     bool        _configure_valget(ConfigKey key);
     void        _configure_rate(void);
     void        _configure_sbas(bool enable);
-    void        _update_checksum(uint8_t *data, uint16_t len, uint8_t &ck_a, uint8_t &ck_b);
+    void        _update_checksum(const uint8_t *data, uint16_t len, uint8_t &ck_a, uint8_t &ck_b);
     bool        _send_message(uint8_t msg_class, uint8_t msg_id, const void *msg, uint16_t size);
     void	send_next_rate_update(void);
     bool        _request_message_rate(uint8_t msg_class, uint8_t msg_id);
@@ -0,0 +1,481 @@
+// Micro-benchmarks of the parsers every UART byte goes through: PingParser
+// on Ping1D profile (1300) frames, the ping_message checksum, AP_GPS_UBLOX
+// on UBX streams and RN2483_response on module replies.
+//
+// Each case runs over a prepared buffer until it has run for a while and
+// reports the best of a few rounds in ns and cycles per byte, and per
+// message where a case counts them. A baseline
+// written with --save can be compared against later with --baseline, so
+// parser changes come with numbers.
+//
+// Built on the host as usv_bench. The same file builds for the target from
+// an IDF project's main component, where app_main runs it and cycles come
+// from esp_cpu_get_cycle_count().
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "ping-parser.h"
+#include "qqqlab_GPS_UBLOX.h"
+#include "lora_task.h"
+#include "rn2483.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define MAX_CASES 32
+#define ROUNDS 5
+#define ROUND_NS 20000000LL         // each round runs at least this long
+#define PING_PARSER_BUFFER 512      // what ping_task gives its PingParser
+
+typedef struct {
+    char name[40];
+    size_t bytes;                   // bytes per pass
+    double ns_per_byte;
+    double cycles_per_byte;         // 0 where there is no cycle counter
+    size_t messages;                // per pass, 0 where not counted
+} bench_result_t;
+
+static bench_result_t results[MAX_CASES];
+static size_t n_results;
+static volatile uint32_t sink;      // keeps the parsers' results alive
+
+/* CLOCKS */
+
+static int64_t now_ns()
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+static uint64_t cycles()
+{
+#ifdef ESP_PLATFORM
+    return esp_cpu_get_cycle_count();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// runs pass() over `bytes` bytes until ROUND_NS has passed, ROUNDS times,
+// and keeps the fastest round
+template <typename F>
+static void run_case(const char *name, size_t bytes, F pass, size_t messages = 0)
+{
+    double best_ns = 0, best_cycles = 0;
+    pass();                         // warm the caches
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t passes = 0;
+        int64_t t0 = now_ns();
+        uint64_t c0 = cycles();
+        int64_t t1;
+        do {
+            pass();
+            passes++;
+            t1 = now_ns();
+        } while (t1 - t0 < ROUND_NS);
+        uint64_t c1 = cycles();
+        double ns = (double)(t1 - t0) / (passes * bytes);
+        double cy = (double)(c1 - c0) / (passes * bytes);
+        if (r == 0 || ns < best_ns) {
+            best_ns = ns;
+            best_cycles = cy;
+        }
+    }
+
+    if (n_results < MAX_CASES) {
+        bench_result_t *res = &results[n_results++];
+        snprintf(res->name, sizeof(res->name), "%s", name);
+        res->bytes = bytes;
+        res->ns_per_byte = best_ns;
+        res->cycles_per_byte = best_cycles;
+        res->messages = messages;
+    }
+}
+
+/* PING1D */
+
+// profile (1300): distance, confidence, transmit duration, ping number,
+// scan start, scan length, gain setting, profile data length, profile data
+static void add_ping_profile(std::vector<uint8_t> &out, uint16_t points, uint32_t n)
+{
+    uint16_t payload_len = 26 + points;
+    ping_message msg(ping_message::headerLength + payload_len + ping_message::checksumLength);
+    msg.set_payload_length(payload_len);
+    msg.set_message_id(1300);
+    msg.set_source_device_id(1);
+    msg.set_destination_device_id(0);
+    uint8_t *p = msg.payload_data();
+    memset(p, 0, payload_len);
+    uint32_t distance = 2500 + n % 100;
+    memcpy(p + 0, &distance, 4);
+    p[4] = 100;
+    memcpy(p + 8, &n, 4);
+    uint32_t scan_length = 3000;
+    memcpy(p + 16, &scan_length, 4);
+    memcpy(p + 24, &points, 2);
+    for (uint16_t i = 0; i < points; i++)
+        p[26 + i] = (uint8_t)((i * 7 + n) & 0xff);
+    msg.updateChecksum();
+    out.insert(out.end(), msg.msgData, msg.msgData + msg.msgDataLength());
+}
+
+static void bench_ping()
+{
+    const uint16_t sizes[] = {50, 200, 470};
+    char name[40];
+    for (uint16_t points : sizes) {
+        // a batch of frames as they come back in ping_task's rx_buf
+        std::vector<uint8_t> stream;
+        for (uint32_t n = 0; n < 8; n++)
+            add_ping_profile(stream, points, n);
+        PingParser parser(PING_PARSER_BUFFER);
+        snprintf(name, sizeof(name), "ping_parse_profile_%u", points);
+        run_case(name, stream.size(), [&] {
+            parser.reset();
+            uint32_t frames = 0;
+            for (uint8_t b : stream)
+                frames += parser.parseByte(b) == PingParser::State::NEW_MESSAGE;
+            sink += frames;
+        });
+    }
+
+    for (uint16_t points : sizes) {
+        std::vector<uint8_t> frame;
+        add_ping_profile(frame, points, 0);
+        ping_message msg(frame.data(), (uint16_t)frame.size());
+        snprintf(name, sizeof(name), "ping_checksum_%u", (unsigned)frame.size());
+        run_case(name, frame.size(), [&] { sink += msg.calculateChecksum(); });
+    }
+}
+
+/* UBLOX */
+
+static void add_ubx(std::vector<uint8_t> &out, uint8_t cls, uint8_t id, uint16_t len, uint32_t n)
+{
+    size_t start = out.size();
+    out.push_back(0xB5);
+    out.push_back(0x62);
+    out.push_back(cls);
+    out.push_back(id);
+    out.push_back(len & 0xff);
+    out.push_back(len >> 8);
+    for (uint16_t i = 0; i < len; i++)
+        out.push_back((uint8_t)(i * 13 + n));
+    // iTOW first, so the driver sees epochs move on
+    uint32_t itow = 1000 * n;
+    if (len >= 4)
+        memcpy(&out[start + 6], &itow, 4);
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = start + 2; i < out.size(); i++) {
+        ck_a += out[i];
+        ck_b += ck_a;
+    }
+    out.push_back(ck_a);
+    out.push_back(ck_b);
+}
+
+// how BenchGPS hands the driver its bytes
+enum bench_read_t {
+    READ_SPAN,          // I_peek / I_consume on rx_buf, as gnss_task does now
+    READ_BYTEWISE,      // one I_read per byte out of rx_buf in place
+    READ_MEMMOVE,       // one I_read per byte shifting a 512 byte buffer
+                        // down, gnss_task before it read the pooled rx_buf
+};
+
+// the driver fed from memory, a pass re-reads the same stream
+class BenchGPS : public AP_GPS_UBLOX {
+public:
+    BenchGPS(const std::vector<uint8_t> &s, bench_read_t read_mode) : stream(s), mode(read_mode)
+    {
+        // gnss_task's driver is a static, zeroed before it starts
+        _step = 0;
+        state = {};
+    }
+
+    void pass()
+    {
+        pos = 0;
+        while (pos < stream.size()) {
+            rx_len = stream.size() - pos < sizeof(rx_buf) ? stream.size() - pos : sizeof(rx_buf);
+            memcpy(rx_buf, stream.data() + pos, rx_len);
+            pos += rx_len;
+            rx_head = 0;
+            parsed_reads += read();
+        }
+        sink += state.num_sats;
+    }
+
+    uint32_t parsed_reads = 0;      // read() calls that parsed a fix
+
+    void I_setBaud(int baud) override {}
+    int I_available() override { return (int)(rx_len - rx_head); }
+    int I_read(uint8_t *data, size_t len) override
+    {
+        if (rx_head == rx_len)
+            return 0;
+        if (mode == READ_MEMMOVE) {
+            *data = rx_buf[0];
+            rx_len--;
+            memmove(rx_buf, rx_buf + 1, rx_len);
+            return 1;
+        }
+        *data = rx_buf[rx_head++];
+        return 1;
+    }
+    size_t I_peek(const uint8_t **data) override
+    {
+        if (mode != READ_SPAN)
+            return 0;
+        *data = rx_buf + rx_head;
+        return rx_len - rx_head;
+    }
+    void I_consume(size_t len) override { rx_head += len; }
+    int I_write(uint8_t *data, size_t len) override { return (int)len; }
+    int I_availableForWrite() override { return 128; }
+    uint32_t I_millis() override { return 0; }
+    void I_print(const char *str) override {}
+
+private:
+    const std::vector<uint8_t> &stream;
+    bench_read_t mode;
+    size_t pos = 0;
+    uint8_t rx_buf[512];
+    size_t rx_len = 0;
+    size_t rx_head = 0;
+};
+
+static bool ubx_mismatch;
+
+// the span parser has to leave the driver where the byte at a time state
+// machine does, on every stream the cases run
+static void cross_check_ublox(const char *name, const std::vector<uint8_t> &stream)
+{
+    BenchGPS span(stream, READ_SPAN), bytes(stream, READ_SPAN);
+    bytes.span_parse = false;
+    span.pass();
+    bytes.pass();
+    const auto &a = span.state, &b = bytes.state;
+    if (span.parsed_reads != bytes.parsed_reads || a.time_week_ms != b.time_week_ms || a.lat != b.lat ||
+        a.lng != b.lng || a.alt != b.alt || a.ground_speed != b.ground_speed || a.num_sats != b.num_sats) {
+        fprintf(stderr, "%s: the span parser and the state machine disagree\n", name);
+        ubx_mismatch = true;
+    }
+}
+
+static void bench_ublox()
+{
+    std::vector<uint8_t> pvt, mixed, noisy, rawx;
+    const uint32_t epochs = 10;
+    for (uint32_t n = 0; n < epochs; n++) {
+        add_ubx(pvt, 0x01, 0x07, 92, n);            // NAV-PVT
+
+        add_ubx(mixed, 0x01, 0x07, 92, n);          // NAV-PVT
+        add_ubx(mixed, 0x01, 0x02, 28, n);          // NAV-POSLLH
+        add_ubx(mixed, 0x01, 0x03, 16, n);          // NAV-STATUS
+        add_ubx(mixed, 0x01, 0x12, 36, n);          // NAV-VELNED
+        add_ubx(mixed, 0x0A, 0x09, 60, n);          // MON-HW
+
+        // line noise and a corrupted frame between good ones
+        for (int i = 0; i < 40; i++)
+            noisy.push_back((uint8_t)(i * 37 + n));
+        add_ubx(noisy, 0x01, 0x07, 92, n);
+        add_ubx(noisy, 0x01, 0x02, 28, n);
+        noisy[noisy.size() - 1] ^= 0x55;
+
+        add_ubx(rawx, 0x02, 0x15, 16 + 32 * 16, n); // RXM-RAWX, 16 measurements
+        add_ubx(rawx, 0x01, 0x07, 92, n);
+    }
+
+    // messages counts the good frames of a pass
+    struct {
+        const char *name;
+        const std::vector<uint8_t> *stream;
+        bench_read_t mode;
+        bool span_parse;
+        size_t messages;
+    } cases[] = {
+        {"ubx_read_pvt", &pvt, READ_SPAN, true, epochs},
+        {"ubx_read_mixed", &mixed, READ_SPAN, true, 5 * epochs},
+        {"ubx_read_noisy", &noisy, READ_SPAN, true, epochs},
+        {"ubx_read_rawx", &rawx, READ_SPAN, true, 2 * epochs},
+        {"ubx_read_mixed_state_machine", &mixed, READ_SPAN, false, 5 * epochs},
+        {"ubx_read_rawx_state_machine", &rawx, READ_SPAN, false, 2 * epochs},
+        {"ubx_read_mixed_bytewise", &mixed, READ_BYTEWISE, false, 5 * epochs},
+        {"ubx_read_mixed_idf_memmove", &mixed, READ_MEMMOVE, false, 5 * epochs},
+    };
+    for (auto &c : cases) {
+        cross_check_ublox(c.name, *c.stream);
+        BenchGPS gps(*c.stream, c.mode);
+        gps.span_parse = c.span_parse;
+        run_case(c.name, c.stream->size(), [&] { gps.pass(); }, c.messages);
+    }
+}
+
+/* RN2483 */
+
+static void bench_rn2483()
+{
+    const char *replies[] = {
+        "ok\r\n",
+        "radio_tx_ok\r\n",
+        "RN2483 1.0.5 Oct 31 2018 15:06:52\r\n",
+    };
+    const char *names[] = {"rn2483_response_ok", "rn2483_response_tx_ok", "rn2483_response_ver"};
+    lora_request_t *req = get_curr_request();
+    for (size_t i = 0; i < sizeof(replies) / sizeof(replies[0]); i++) {
+        size_t len = strlen(replies[i]);
+        req->lora_rx_buf = replies[i];
+        req->lora_rx_len = len;
+        uint8_t response[RN2483_MAX_BUFF];
+        // RN2483_response reads up to the '\n' or RN2483_MAX_BUFF - 1 bytes
+        size_t consumed = len < RN2483_MAX_BUFF - 1 ? len : RN2483_MAX_BUFF - 1;
+        run_case(names[i], consumed, [&] {
+            req->id++;              // a new request restarts the reader
+            sink += RN2483_response(response);
+        });
+    }
+}
+
+/* BASELINES */
+
+static bool load_baseline(const char *path, bench_result_t *base, size_t *n_base)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    char line[160];
+    *n_base = 0;
+    while (fgets(line, sizeof(line), f) && *n_base < MAX_CASES) {
+        bench_result_t *b = &base[*n_base];
+        unsigned long bytes;
+        if (line[0] == '#' || sscanf(line, "%39s %lu %lf %lf", b->name, &bytes, &b->ns_per_byte, &b->cycles_per_byte) != 4)
+            continue;
+        b->bytes = bytes;
+        (*n_base)++;
+    }
+    fclose(f);
+    return true;
+}
+
+static void print_results(FILE *out, const bench_result_t *base, size_t n_base)
+{
+    fprintf(out, "# %-30s %8s %10s %12s %9s%s\n", "case", "bytes", "ns/byte", "cycles/byte", "ns/msg",
+            n_base ? "   vs baseline" : "");
+    for (size_t i = 0; i < n_results; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(out, "  %-30s %8zu %10.3f %12.2f", r->name, r->bytes, r->ns_per_byte, r->cycles_per_byte);
+        if (r->messages)
+            fprintf(out, " %9.1f", r->ns_per_byte * r->bytes / r->messages);
+        else
+            fprintf(out, " %9s", "-");
+        for (size_t j = 0; j < n_base; j++) {
+            if (strcmp(base[j].name, r->name) == 0 && base[j].ns_per_byte > 0) {
+                fprintf(out, "   %+6.1f%%", 100.0 * (r->ns_per_byte / base[j].ns_per_byte - 1.0));
+                break;
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+static void run_all()
+{
+    bench_ping();
+    bench_ublox();
+    bench_rn2483();
+}
+
+#ifdef ESP_PLATFORM
+
+extern "C" void app_main()
+{
+    run_all();
+    print_results(stdout, NULL, 0);
+}
+
+#else
+
+static void usage(const char *argv0)
+{
+    printf("usage: %s [options]\n"
+           "  --baseline FILE    compare against a saved run\n"
+           "  --save FILE        write this run as a baseline\n"
+           "  --max-slower PCT   exit 1 if a case is more than PCT %% slower than the baseline\n",
+           argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *baseline = NULL;
+    const char *save = NULL;
+    double max_slower = -1;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!v) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(a, "--baseline") == 0) baseline = v;
+        else if (strcmp(a, "--save") == 0) save = v;
+        else if (strcmp(a, "--max-slower") == 0) max_slower = atof(v);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    static bench_result_t base[MAX_CASES];
+    size_t n_base = 0;
+    if (baseline && !load_baseline(baseline, base, &n_base)) {
+        fprintf(stderr, "cannot read %s\n", baseline);
+        return 1;
+    }
+
+    run_all();
+    print_results(stdout, base, n_base);
+    if (ubx_mismatch)
+        return 1;
+
+    if (save) {
+        FILE *f = fopen(save, "w");
+        if (!f) {
+            fprintf(stderr, "cannot write %s\n", save);
+            return 1;
+        }
+        print_results(f, NULL, 0);
+        fclose(f);
+    }
+
+    if (max_slower >= 0) {
+        for (size_t i = 0; i < n_results; i++) {
+            for (size_t j = 0; j < n_base; j++) {
+                if (strcmp(base[j].name, results[i].name) == 0 &&
+                    results[i].ns_per_byte > base[j].ns_per_byte * (1.0 + max_slower / 100.0)) {
+                    fprintf(stderr, "%s: %.3f ns/byte, baseline %.3f\n",
+                            results[i].name, results[i].ns_per_byte, base[j].ns_per_byte);
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,543 @@
+// Host runner: starts app_main() against the FreeRTOS / ESP-IDF shim,
+// lets the pipeline run for a while and prints where the time went.
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host_freertos.h"
+#include "host_gpio.h"
+#include "host_uart.h"
+#include "host_vfs.h"
+#include "host_nvs.h"
+#include "sim/sim_device.h"
+#include "sim/sim_ping1d.h"
+#include "sim/sim_ublox.h"
+#include "sim/sim_rn2483.h"
+#include "config.h"
+#include "hardware.h"
+#include "uart_manager.h"
+#include "ping_task.h"
+#include "gnss_task.h"
+#include "sd_task.h"
+#include "lora_task.h"
+#include "latency.h"
+#include "metrics.h"
+#include "uart_capture.h"
+#include "uart_pool.h"
+#include "uart_stream.h"
+#include "uart_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C" void app_main();
+
+#define MAX_REPORT_TASKS 16
+#define MAX_REPORT_QUEUES 16
+
+typedef struct {
+    int seconds;
+    esp_log_level_t log_level;
+    const char *sd_dir;         // "ram" keeps the card in memory
+    bool sd_timed;
+    host_sd_model_t sd_model;
+    int sd_load;                // extra save_req_t per second, 0 for none
+    int sd_load_bytes;
+    int sd_load_files;
+    int sample_interval_ms;     // -1 keeps what app_main sets
+    int log_interval_ms;
+    int metrics_interval_ms;    // -1 keeps what config.cpp sets
+    bool metrics_lora;
+    bool capture;
+    const char *replay;         // capture file answering the UART, NULL for the simulated devices
+    const char *trace;          // file the UART trace ring is dumped to after the run, NULL for none
+    const char *decode_trace;   // print this trace dump instead of running
+    int switch_off_s;           // seconds in that TOGGLE_SW goes low, -1 never
+    double speed;
+    const char *nvs;            // file backing NVS, NULL: memory only
+    bool calibrate;
+    bool gnss_stream;
+    int gnss_rate_ms;           // -1 keeps what config.cpp sets
+    int gps_settle_us;
+    int ping_settle_us;
+    int lora_settle_us;
+    int gps_uart;               // -1: behind the mux on UART_PORT
+    int ping_uart;
+    int lora_uart;
+    uint64_t seed;
+    const char *ping;           // NULL: nothing on the ping address
+    sim_ping1d_config_t ping_cfg;
+    const char *gps;            // NULL: nothing on the gps address
+    sim_ublox_config_t gps_cfg;
+    bool lora;
+    sim_rn2483_config_t lora_cfg;
+} host_options_t;
+
+static SimUblox *sim_gps;
+
+// synthetic save_queue producer
+typedef struct {
+    int per_s;
+    int bytes;
+    int files;
+    uint32_t sent;
+    int64_t send_us_max;        // longest xQueueSend(portMAX_DELAY), sd_task not keeping up
+    int64_t behind_us_max;      // how far the producer fell behind its schedule
+} sd_load_t;
+
+static sd_load_t sd_load;
+
+static void usage(const char *argv0)
+{
+    printf("usage: %s [options]\n"
+           "  --seconds N        run time before the report (default 10)\n"
+           "  --log LEVEL        none|error|warn|info|debug (default warn)\n"
+           "  --sd DIR           host directory backing " MOUNT_POINT " (default ./sdcard), or 'ram'\n"
+           "  --sd-timing on|off charge SD card write latency to the writing task (default off)\n"
+           "  --sd-write-us N    per write cost, implies --sd-timing on (default 1500)\n"
+           "  --sd-kbps N        write throughput (default 1200)\n"
+           "  --sd-cluster-us N  cost of growing a file by a cluster (default 3000)\n"
+           "  --sd-stall-every-kb N  erase stall every N KB written, 0 for none (default 512)\n"
+           "  --sd-stall-ms N    length of that stall (default 150)\n"
+           "  --sd-spike-permille N  writes taking --sd-spike-ms longer (default 20)\n"
+           "  --sd-spike-ms N    (default 25)\n"
+           "  --sd-load N        post N extra save_req_t per second to save_queue (default 0)\n"
+           "  --sd-load-bytes N  bytes per request, at most 1023 (default 200)\n"
+           "  --sd-load-files N  files the requests rotate over (default 3)\n"
+           "  --sample-ms N      override g_sample_interval_ms\n"
+           "  --log-ms N         override g_log_interval_ms\n"
+           "  --metrics-ms N     override g_metrics_interval_ms, records go to " METRICS_FILE "\n"
+           "  --metrics-lora on|off  also send the metrics records over LoRa\n"
+           "  --capture on|off   record UART transactions to " MOUNT_POINT "/" UART_CAPTURE_FILE "\n"
+           "  --replay FILE      answer UART transactions from a capture instead of the devices\n"
+           "  --trace FILE       dump the UART trace ring, the last transactions, to FILE after the run\n"
+           "  --decode-trace FILE  print a UART trace dump, e.g. " UART_TRACE_FILE " off the card, and exit\n"
+           "  --switch-off S     turn the logging switch off S seconds in, sd_task dumps " UART_TRACE_FILE "\n"
+           "  --speed N          run the clock N times faster than real time (default 1)\n"
+           "  --nvs FILE         keep NVS (calibrated settle times) in FILE between runs\n"
+           "  --calibrate on|off measure the mux settle time of each device at start\n"
+           "  --gnss-stream on|off  keep the mux on the GPS between transactions and parse its stream\n"
+           "  --gnss-rate-ms N   override g_gnss_rate_ms, the navigation period the GPS is set to\n"
+           "  --gps-settle-us N  time the u-blox needs after a mux switch (default 2000)\n"
+           "  --ping-settle-us N time the Ping1D needs after a mux switch (default 1000)\n"
+           "  --lora-settle-us N time the RN2483 needs after a mux switch (default 3000)\n"
+           "  --gps-uart N       wire the u-blox to UART N of its own instead of the mux\n"
+           "  --ping-uart N      same for the Ping1D\n"
+           "  --lora-uart N      same for the RN2483\n"
+           "  --seed N           seed for every simulated device\n"
+           "  --ping SRC         attach a Ping1D: 'synth' or a file of raw ping frames\n"
+           "  --ping-delay-us N  Ping1D response delay (default 2000)\n"
+           "  --ping-jitter-us N Ping1D response jitter, +/- (default 500)\n"
+           "  --ping-rate-ms N   Ping1D continuous mode interval (default 50)\n"
+           "  --ping-depth-mm N  synthetic bottom depth (default 2500)\n"
+           "  --ping-points N    synthetic profile length (default 200)\n"
+           "  --gps MSGS         attach a u-blox: 'driver' outputs what AP_GPS_UBLOX configures,\n"
+           "                     or a list of pvt,posllh,status,velned,hw,rawx forced every epoch\n"
+           "  --gps-rate-hz N    fixed nav rate (default: CFG-RATE as set by the driver)\n"
+           "  --gps-noise N      random bytes between epochs, average (default 0)\n"
+           "  --gps-bad-ck N     per mille of frames with a corrupted checksum (default 0)\n"
+           "  --gps-rawx N       measurements per RXM-RAWX, at most 32 (default 16)\n"
+           "  --lora on|off      attach an RN2483 on the LoRa address\n"
+           "  --lora-delay-us N  RN2483 command response delay (default 2000)\n",
+           argv0);
+}
+
+static esp_log_level_t parse_level(const char *s)
+{
+    if (strcmp(s, "none") == 0) return ESP_LOG_NONE;
+    if (strcmp(s, "error") == 0) return ESP_LOG_ERROR;
+    if (strcmp(s, "warn") == 0) return ESP_LOG_WARN;
+    if (strcmp(s, "debug") == 0) return ESP_LOG_DEBUG;
+    if (strcmp(s, "verbose") == 0) return ESP_LOG_VERBOSE;
+    return ESP_LOG_INFO;
+}
+
+static bool parse_args(int argc, char **argv, host_options_t *opt)
+{
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(a, "--help") == 0 || strcmp(a, "-h") == 0 || !v)
+            return false;
+        if (strcmp(a, "--seconds") == 0) opt->seconds = atoi(v);
+        else if (strcmp(a, "--log") == 0) opt->log_level = parse_level(v);
+        else if (strcmp(a, "--sd") == 0) opt->sd_dir = v;
+        else if (strcmp(a, "--sd-timing") == 0) opt->sd_timed = strcmp(v, "on") == 0;
+        else if (strcmp(a, "--sd-load") == 0) opt->sd_load = atoi(v);
+        else if (strcmp(a, "--sd-load-bytes") == 0) opt->sd_load_bytes = atoi(v);
+        else if (strcmp(a, "--sd-load-files") == 0) opt->sd_load_files = atoi(v);
+        else if (strncmp(a, "--sd-", 5) == 0) {
+            host_sd_model_t *m = &opt->sd_model;
+            if (strcmp(a, "--sd-write-us") == 0) m->write_base_us = atoi(v);
+            else if (strcmp(a, "--sd-kbps") == 0) m->write_kbps = atoi(v);
+            else if (strcmp(a, "--sd-cluster-us") == 0) m->cluster_alloc_us = atoi(v);
+            else if (strcmp(a, "--sd-stall-every-kb") == 0) m->stall_every_kb = atoi(v);
+            else if (strcmp(a, "--sd-stall-ms") == 0) m->stall_us = atoi(v) * 1000;
+            else if (strcmp(a, "--sd-spike-permille") == 0) m->spike_permille = atoi(v);
+            else if (strcmp(a, "--sd-spike-ms") == 0) m->spike_us = atoi(v) * 1000;
+            else return false;
+            opt->sd_timed = true;
+        }
+        else if (strcmp(a, "--sample-ms") == 0) opt->sample_interval_ms = atoi(v);
+        else if (strcmp(a, "--log-ms") == 0) opt->log_interval_ms = atoi(v);
+        else if (strcmp(a, "--metrics-ms") == 0) opt->metrics_interval_ms = atoi(v);
+        else if (strcmp(a, "--metrics-lora") == 0) opt->metrics_lora = strcmp(v, "on") == 0;
+        else if (strcmp(a, "--capture") == 0) opt->capture = strcmp(v, "on") == 0;
+        else if (strcmp(a, "--replay") == 0) opt->replay = v;
+        else if (strcmp(a, "--trace") == 0) opt->trace = v;
+        else if (strcmp(a, "--decode-trace") == 0) opt->decode_trace = v;
+        else if (strcmp(a, "--switch-off") == 0) opt->switch_off_s = atoi(v);
+        else if (strcmp(a, "--speed") == 0) opt->speed = atof(v);
+        else if (strcmp(a, "--nvs") == 0) opt->nvs = v;
+        else if (strcmp(a, "--calibrate") == 0) opt->calibrate = strcmp(v, "on") == 0;
+        else if (strcmp(a, "--gnss-stream") == 0) opt->gnss_stream = strcmp(v, "on") == 0;
+        else if (strcmp(a, "--gnss-rate-ms") == 0) opt->gnss_rate_ms = atoi(v);
+        else if (strcmp(a, "--gps-settle-us") == 0) opt->gps_settle_us = atoi(v);
+        else if (strcmp(a, "--ping-settle-us") == 0) opt->ping_settle_us = atoi(v);
+        else if (strcmp(a, "--lora-settle-us") == 0) opt->lora_settle_us = atoi(v);
+        else if (strcmp(a, "--gps-uart") == 0) opt->gps_uart = atoi(v);
+        else if (strcmp(a, "--ping-uart") == 0) opt->ping_uart = atoi(v);
+        else if (strcmp(a, "--lora-uart") == 0) opt->lora_uart = atoi(v);
+        else if (strcmp(a, "--seed") == 0) opt->seed = strtoull(v, NULL, 0);
+        else if (strcmp(a, "--ping") == 0) opt->ping = v;
+        else if (strcmp(a, "--ping-delay-us") == 0) opt->ping_cfg.response_delay_us = atoi(v);
+        else if (strcmp(a, "--ping-jitter-us") == 0) opt->ping_cfg.response_jitter_us = atoi(v);
+        else if (strcmp(a, "--ping-rate-ms") == 0) opt->ping_cfg.ping_interval_ms = atoi(v);
+        else if (strcmp(a, "--ping-depth-mm") == 0) opt->ping_cfg.depth_mm = atoi(v);
+        else if (strcmp(a, "--ping-points") == 0) opt->ping_cfg.points = atoi(v);
+        else if (strcmp(a, "--gps") == 0) opt->gps = v;
+        else if (strcmp(a, "--gps-rate-hz") == 0) opt->gps_cfg.nav_rate_hz = atoi(v);
+        else if (strcmp(a, "--gps-noise") == 0) opt->gps_cfg.noise_bytes = atoi(v);
+        else if (strcmp(a, "--gps-bad-ck") == 0) opt->gps_cfg.bad_ck_permille = atoi(v);
+        else if (strcmp(a, "--gps-rawx") == 0) opt->gps_cfg.rawx_meas = atoi(v);
+        else if (strcmp(a, "--lora") == 0) opt->lora = strcmp(v, "on") == 0;
+        else if (strcmp(a, "--lora-delay-us") == 0) opt->lora_cfg.response_delay_us = atoi(v);
+        else return false;
+        i++;
+    }
+    return true;
+}
+
+// behind the mux, or on a UART of its own when own_uart is set
+static void attach_device(mux_device_t dev, int own_uart, SimDevice *sim)
+{
+    if (own_uart < 0) {
+        sim_mux_attach(dev, sim);
+        return;
+    }
+    sim_port_attach(own_uart, sim);
+    uart_route_t route = {own_uart, -1, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE};
+    uart_manager_set_route(dev, &route);
+}
+
+static void main_task(void *arg)
+{
+    app_main();
+}
+
+static void sd_load_task(void *arg)
+{
+    sd_load_t *load = (sd_load_t *)arg;
+    // sd_task writes len bytes: a line of bytes - 1 characters and its newline
+    static save_req_t req;
+    memset(req.data, 'x', load->bytes - 1);
+    req.data[load->bytes - 1] = '\n';
+    req.data[load->bytes] = '\0';
+    req.device = GPS;
+    req.len = load->bytes;
+    int64_t period_us = 1000000 / load->per_s;
+    int64_t next = esp_timer_get_time();
+    for (;;) {
+        snprintf(req.fname, sizeof(req.fname), "load_%u.csv", (unsigned)(load->sent % load->files));
+        int64_t t0 = esp_timer_get_time();
+        xQueueSend(get_save_queue(), &req, portMAX_DELAY);
+        int64_t t1 = esp_timer_get_time();
+        if (t1 - t0 > load->send_us_max)
+            load->send_us_max = t1 - t0;
+        if (t1 - next > load->behind_us_max)
+            load->behind_us_max = t1 - next;
+        load->sent++;
+        next += period_us;
+        if (next > t1)
+            vTaskDelay(pdMS_TO_TICKS((next - t1 + 999) / 1000));
+    }
+}
+
+static void print_report(double seconds)
+{
+    printf("\n==== host run: %.1f s ====\n", seconds);
+
+    // queues
+    host_queue_stats_t qs[MAX_REPORT_QUEUES];
+    size_t nq = host_queue_stats(qs, MAX_REPORT_QUEUES);
+    if (nq > MAX_REPORT_QUEUES)
+        nq = MAX_REPORT_QUEUES;
+    printf("\n%-12s %6s %6s %6s %8s %8s %8s %10s %10s %8s\n",
+           "queue", "len", "item", "peak", "sent", "recv", "blocked", "avg_us", "max_us", "recv/s");
+    for (size_t i = 0; i < nq; i++) {
+        host_queue_stats_t *q = &qs[i];
+        printf("%-12s %6u %6u %6u %8u %8u %8u %10.0f %10llu %8.1f\n",
+               q->name ? q->name : "(unnamed)",
+               q->length, q->item_size, q->peak_waiting, q->sent, q->received, q->send_blocked,
+               q->received ? (double)q->latency_us_total / q->received : 0.0,
+               (unsigned long long)q->latency_us_max,
+               q->received / seconds);
+    }
+
+    // tasks
+    TaskStatus_t ts[MAX_REPORT_TASKS];
+    uint32_t total_us = 0;
+    UBaseType_t nt = uxTaskGetSystemState(ts, MAX_REPORT_TASKS, &total_us);
+    uint32_t gnss_cpu_us = 0;
+    printf("\n%-12s %4s %4s %10s %7s %12s\n", "task", "prio", "core", "cpu_us", "cpu%", "stack_free");
+    for (UBaseType_t i = 0; i < nt; i++) {
+        printf("%-12s %4u %4d %10u %6.2f%% %12u\n",
+               ts[i].pcTaskName, ts[i].uxCurrentPriority,
+               ts[i].xCoreID == tskNO_AFFINITY ? -1 : ts[i].xCoreID,
+               ts[i].ulRunTimeCounter,
+               total_us ? 100.0 * ts[i].ulRunTimeCounter / total_us : 0.0,
+               ts[i].usStackHighWaterMark);
+        if (strcmp(ts[i].pcTaskName, "gnss") == 0)
+            gnss_cpu_us = ts[i].ulRunTimeCounter;
+    }
+
+    // the UARTs, the shared one first
+    printf("\n");
+    for (int i = 0; i < UART_NUM_MAX; i++) {
+        uart_port_t port = (UART_PORT + i) % UART_NUM_MAX;
+        if (!get_uart_queue(port))
+            continue;
+        host_uart_stats_t us;
+        host_uart_get_stats(port, &us);
+        printf("uart%d: tx %u B, rx %u B, reads %u (%u short), blocked %.1f%% of run, "
+               "overflow %u B, dropped on switch %u B\n",
+               port, us.tx_bytes, us.rx_bytes, us.reads, us.read_timeouts,
+               100.0 * us.read_wait_us / (seconds * 1e6),
+               us.rx_overflow_bytes, us.rx_dropped_bytes);
+    }
+    sim_mux_stats_t ms;
+    sim_mux_get_stats(&ms);
+    printf("mux: %u switches, %u writes to empty address, %u at wrong baud, %u before the device settled\n",
+           ms.switches, ms.unrouted_tx, ms.garbled_tx, ms.unsettled_tx);
+    sim_mux_print_devices(stdout);
+    sim_port_print_devices(stdout);
+    uart_manager_print_schedule(stdout);
+    uart_pool_stats_t ps;
+    uart_pool_get_stats(&ps);
+    printf("uart pool: %u of %u transactions at peak, %u allocs, %u waited for a free one\n",
+           ps.peak_in_use, UART_POOL_SIZE, ps.allocs, ps.alloc_waits);
+    if (g_gnss_stream) {
+        uart_stream_stats_t st;
+        uart_stream_get_stats(&st);
+        printf("gnss stream: %llu B (%.0f B/s), %llu B dropped on a full ring, %u reads, %u returns to the GPS\n",
+               (unsigned long long)st.bytes, st.bytes / seconds, (unsigned long long)st.dropped_bytes,
+               st.drains, st.resumes);
+    }
+
+    // the card
+    host_sd_stats_t sd;
+    host_vfs_get_stats(&sd);
+    printf("sd: %u opens, %u writes, %llu B (%.1f KB/s), %u cluster allocs, %u stalls, %u spikes, "
+           "write avg %.0f us max %llu us, blocked %.1f%% of run\n",
+           sd.opens, sd.writes, (unsigned long long)sd.bytes, sd.bytes / 1024.0 / seconds,
+           sd.cluster_allocs, sd.stalls, sd.spikes,
+           sd.writes ? (double)sd.write_us_total / sd.writes : 0.0,
+           (unsigned long long)sd.write_us_max, 100.0 * sd.write_us_total / (seconds * 1e6));
+    // record age per stage, from the UART read it came out of
+    printf("\n");
+    latency_print(stdout);
+
+    if (sd_load.per_s)
+        printf("sd load: %u of %.0f save_req_t (%.1f/s), longest xQueueSend %.1f ms, fell behind by up to %.1f ms\n",
+               sd_load.sent, sd_load.per_s * seconds, sd_load.sent / seconds,
+               sd_load.send_us_max / 1e3, sd_load.behind_us_max / 1e3);
+    uart_capture_stats_t cs;
+    uart_capture_get_stats(&cs);
+    if (g_uart_capture)
+        printf("uart capture: %u transactions (%u dropped), %llu B written\n",
+               cs.recorded, cs.record_dropped, (unsigned long long)cs.bytes_written);
+    if (g_uart_replay)
+        printf("uart replay: %u transactions, %u with nothing left to replay, %u tx mismatches\n",
+               cs.replayed, cs.replay_missing, cs.replay_tx_mismatch);
+    if (sim_gps && sim_gps->delivered_frames())
+        printf("gnss: %.1f us cpu per UBX frame that reached the ESP\n",
+               (double)gnss_cpu_us / sim_gps->delivered_frames());
+    gnss_fix_t fix;
+    if (uint32_t version = gnss_get_fix(&fix))
+        printf("gnss fix: %u published, newest tow %u ms lat %.7f lng %.7f alt %.1f m, %u sats, %.0f ms old\n",
+               (unsigned)version, (unsigned)fix.itow_ms, fix.lat * 1e-7, fix.lng * 1e-7, fix.alt_mm / 1000.0,
+               (unsigned)fix.num_sats, (esp_timer_get_time() - fix.capture_us) / 1000.0);
+    if (sim_gps)
+        gnss_print_msg_stats(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    host_options_t opt = {
+        .seconds = 10,
+        .log_level = ESP_LOG_WARN,
+        .sd_dir = "sdcard",
+        .sd_timed = false,
+        .sd_model = HOST_SD_MODEL_DEFAULT(),
+        .sd_load = 0,
+        .sd_load_bytes = 200,
+        .sd_load_files = 3,
+        .sample_interval_ms = -1,
+        .log_interval_ms = -1,
+        .metrics_interval_ms = -1,
+        .metrics_lora = false,
+        .capture = false,
+        .replay = NULL,
+        .trace = NULL,
+        .decode_trace = NULL,
+        .switch_off_s = -1,
+        .speed = 1.0,
+        .nvs = NULL,
+        .calibrate = false,
+        .gnss_stream = false,
+        .gnss_rate_ms = -1,
+        .gps_settle_us = 2000,
+        .ping_settle_us = 1000,
+        .lora_settle_us = 3000,
+        .gps_uart = -1,
+        .ping_uart = -1,
+        .lora_uart = -1,
+        .seed = 1,
+        .ping = NULL,
+        .ping_cfg = SIM_PING1D_CONFIG_DEFAULT(),
+        .gps = NULL,
+        .gps_cfg = SIM_UBLOX_CONFIG_DEFAULT(),
+        .lora = false,
+        .lora_cfg = SIM_RN2483_CONFIG_DEFAULT(),
+    };
+    if (!parse_args(argc, argv, &opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    esp_log_level_set("*", opt.log_level);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (opt.decode_trace) {
+        FILE *f = fopen(opt.decode_trace, "rb");
+        if (!f || !uart_trace_decode(f, stdout)) {
+            fprintf(stderr, "%s is not a UART trace dump\n", opt.decode_trace);
+            return 1;
+        }
+        fclose(f);
+        return 0;
+    }
+
+    if (strcmp(opt.sd_dir, "ram") == 0)
+        host_vfs_use_ram();
+    else
+        host_vfs_set_root(opt.sd_dir);
+    if (opt.sd_timed) {
+        opt.sd_model.seed = opt.seed;
+        host_vfs_set_model(&opt.sd_model);
+    }
+    // a port of its own must be free: not the mux port, not another device's
+    int own_uart[] = {opt.gps_uart, opt.ping_uart, opt.lora_uart};
+    for (int i = 0; i < 3; i++) {
+        bool bad = own_uart[i] >= UART_NUM_MAX || own_uart[i] == UART_PORT;
+        for (int j = 0; j < i; j++)
+            bad |= own_uart[i] >= 0 && own_uart[i] == own_uart[j];
+        if (bad) {
+            fprintf(stderr, "UART %d is not free\n", own_uart[i]);
+            return 1;
+        }
+    }
+    sim_mux_init(UART_PORT);
+    if (opt.ping) {
+        opt.ping_cfg.profile_file = strcmp(opt.ping, "synth") == 0 ? NULL : opt.ping;
+        opt.ping_cfg.seed = opt.seed;
+        SimPing1D *ping = new SimPing1D(opt.ping_cfg);
+        ping->settle_us = opt.ping_settle_us;
+        attach_device(PING, opt.ping_uart, ping);
+    }
+    if (opt.gps) {
+        if (strcmp(opt.gps, "driver") != 0 && !sim_ublox_parse_msgs(opt.gps, &opt.gps_cfg.forced_msgs)) {
+            usage(argv[0]);
+            return 1;
+        }
+        opt.gps_cfg.seed = opt.seed;
+        sim_gps = new SimUblox(opt.gps_cfg);
+        sim_gps->settle_us = opt.gps_settle_us;
+        attach_device(GPS, opt.gps_uart, sim_gps);
+    }
+    if (opt.lora) {
+        opt.lora_cfg.seed = opt.seed;
+        SimRN2483 *lora = new SimRN2483(opt.lora_cfg);
+        lora->settle_us = opt.lora_settle_us;
+        attach_device(LORA, opt.lora_uart, lora);
+    }
+
+    if (opt.speed > 0 && opt.speed != 1.0)
+        host_set_time_scale(opt.speed);
+    g_uart_capture = opt.capture;
+    g_uart_calibrate = opt.calibrate;
+    g_gnss_stream = opt.gnss_stream;
+    if (opt.gnss_rate_ms >= 0)
+        g_gnss_rate_ms = opt.gnss_rate_ms;
+    host_nvs_set_file(opt.nvs);
+    if (opt.replay) {
+        if (!uart_replay_load(opt.replay))
+            return 1;
+        g_uart_replay = 1;
+    }
+
+    host_run_as_task(main_task, "main", 3584);
+
+    // app_main creates the queues from its own task, wait for the last one
+    while (!get_lora_queue())
+        vTaskDelay(1);
+    static char uart_queue_names[UART_NUM_MAX][16];
+    for (int port = 0; port < UART_NUM_MAX; port++) {
+        if (!get_uart_queue(port))
+            continue;
+        if (port == UART_PORT)
+            snprintf(uart_queue_names[port], sizeof(uart_queue_names[port]), "uart_queue");
+        else
+            snprintf(uart_queue_names[port], sizeof(uart_queue_names[port]), "uart%d_queue", port);
+        vQueueAddToRegistry(get_uart_queue(port), uart_queue_names[port]);
+    }
+    vQueueAddToRegistry(get_ping_queue(), "ping_queue");
+    vQueueAddToRegistry(get_save_queue(), "save_queue");
+    vQueueAddToRegistry(get_lora_queue(), "lora_queue");
+
+    if (opt.sample_interval_ms >= 0)
+        g_sample_interval_ms = opt.sample_interval_ms;
+    if (opt.log_interval_ms >= 0)
+        g_log_interval_ms = opt.log_interval_ms;
+    if (opt.metrics_interval_ms >= 0)
+        g_metrics_interval_ms = opt.metrics_interval_ms;
+    g_metrics_lora = opt.metrics_lora;
+
+    if (opt.sd_load > 0) {
+        sd_load.per_s = opt.sd_load;
+        sd_load.bytes = opt.sd_load_bytes < 2 ? 2 : opt.sd_load_bytes > MAX_DATA - 1 ? MAX_DATA - 1 : opt.sd_load_bytes;
+        sd_load.files = opt.sd_load_files < 1 ? 1 : opt.sd_load_files;
+        xTaskCreate(sd_load_task, "sd_load", 4096, &sd_load, 8, NULL);
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (opt.switch_off_s >= 0 && opt.switch_off_s < opt.seconds) {
+        vTaskDelay(pdMS_TO_TICKS(opt.switch_off_s * 1000));
+        host_gpio_set_input(TOGGLE_SW, 0);
+        vTaskDelay(pdMS_TO_TICKS((opt.seconds - opt.switch_off_s) * 1000));
+    } else {
+        vTaskDelay(pdMS_TO_TICKS(opt.seconds * 1000));
+    }
+    print_report((esp_timer_get_time() - start) / 1e6);
+    if (opt.trace) {
+        FILE *f = fopen(opt.trace, "wb");
+        if (!f || !uart_trace_dump(f))
+            fprintf(stderr, "Failed to write %s\n", opt.trace);
+        if (f)
+            fclose(f);
+    }
+
+    // the firmware tasks never return
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,84 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include <pthread.h>
+#include <string.h>
+
+#define MAX_TAG_LEVELS 16
+
+typedef struct {
+    char tag[24];
+    esp_log_level_t level;
+} tag_level_t;
+
+static esp_log_level_t default_level = ESP_LOG_INFO;
+static tag_level_t tag_levels[MAX_TAG_LEVELS];
+static int num_tag_levels = 0;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (strcmp(tag, "*") == 0) {
+        default_level = level;
+        return;
+    }
+    for (int i = 0; i < num_tag_levels; i++) {
+        if (strcmp(tag_levels[i].tag, tag) == 0) {
+            tag_levels[i].level = level;
+            return;
+        }
+    }
+    if (num_tag_levels < MAX_TAG_LEVELS) {
+        snprintf(tag_levels[num_tag_levels].tag, sizeof(tag_levels[0].tag), "%s", tag);
+        tag_levels[num_tag_levels].level = level;
+        num_tag_levels++;
+    }
+}
+
+esp_log_level_t esp_log_level_get(const char *tag)
+{
+    for (int i = 0; i < num_tag_levels; i++) {
+        if (strcmp(tag_levels[i].tag, tag) == 0)
+            return tag_levels[i].level;
+    }
+    return default_level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    (void)level;
+    (void)tag;
+    va_list args;
+    va_start(args, format);
+    pthread_mutex_lock(&log_lock);
+    vfprintf(stdout, format, args);
+    pthread_mutex_unlock(&log_lock);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
@@ -0,0 +1,190 @@
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "host_clock.h"
+#include "host_freertos.h"
+#include "esp_rom_sys.h"
+#include <errno.h>
+#include <pthread.h>
+#include <vector>
+
+static int64_t raw_monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// "boot" is the first time anything asks for the time. Simulated time runs
+// `scale` times faster than the host clock from the raw/virtual base pair on.
+static int64_t boot_us = raw_monotonic_us();
+static int64_t base_raw_us = boot_us;
+static int64_t base_virtual_us = 0;
+static double scale = 1.0;
+
+int64_t host_now_us()
+{
+    return base_virtual_us + (int64_t)((raw_monotonic_us() - base_raw_us) * scale);
+}
+
+double host_time_scale()
+{
+    return scale;
+}
+
+void host_set_time_scale(double speed)
+{
+    if (speed <= 0)
+        return;
+    int64_t now = host_now_us();
+    base_raw_us = raw_monotonic_us();
+    base_virtual_us = now;
+    scale = speed;
+}
+
+struct timespec host_deadline(int64_t t_us)
+{
+    int64_t abs_us = base_raw_us + (int64_t)((t_us - base_virtual_us) / scale);
+    struct timespec ts;
+    ts.tv_sec = abs_us / 1000000;
+    ts.tv_nsec = (abs_us % 1000000) * 1000;
+    return ts;
+}
+
+void host_sleep_until_us(int64_t t_us)
+{
+    struct timespec ts = host_deadline(t_us);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void host_sleep_us(int64_t us)
+{
+    if (us > 0)
+        host_sleep_until_us(host_now_us() + us);
+}
+
+// FreeRTOS counts a timeout in tick interrupts, so it ends at a tick
+// boundary: N ticks from mid tick are anywhere from N - 1 to N periods
+int64_t host_ticks_deadline_us(uint32_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+        return INT64_MAX;
+    int64_t tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+    return (host_now_us() / tick_us + ticks) * tick_us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_now_us();
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    host_sleep_us(us);
+}
+
+/* ONE SHOT TIMERS */
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t alarm_us;           // esp_timer time it fires, 0 while not armed
+};
+
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static std::vector<esp_timer *> armed;
+static bool timer_thread_started;
+
+static void *timer_thread(void *arg)
+{
+    pthread_mutex_lock(&timer_lock);
+    while (1) {
+        esp_timer *next = NULL;
+        for (esp_timer *t : armed) {
+            if (!next || t->alarm_us < next->alarm_us)
+                next = t;
+        }
+        if (!next) {
+            pthread_cond_wait(&timer_cond, &timer_lock);
+            continue;
+        }
+        if (next->alarm_us > host_now_us()) {
+            struct timespec ts = host_deadline(next->alarm_us);
+            pthread_cond_timedwait(&timer_cond, &timer_lock, &ts);
+            continue;
+        }
+        for (size_t i = 0; i < armed.size(); i++) {
+            if (armed[i] == next) {
+                armed.erase(armed.begin() + i);
+                break;
+            }
+        }
+        next->alarm_us = 0;
+        esp_timer_cb_t cb = next->callback;
+        void *cb_arg = next->arg;
+        pthread_mutex_unlock(&timer_lock);
+        cb(cb_arg);
+        pthread_mutex_lock(&timer_lock);
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (!create_args || !create_args->callback || !out_handle)
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&timer_lock);
+    if (!timer_thread_started) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&timer_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_t thread;
+        pthread_create(&thread, NULL, timer_thread, NULL);
+        pthread_detach(thread);
+        timer_thread_started = true;
+    }
+    pthread_mutex_unlock(&timer_lock);
+    *out_handle = new esp_timer{create_args->callback, create_args->arg, 0};
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    pthread_mutex_lock(&timer_lock);
+    if (timer->alarm_us) {
+        pthread_mutex_unlock(&timer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->alarm_us = host_now_us() + (int64_t)timeout_us;
+    if (timer->alarm_us == 0)
+        timer->alarm_us = 1;
+    armed.push_back(timer);
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&timer_lock);
+    bool was_armed = timer->alarm_us != 0;
+    for (size_t i = 0; i < armed.size(); i++) {
+        if (armed[i] == timer) {
+            armed.erase(armed.begin() + i);
+            break;
+        }
+    }
+    timer->alarm_us = 0;
+    pthread_mutex_unlock(&timer_lock);
+    return was_armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    esp_timer_stop(timer);
+    delete timer;
+    return ESP_OK;
+}
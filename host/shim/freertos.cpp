@@ -0,0 +1,504 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "host_freertos.h"
+#include "host_clock.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// x86_64 frames and glibc's printf need far more stack than the xtensa
+// build, so every task gets a scaled host stack. The stack is painted the
+// way FreeRTOS does it so the high water mark can still be read back.
+#define HOST_STACK_SCALE 4
+#define HOST_STACK_MIN (64 * 1024)
+#define STACK_FILL_BYTE 0xa5
+
+struct tskTaskControlBlock {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t stack_depth;
+    UBaseType_t priority;
+    BaseType_t core;
+    UBaseType_t number;
+
+    uint8_t *stack;             // NULL for adopted threads
+    size_t stack_size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+    bool deleted;
+
+    tskTaskControlBlock *next;
+};
+
+struct QueueDefinition {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    uint8_t *storage;
+    int64_t *stamps;            // enqueue time of each slot
+    UBaseType_t head;
+    UBaseType_t count;
+
+    const char *name;
+    UBaseType_t peak;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t send_blocked;
+    uint64_t latency_us_total;
+    uint64_t latency_us_max;
+
+    QueueDefinition *next;
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static tskTaskControlBlock *task_list = NULL;
+static QueueDefinition *queue_list = NULL;
+static UBaseType_t task_count = 0;
+
+static thread_local tskTaskControlBlock *current_task = NULL;
+
+/* UTILS */
+
+static void init_monotonic_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// waits on cond until woken or deadline passes, false on timeout
+static bool cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, int64_t deadline_us)
+{
+    if (deadline_us == INT64_MAX) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    struct timespec ts = host_deadline(deadline_us);
+    return pthread_cond_timedwait(cond, lock, &ts) == 0;
+}
+
+static tskTaskControlBlock *new_tcb(const char *name, uint32_t stack_depth, UBaseType_t priority, BaseType_t core)
+{
+    tskTaskControlBlock *tcb = (tskTaskControlBlock *)calloc(1, sizeof(tskTaskControlBlock));
+    snprintf(tcb->name, sizeof(tcb->name), "%s", name);
+    tcb->stack_depth = stack_depth;
+    tcb->priority = priority;
+    tcb->core = core;
+    pthread_mutex_init(&tcb->lock, NULL);
+    init_monotonic_cond(&tcb->cond);
+
+    pthread_mutex_lock(&registry_lock);
+    tcb->number = ++task_count;
+    tcb->next = task_list;
+    task_list = tcb;
+    pthread_mutex_unlock(&registry_lock);
+    return tcb;
+}
+
+static void *task_entry(void *arg)
+{
+    tskTaskControlBlock *tcb = (tskTaskControlBlock *)arg;
+    current_task = tcb;
+    pthread_setname_np(pthread_self(), tcb->name);
+    tcb->fn(tcb->arg);
+
+    // returning from a task is a bug on target, treat it like vTaskDelete(NULL)
+    fprintf(stderr, "task %s returned\n", tcb->name);
+    tcb->deleted = true;
+    return NULL;
+}
+
+/* TASKS */
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode,
+                                   const char *const pcName,
+                                   const uint32_t usStackDepth,
+                                   void *const pvParameters,
+                                   UBaseType_t uxPriority,
+                                   TaskHandle_t *const pvCreatedTask,
+                                   const BaseType_t xCoreID)
+{
+    tskTaskControlBlock *tcb = new_tcb(pcName, usStackDepth, uxPriority, xCoreID);
+    tcb->fn = pvTaskCode;
+    tcb->arg = pvParameters;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (size_t)usStackDepth * HOST_STACK_SCALE;
+    if (size < HOST_STACK_MIN)
+        size = HOST_STACK_MIN;
+    size = (size + page - 1) & ~(page - 1);
+
+    // one guard page below the stack
+    uint8_t *mem = (uint8_t *)mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return pdFAIL;
+    mprotect(mem, page, PROT_NONE);
+    tcb->stack = mem + page;
+    tcb->stack_size = size;
+    memset(tcb->stack, STACK_FILL_BYTE, size);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, tcb->stack, size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&tcb->thread, &attr, task_entry, tcb);
+    pthread_attr_destroy(&attr);
+    if (rc != 0)
+        return pdFAIL;
+
+    if (pvCreatedTask)
+        *pvCreatedTask = tcb;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    tskTaskControlBlock *tcb = xTaskToDelete ? xTaskToDelete : xTaskGetCurrentTaskHandle();
+    tcb->deleted = true;
+    if (tcb == current_task)
+        pthread_exit(NULL);
+    // deleting another task is not needed by the firmware
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    if (xTicksToDelay == 0)
+        sched_yield();
+    else
+        host_sleep_until_us(host_ticks_deadline_us(xTicksToDelay));
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *const pxPreviousWakeTime, const TickType_t xTimeIncrement)
+{
+    TickType_t wake = *pxPreviousWakeTime + xTimeIncrement;
+    *pxPreviousWakeTime = wake;
+    if ((int32_t)(wake - xTaskGetTickCount()) <= 0)
+        return pdFALSE;
+    host_sleep_until_us((int64_t)wake * portTICK_PERIOD_MS * 1000);
+    return pdTRUE;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    while (__atomic_exchange_n(&mux->owner, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(host_now_us() / (portTICK_PERIOD_MS * 1000));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!current_task) {
+        // a thread the shim did not start, e.g. the host main thread
+        current_task = new_tcb("host", 0, 1, tskNO_AFFINITY);
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+char *pcTaskGetName(TaskHandle_t xTaskToQuery)
+{
+    tskTaskControlBlock *tcb = xTaskToQuery ? xTaskToQuery : xTaskGetCurrentTaskHandle();
+    return tcb->name;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    return task_count;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    tskTaskControlBlock *tcb = xTask ? xTask : xTaskGetCurrentTaskHandle();
+    if (!tcb->stack)
+        return 0;
+    // stacks grow down, untouched fill bytes are at the low end
+    size_t i = 0;
+    while (i < tcb->stack_size && tcb->stack[i] == STACK_FILL_BYTE)
+        i++;
+    return (UBaseType_t)i;
+}
+
+static uint32_t thread_cpu_us(pthread_t thread)
+{
+    clockid_t cid;
+    struct timespec ts;
+    if (pthread_getcpuclockid(thread, &cid) != 0 || clock_gettime(cid, &ts) != 0)
+        return 0;
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *const pxTaskStatusArray,
+                                 const UBaseType_t uxArraySize,
+                                 uint32_t *const pulTotalRunTime)
+{
+    UBaseType_t n = 0;
+    pthread_mutex_lock(&registry_lock);
+    for (tskTaskControlBlock *tcb = task_list; tcb && n < uxArraySize; tcb = tcb->next) {
+        if (tcb->deleted)
+            continue;
+        TaskStatus_t *s = &pxTaskStatusArray[n++];
+        s->xHandle = tcb;
+        s->pcTaskName = tcb->name;
+        s->xTaskNumber = tcb->number;
+        s->eCurrentState = eBlocked;
+        s->uxCurrentPriority = tcb->priority;
+        s->uxBasePriority = tcb->priority;
+        s->ulRunTimeCounter = (uint32_t)(thread_cpu_us(tcb->thread) * host_time_scale());
+        s->pxStackBase = (StackType_t *)tcb->stack;
+        s->usStackHighWaterMark = uxTaskGetStackHighWaterMark(tcb);
+        s->xCoreID = tcb->core;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    if (pulTotalRunTime)
+        *pulTotalRunTime = (uint32_t)host_now_us();
+    return n;
+}
+
+/* NOTIFICATIONS */
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    pthread_mutex_lock(&xTaskToNotify->lock);
+    xTaskToNotify->notify++;
+    pthread_cond_signal(&xTaskToNotify->cond);
+    pthread_mutex_unlock(&xTaskToNotify->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    tskTaskControlBlock *tcb = xTaskGetCurrentTaskHandle();
+    int64_t deadline = host_ticks_deadline_us(xTicksToWait);
+
+    pthread_mutex_lock(&tcb->lock);
+    while (tcb->notify == 0 && xTicksToWait != 0) {
+        if (!cond_wait_until(&tcb->cond, &tcb->lock, deadline))
+            break;
+    }
+    uint32_t value = tcb->notify;
+    if (value) {
+        if (xClearCountOnExit)
+            tcb->notify = 0;
+        else
+            tcb->notify--;
+    }
+    pthread_mutex_unlock(&tcb->lock);
+    return value;
+}
+
+/* QUEUES */
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    QueueDefinition *q = (QueueDefinition *)calloc(1, sizeof(QueueDefinition));
+    if (!q)
+        return NULL;
+    q->length = uxQueueLength;
+    q->item_size = uxItemSize;
+    q->storage = (uint8_t *)calloc(uxQueueLength, uxItemSize);
+    q->stamps = (int64_t *)calloc(uxQueueLength, sizeof(int64_t));
+    pthread_mutex_init(&q->lock, NULL);
+    init_monotonic_cond(&q->not_empty);
+    init_monotonic_cond(&q->not_full);
+
+    // append so the report lists queues in creation order
+    pthread_mutex_lock(&registry_lock);
+    QueueDefinition **tail = &queue_list;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = q;
+    pthread_mutex_unlock(&registry_lock);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (QueueDefinition **p = &queue_list; *p; p = &(*p)->next) {
+        if (*p == xQueue) {
+            *p = xQueue->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    free(xQueue->storage);
+    free(xQueue->stamps);
+    free(xQueue);
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void *item, TickType_t ticks, bool front)
+{
+    int64_t deadline = host_ticks_deadline_us(ticks);
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->length && ticks != 0)
+        q->send_blocked++;
+    while (q->count == q->length) {
+        if (ticks == 0 || !cond_wait_until(&q->not_full, &q->lock, deadline)) {
+            if (q->count < q->length)
+                break;
+            pthread_mutex_unlock(&q->lock);
+            return errQUEUE_FULL;
+        }
+    }
+
+    UBaseType_t slot;
+    if (front) {
+        q->head = (q->head + q->length - 1) % q->length;
+        slot = q->head;
+    } else {
+        slot = (q->head + q->count) % q->length;
+    }
+    memcpy(q->storage + (size_t)slot * q->item_size, item, q->item_size);
+    q->stamps[slot] = host_now_us();
+    q->count++;
+    q->sent++;
+    if (q->count > q->peak)
+        q->peak = q->count;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return queue_send(xQueue, pvItemToQueue, xTicksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return queue_send(xQueue, pvItemToQueue, xTicksToWait, true);
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void *buf, TickType_t ticks, bool peek)
+{
+    int64_t deadline = host_ticks_deadline_us(ticks);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        if (ticks == 0 || !cond_wait_until(&q->not_empty, &q->lock, deadline)) {
+            if (q->count > 0)
+                break;
+            pthread_mutex_unlock(&q->lock);
+            return errQUEUE_EMPTY;
+        }
+    }
+
+    memcpy(buf, q->storage + (size_t)q->head * q->item_size, q->item_size);
+    if (!peek) {
+        uint64_t latency = (uint64_t)(host_now_us() - q->stamps[q->head]);
+        q->latency_us_total += latency;
+        if (latency > q->latency_us_max)
+            q->latency_us_max = latency;
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        q->received++;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    return queue_receive(xQueue, pvBuffer, xTicksToWait, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    return queue_receive(xQueue, pvBuffer, xTicksToWait, true);
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->lock);
+    xQueue->head = 0;
+    xQueue->count = 0;
+    pthread_cond_broadcast(&xQueue->not_full);
+    pthread_mutex_unlock(&xQueue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->lock);
+    UBaseType_t n = xQueue->count;
+    pthread_mutex_unlock(&xQueue->lock);
+    return n;
+}
+
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->lock);
+    UBaseType_t n = xQueue->length - xQueue->count;
+    pthread_mutex_unlock(&xQueue->lock);
+    return n;
+}
+
+void vQueueAddToRegistry(QueueHandle_t xQueue, const char *pcQueueName)
+{
+    if (xQueue)
+        xQueue->name = pcQueueName;
+}
+
+const char *pcQueueGetName(QueueHandle_t xQueue)
+{
+    return xQueue ? xQueue->name : NULL;
+}
+
+/* HOST ONLY */
+
+size_t host_queue_stats(host_queue_stats_t *out, size_t max)
+{
+    size_t n = 0;
+    pthread_mutex_lock(&registry_lock);
+    for (QueueDefinition *q = queue_list; q; q = q->next) {
+        if (n < max) {
+            host_queue_stats_t *s = &out[n];
+            pthread_mutex_lock(&q->lock);
+            s->handle = q;
+            s->name = q->name;
+            s->length = q->length;
+            s->item_size = q->item_size;
+            s->waiting = q->count;
+            s->peak_waiting = q->peak;
+            s->sent = q->sent;
+            s->received = q->received;
+            s->send_blocked = q->send_blocked;
+            s->latency_us_total = q->latency_us_total;
+            s->latency_us_max = q->latency_us_max;
+            pthread_mutex_unlock(&q->lock);
+        }
+        n++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return n;
+}
+
+void host_run_as_task(TaskFunction_t fn, const char *name, uint32_t stack_depth)
+{
+    xTaskCreatePinnedToCore(fn, name, stack_depth, NULL, 1, NULL, 0);
+}
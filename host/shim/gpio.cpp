@@ -0,0 +1,73 @@
+#include "driver/gpio.h"
+#include "host_gpio.h"
+
+static uint32_t levels[GPIO_NUM_MAX];
+static gpio_mode_t modes[GPIO_NUM_MAX];
+static host_gpio_hook_t hook = NULL;
+static void *hook_ctx = NULL;
+
+static bool valid(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_config(const gpio_config_t *pGPIOConfig)
+{
+    for (int i = 0; i < GPIO_NUM_MAX; i++) {
+        if (!(pGPIOConfig->pin_bit_mask & (1ULL << i)))
+            continue;
+        modes[i] = pGPIOConfig->mode;
+        // an unconnected input follows its pull resistor
+        if (pGPIOConfig->mode == GPIO_MODE_INPUT)
+            levels[i] = pGPIOConfig->pull_up_en ? 1 : 0;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    if (!valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    modes[gpio_num] = GPIO_MODE_DISABLE;
+    levels[gpio_num] = 0;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    if (!valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    modes[gpio_num] = mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    level = level ? 1 : 0;
+    bool changed = levels[gpio_num] != level;
+    levels[gpio_num] = level;
+    if (changed && hook)
+        hook(gpio_num, level, hook_ctx);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (!valid(gpio_num))
+        return 0;
+    return (int)levels[gpio_num];
+}
+
+void host_gpio_set_input(gpio_num_t gpio_num, uint32_t level)
+{
+    if (valid(gpio_num))
+        levels[gpio_num] = level ? 1 : 0;
+}
+
+void host_gpio_set_hook(host_gpio_hook_t fn, void *ctx)
+{
+    hook_ctx = ctx;
+    hook = fn;
+}
@@ -0,0 +1,19 @@
+#pragma once
+// Shared time base of the host shim. Everything that sleeps or stamps goes
+// through here so ticks, esp_timer and the simulated UART agree.
+#include <stdint.h>
+#include <time.h>
+
+int64_t host_now_us();
+
+// simulated seconds per host second, see host_set_time_scale()
+double host_time_scale();
+void host_sleep_until_us(int64_t t_us);
+void host_sleep_us(int64_t us);
+
+// absolute CLOCK_MONOTONIC deadline for pthread_cond_timedwait
+struct timespec host_deadline(int64_t t_us);
+
+// deadline for a FreeRTOS style wait: the tick boundary it ends on,
+// INT64_MAX for portMAX_DELAY
+int64_t host_ticks_deadline_us(uint32_t ticks);
@@ -0,0 +1,28 @@
+#pragma once
+#include "driver/spi_common.h"
+#include "driver/gpio.h"
+
+#define SDSPI_DEFAULT_DMA SPI_DMA_CH_AUTO
+
+typedef struct {
+    int slot;
+    int max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct {
+    spi_host_device_t host_id;
+    gpio_num_t gpio_cs;
+    gpio_num_t gpio_cd;
+    gpio_num_t gpio_wp;
+    gpio_num_t gpio_int;
+} sdspi_device_config_t;
+
+#define SDSPI_HOST_DEFAULT() { .slot = SPI2_HOST, .max_freq_khz = 20000 }
+
+#define SDSPI_DEVICE_CONFIG_DEFAULT() { \
+    .host_id = SPI2_HOST,               \
+    .gpio_cs = GPIO_NUM_13,             \
+    .gpio_cd = GPIO_NUM_NC,             \
+    .gpio_wp = GPIO_NUM_NC,             \
+    .gpio_int = GPIO_NUM_NC,            \
+}
@@ -0,0 +1,38 @@
+#pragma once
+// Host only: statistics the FreeRTOS shim keeps for the benchmark report.
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+typedef struct {
+    QueueHandle_t handle;
+    const char *name;           // from vQueueAddToRegistry, NULL if never registered
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t waiting;
+    UBaseType_t peak_waiting;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t send_blocked;      // sends that found the queue full and had to wait
+    uint64_t latency_us_total;  // enqueue -> dequeue time summed over received items
+    uint64_t latency_us_max;
+} host_queue_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// fills up to max entries in creation order, returns the number of queues
+size_t host_queue_stats(host_queue_stats_t *out, size_t max);
+
+// runs fn as a FreeRTOS task and returns once it has been started, used to
+// run app_main() the way the IDF main task does
+void host_run_as_task(TaskFunction_t fn, const char *name, uint32_t stack_depth);
+
+// runs ticks, esp_timer and the simulated devices speed times faster than
+// the host clock; call before starting the application
+void host_set_time_scale(double speed);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+// Host only: drive inputs and observe outputs of the gpio shim.
+#include "driver/gpio.h"
+
+typedef void (*host_gpio_hook_t)(gpio_num_t gpio_num, uint32_t level, void *ctx);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// set the level an input pin reads back, e.g. the TOGGLE_SW logging switch
+void host_gpio_set_input(gpio_num_t gpio_num, uint32_t level);
+
+// called after every gpio_set_level that changes a pin
+void host_gpio_set_hook(host_gpio_hook_t hook, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+// Host only: where the simulated NVS partition is kept between runs.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// file nvs_flash_init loads and nvs_commit rewrites, NULL (default) keeps
+// NVS in memory for the run only
+void host_nvs_set_file(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+// Host only: the far end of a simulated UART.
+//
+// A peer sees everything written to the port and schedules bytes back into
+// the driver RX buffer. Bytes are spaced by the port baud rate, 10 bits per
+// byte, so a read sees them arrive at wire speed.
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/uart.h"
+
+typedef struct {
+    // bytes written by the firmware, done_us is when the last stop bit left the pin
+    void (*on_tx)(void *ctx, uart_port_t port, const uint8_t *data, size_t len, int baud, int64_t done_us);
+    // optional, lets a peer produce unsolicited output up to now_us
+    void (*pump)(void *ctx, uart_port_t port, int64_t now_us);
+} host_uart_peer_t;
+
+typedef struct {
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;              // bytes handed to uart_read_bytes callers
+    uint32_t rx_overflow_bytes;     // bytes lost because the driver RX buffer was full
+    uint32_t rx_dropped_bytes;      // in flight bytes dropped by host_uart_drop_in_flight
+    uint32_t reads;
+    uint32_t read_timeouts;         // reads that returned short
+    uint64_t read_wait_us;          // time callers spent blocked in uart_read_bytes
+} host_uart_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void host_uart_attach(uart_port_t port, const host_uart_peer_t *peer, void *ctx);
+
+// queue bytes that start arriving at start_us, returns when the last one lands
+int64_t host_uart_deliver(uart_port_t port, const uint8_t *data, size_t len, int64_t start_us);
+
+// forget bytes that have not reached the pin yet, e.g. after a mux switch
+void host_uart_drop_in_flight(uart_port_t port);
+
+int host_uart_get_baud(uart_port_t port);
+void host_uart_get_stats(uart_port_t port, host_uart_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+// Host only: where the simulated SD card lives on the host filesystem, and
+// how slow it is.
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Write latency of the card, charged to the task calling fwrite / fflush /
+// fclose on a file under the mount point. A write costs write_base_us plus
+// its bytes at write_kbps, a FAT update each time a file grows into a new
+// cluster, and now and then a spike or a long internal erase stall.
+typedef struct {
+    uint32_t write_base_us;     // per write: command, busy wait, FAT / dir entry sync
+    uint32_t write_kbps;        // sustained write throughput over SPI, 0 for no cost
+    uint32_t cluster_alloc_us;  // FAT chain update when a file crosses a cluster
+    uint32_t stall_every_kb;    // card erase / wear levelling, every N KB written (0 off)
+    uint32_t stall_us;
+    uint16_t spike_permille;    // writes that take spike_us longer
+    uint32_t spike_us;
+    uint64_t seed;
+} host_sd_model_t;
+
+#define HOST_SD_MODEL_DEFAULT() {   \
+    .write_base_us = 1500,          \
+    .write_kbps = 1200,             \
+    .cluster_alloc_us = 3000,       \
+    .stall_every_kb = 512,          \
+    .stall_us = 150000,             \
+    .spike_permille = 20,           \
+    .spike_us = 25000,              \
+    .seed = 1,                      \
+}
+
+// a card that costs nothing, what the host filesystem gives
+#define HOST_SD_MODEL_NONE() {      \
+    .write_base_us = 0,             \
+    .write_kbps = 0,                \
+    .cluster_alloc_us = 0,          \
+    .stall_every_kb = 0,            \
+    .stall_us = 0,                  \
+    .spike_permille = 0,            \
+    .spike_us = 0,                  \
+    .seed = 1,                      \
+}
+
+typedef struct {
+    uint32_t opens;
+    uint32_t writes;            // write calls that reached the card (after stdio buffering)
+    uint64_t bytes;
+    uint32_t cluster_allocs;
+    uint32_t stalls;
+    uint32_t spikes;
+    uint64_t write_us_total;    // time callers spent blocked in the card
+    uint64_t write_us_max;
+} host_sd_stats_t;
+
+// directory that esp_vfs_fat_sdspi_mount maps its base path onto
+void host_vfs_set_root(const char *dir);
+
+// keep the card contents in memory instead of a host directory
+void host_vfs_use_ram(void);
+
+void host_vfs_set_model(const host_sd_model_t *model);
+void host_vfs_get_stats(host_sd_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
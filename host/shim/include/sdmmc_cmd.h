@@ -0,0 +1,28 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    int mfg_id;
+    int oem_id;
+    char name[8];
+    int revision;
+    int serial;
+    int date;
+} sdmmc_cid_t;
+
+typedef struct {
+    sdmmc_cid_t cid;
+    uint64_t capacity_bytes;
+} sdmmc_card_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,149 @@
+#include "nvs_flash.h"
+#include "host_nvs.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <string.h>
+
+// one "namespace key hexbytes" line per entry in the backing file
+static std::map<std::string, std::vector<uint8_t>> entries;
+static std::vector<std::string> namespaces;     // handle - 1
+static std::mutex nvs_lock;
+static std::string backing;
+static bool initialized;
+
+static std::string entry_key(nvs_handle_t handle, const char *key)
+{
+    return namespaces[handle - 1] + " " + key;
+}
+
+static bool valid(nvs_handle_t handle)
+{
+    return handle >= 1 && handle <= namespaces.size();
+}
+
+static void load()
+{
+    entries.clear();
+    if (backing.empty())
+        return;
+    FILE *f = fopen(backing.c_str(), "r");
+    if (!f)
+        return;
+    char ns[64], key[64], hex[8192];
+    while (fscanf(f, "%63s %63s %8191s", ns, key, hex) == 3) {
+        std::vector<uint8_t> value;
+        for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+            unsigned b;
+            sscanf(&hex[i], "%2x", &b);
+            value.push_back((uint8_t)b);
+        }
+        entries[std::string(ns) + " " + key] = value;
+    }
+    fclose(f);
+}
+
+static esp_err_t save()
+{
+    if (backing.empty())
+        return ESP_OK;
+    FILE *f = fopen(backing.c_str(), "w");
+    if (!f)
+        return ESP_FAIL;
+    for (auto &e : entries) {
+        fprintf(f, "%s ", e.first.c_str());
+        for (uint8_t b : e.second)
+            fprintf(f, "%02x", b);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    return ESP_OK;
+}
+
+void host_nvs_set_file(const char *path)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    backing = path ? path : "";
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    if (!initialized)
+        load();
+    initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    entries.clear();
+    return save();
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    if (!initialized)
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    for (size_t i = 0; i < namespaces.size(); i++) {
+        if (namespaces[i] == namespace_name) {
+            *out_handle = (nvs_handle_t)(i + 1);
+            return ESP_OK;
+        }
+    }
+    namespaces.push_back(namespace_name);
+    *out_handle = (nvs_handle_t)namespaces.size();
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    if (!valid(handle))
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    auto it = entries.find(entry_key(handle, key));
+    if (it == entries.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (!out_value) {
+        *length = it->second.size();
+        return ESP_OK;
+    }
+    if (*length < it->second.size())
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out_value, it->second.data(), it->second.size());
+    *length = it->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    if (!valid(handle))
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    const uint8_t *p = (const uint8_t *)value;
+    entries[entry_key(handle, key)] = std::vector<uint8_t>(p, p + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    if (!valid(handle))
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    return entries.erase(entry_key(handle, key)) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> g(nvs_lock);
+    if (!valid(handle))
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    return save();
+}
@@ -0,0 +1,430 @@
+#include "driver/uart.h"
+#include "host_uart.h"
+#include "host_clock.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// bytes a peer may have scheduled but not yet landed in the driver buffer
+#define IN_FLIGHT_MAX 16384
+// the S3 UART hardware FIFO, writes only block once it is full
+#define HW_FIFO_LEN 128
+// driver defaults for when the RX interrupt empties the FIFO
+#define RX_FULL_THRESH_DEFAULT 120
+#define RX_TOUT_DEFAULT 10
+
+typedef struct {
+    bool installed;
+    int baud;
+
+    // driver RX ring buffer (rx_buffer_size of uart_driver_install)
+    uint8_t *rx;
+    size_t rx_size;
+    size_t rx_head;
+    size_t rx_count;
+
+    // bytes on the wire, with the time each one finishes arriving; the ones
+    // that have arrived sit in the hardware FIFO until the RX interrupt
+    uint8_t fly_data[IN_FLIGHT_MAX];
+    int64_t fly_time[IN_FLIGHT_MAX];
+    size_t fly_head;
+    size_t fly_count;
+    int64_t rx_line_free_us;
+    int rx_full_thresh;         // FIFO bytes that raise the RX full interrupt
+    int rx_tout;                // idle symbols that raise the RX timeout interrupt
+
+    int64_t tx_done_us;
+
+    const host_uart_peer_t *peer;
+    void *peer_ctx;
+    host_uart_stats_t stats;
+
+    pthread_mutex_t lock;
+} port_t;
+
+static port_t ports[UART_NUM_MAX];
+static pthread_once_t ports_once = PTHREAD_ONCE_INIT;
+
+/* UTILS */
+
+static void init_ports()
+{
+    // recursive so a peer can deliver from inside on_tx / pump
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    for (int i = 0; i < UART_NUM_MAX; i++) {
+        pthread_mutex_init(&ports[i].lock, &attr);
+        ports[i].baud = 115200;
+        ports[i].rx_full_thresh = RX_FULL_THRESH_DEFAULT;
+        ports[i].rx_tout = RX_TOUT_DEFAULT;
+    }
+    pthread_mutexattr_destroy(&attr);
+}
+
+static port_t *get_port(uart_port_t uart_num)
+{
+    pthread_once(&ports_once, init_ports);
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX)
+        return NULL;
+    return &ports[uart_num];
+}
+
+// 8N1: ten bit times per byte
+static double byte_time_us(const port_t *p)
+{
+    return 10.0 * 1000000.0 / (double)(p->baud > 0 ? p->baud : 115200);
+}
+
+static int64_t fly_time_at(const port_t *p, size_t i)
+{
+    return p->fly_time[(p->fly_head + i) % IN_FLIGHT_MAX];
+}
+
+// bytes that have reached the FIFO by now
+static size_t arrived(const port_t *p, int64_t now)
+{
+    size_t n = 0;
+    while (n < p->fly_count && fly_time_at(p, n) <= now)
+        n++;
+    return n;
+}
+
+//
+// When the RX interrupt will have moved the byte at in flight index i into
+// the driver buffer: once the FIFO holds rx_full_thresh bytes, or once the
+// line has been idle for rx_tout symbols after it. Only bytes already
+// scheduled are known, a streaming peer may extend the burst.
+//
+static int64_t delivered_at(const port_t *p, size_t i)
+{
+    int64_t tout_us = (int64_t)(p->rx_tout * byte_time_us(p));
+    size_t j = i;
+    while (j + 1 < p->fly_count && fly_time_at(p, j + 1) <= fly_time_at(p, j) + tout_us)
+        j++;
+    int64_t t = fly_time_at(p, j) + tout_us;
+    size_t full = (size_t)p->rx_full_thresh - 1;
+    if (full < i)
+        full = i;
+    if (full < p->fly_count && fly_time_at(p, full) < t)
+        t = fly_time_at(p, full);
+    return t;
+}
+
+// run the RX interrupt: move the FIFO into the driver buffer if it is due
+static void land(port_t *p, int64_t now)
+{
+    if (p->peer && p->peer->pump)
+        p->peer->pump(p->peer_ctx, (uart_port_t)(p - ports), now);
+
+    size_t n = arrived(p, now);
+    if (n == 0)
+        return;
+    bool idle = now >= fly_time_at(p, n - 1) + (int64_t)(p->rx_tout * byte_time_us(p));
+    if (n < (size_t)p->rx_full_thresh && !idle)
+        return;
+    while (n--) {
+        uint8_t b = p->fly_data[p->fly_head];
+        p->fly_head = (p->fly_head + 1) % IN_FLIGHT_MAX;
+        p->fly_count--;
+
+        if (p->rx_count == p->rx_size) {
+            p->stats.rx_overflow_bytes++;
+            continue;
+        }
+        p->rx[(p->rx_head + p->rx_count) % p->rx_size] = b;
+        p->rx_count++;
+    }
+}
+
+static size_t take(port_t *p, uint8_t *buf, size_t len)
+{
+    size_t n = p->rx_count < len ? p->rx_count : len;
+    for (size_t i = 0; i < n; i++)
+        buf[i] = p->rx[(p->rx_head + i) % p->rx_size];
+    p->rx_head = (p->rx_head + n) % p->rx_size;
+    p->rx_count -= n;
+    return n;
+}
+
+/* DRIVER API */
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || rx_buffer_size <= HW_FIFO_LEN)
+        return ESP_ERR_INVALID_ARG;
+    if (p->installed)
+        return ESP_FAIL;
+
+    pthread_mutex_lock(&p->lock);
+    p->rx = (uint8_t *)calloc(1, rx_buffer_size);
+    p->rx_size = rx_buffer_size;
+    p->rx_head = 0;
+    p->rx_count = 0;
+    p->installed = true;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t uart_num)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || !p->installed)
+        return ESP_ERR_INVALID_STATE;
+    pthread_mutex_lock(&p->lock);
+    free(p->rx);
+    p->rx = NULL;
+    p->installed = false;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    port_t *p = get_port(uart_num);
+    if (!p)
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&p->lock);
+    p->baud = uart_config->baud_rate;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return get_port(uart_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_baudrate(uart_port_t uart_num, uint32_t baudrate)
+{
+    port_t *p = get_port(uart_num);
+    if (!p)
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&p->lock);
+    p->baud = (int)baudrate;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_full_threshold(uart_port_t uart_num, int threshold)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || threshold < 1 || threshold >= HW_FIFO_LEN)
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&p->lock);
+    p->rx_full_thresh = threshold;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || tout_thresh < 1 || tout_thresh > 126)
+        return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&p->lock);
+    p->rx_tout = tout_thresh;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_get_baudrate(uart_port_t uart_num, uint32_t *baudrate)
+{
+    port_t *p = get_port(uart_num);
+    if (!p)
+        return ESP_ERR_INVALID_ARG;
+    *baudrate = (uint32_t)p->baud;
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || !p->installed)
+        return -1;
+
+    pthread_mutex_lock(&p->lock);
+    int64_t now = host_now_us();
+    int64_t start = p->tx_done_us > now ? p->tx_done_us : now;
+    int64_t done = start + (int64_t)(size * byte_time_us(p));
+    p->tx_done_us = done;
+    p->stats.tx_bytes += size;
+    if (p->peer && p->peer->on_tx)
+        p->peer->on_tx(p->peer_ctx, uart_num, (const uint8_t *)src, size, p->baud, done);
+    // without a TX ring buffer the call returns once the rest fits in the FIFO
+    int64_t fifo_free = done - (int64_t)(HW_FIFO_LEN * byte_time_us(p));
+    pthread_mutex_unlock(&p->lock);
+
+    if (fifo_free > now)
+        host_sleep_until_us(fifo_free);
+    return (int)size;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || !p->installed)
+        return -1;
+
+    int64_t start = host_now_us();
+    int64_t deadline = host_ticks_deadline_us(ticks_to_wait);
+
+    pthread_mutex_lock(&p->lock);
+    while (1) {
+        int64_t now = host_now_us();
+        land(p, now);
+        if (p->rx_count >= length || now >= deadline)
+            break;
+
+        // sleep until the byte that completes the read is in the driver
+        // buffer, or the deadline
+        int64_t wake = deadline;
+        size_t missing = length - p->rx_count;
+        if (p->fly_count >= missing) {
+            int64_t t = delivered_at(p, missing - 1);
+            if (t < wake)
+                wake = t > now ? t : now + 1;
+        }
+        // streaming peers only produce bytes when pumped
+        if (p->peer && p->peer->pump && now + 1000 < wake)
+            wake = now + 1000;
+
+        pthread_mutex_unlock(&p->lock);
+        host_sleep_until_us(wake);
+        pthread_mutex_lock(&p->lock);
+    }
+
+    size_t n = take(p, (uint8_t *)buf, length);
+    p->stats.reads++;
+    p->stats.rx_bytes += n;
+    if (n < length)
+        p->stats.read_timeouts++;
+    p->stats.read_wait_us += (uint64_t)(host_now_us() - start);
+    pthread_mutex_unlock(&p->lock);
+    return (int)n;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || !p->installed)
+        return ESP_FAIL;
+
+    pthread_mutex_lock(&p->lock);
+    int64_t done = p->tx_done_us;
+    pthread_mutex_unlock(&p->lock);
+
+    int64_t deadline = host_ticks_deadline_us(ticks_to_wait);
+    if (done > deadline) {
+        host_sleep_until_us(deadline);
+        return ESP_ERR_TIMEOUT;
+    }
+    host_sleep_until_us(done);
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || !p->installed)
+        return ESP_FAIL;
+    pthread_mutex_lock(&p->lock);
+    land(p, host_now_us());
+    *size = p->rx_count;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    port_t *p = get_port(uart_num);
+    if (!p || !p->installed)
+        return ESP_FAIL;
+    pthread_mutex_lock(&p->lock);
+    int64_t now = host_now_us();
+    land(p, now);
+    p->rx_head = 0;
+    p->rx_count = 0;
+    // and the FIFO
+    size_t n = arrived(p, now);
+    p->fly_head = (p->fly_head + n) % IN_FLIGHT_MAX;
+    p->fly_count -= n;
+    pthread_mutex_unlock(&p->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_flush(uart_port_t uart_num)
+{
+    return uart_flush_input(uart_num);
+}
+
+/* HOST ONLY */
+
+void host_uart_attach(uart_port_t port, const host_uart_peer_t *peer, void *ctx)
+{
+    port_t *p = get_port(port);
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->peer = peer;
+    p->peer_ctx = ctx;
+    pthread_mutex_unlock(&p->lock);
+}
+
+int64_t host_uart_deliver(uart_port_t port, const uint8_t *data, size_t len, int64_t start_us)
+{
+    port_t *p = get_port(port);
+    if (!p)
+        return start_us;
+
+    pthread_mutex_lock(&p->lock);
+    double byte_us = byte_time_us(p);
+    int64_t t0 = p->rx_line_free_us > start_us ? p->rx_line_free_us : start_us;
+    int64_t t = t0;
+    for (size_t i = 0; i < len; i++) {
+        t = t0 + (int64_t)((i + 1) * byte_us);
+        if (p->fly_count == IN_FLIGHT_MAX) {
+            p->stats.rx_overflow_bytes++;
+            continue;
+        }
+        size_t slot = (p->fly_head + p->fly_count) % IN_FLIGHT_MAX;
+        p->fly_data[slot] = data[i];
+        p->fly_time[slot] = t;
+        p->fly_count++;
+    }
+    p->rx_line_free_us = t;
+    pthread_mutex_unlock(&p->lock);
+    return t;
+}
+
+void host_uart_drop_in_flight(uart_port_t port)
+{
+    port_t *p = get_port(port);
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    int64_t now = host_now_us();
+    land(p, now);
+    size_t in_fifo = arrived(p, now);
+    p->stats.rx_dropped_bytes += p->fly_count - in_fifo;
+    p->fly_count = in_fifo;
+    p->rx_line_free_us = now;
+    pthread_mutex_unlock(&p->lock);
+}
+
+int host_uart_get_baud(uart_port_t port)
+{
+    port_t *p = get_port(port);
+    return p ? p->baud : 0;
+}
+
+void host_uart_get_stats(uart_port_t port, host_uart_stats_t *stats)
+{
+    port_t *p = get_port(port);
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    *stats = p->stats;
+    pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,315 @@
+#include "esp_vfs_fat.h"
+#include "host_vfs.h"
+#include "host_clock.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// fopen is wrapped at link time (-Wl,--wrap=fopen) so the unchanged
+// sd_task code can keep using absolute "/sdcard/..." paths
+extern "C" FILE *__real_fopen(const char *path, const char *mode);
+
+#define DEFAULT_CLUSTER_SIZE (16 * 1024)
+
+static const char *TAG = "HOST_VFS";
+static char root_dir[256] = "sdcard";
+static char base_path[32];
+static sdmmc_card_t card;
+static int max_files;
+static size_t cluster_size = DEFAULT_CLUSTER_SIZE;
+
+// the card, one command at a time whichever task writes
+static pthread_mutex_t card_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_sd_model_t model = HOST_SD_MODEL_NONE();
+static host_sd_stats_t stats;
+static uint64_t rng_state = 1;
+static uint64_t since_stall_bytes;
+static int64_t card_free_us;
+static int open_files;
+static bool use_ram;
+static std::map<std::string, std::vector<uint8_t>> ram_files;
+
+typedef struct {
+    int fd;                         // -1 for a file kept in ram_files
+    std::vector<uint8_t> *ram;
+    uint64_t pos;
+    uint64_t size;
+    bool append;
+} sd_file_t;
+
+void host_vfs_set_root(const char *dir)
+{
+    snprintf(root_dir, sizeof(root_dir), "%s", dir);
+}
+
+void host_vfs_use_ram(void)
+{
+    use_ram = true;
+}
+
+void host_vfs_set_model(const host_sd_model_t *m)
+{
+    pthread_mutex_lock(&card_lock);
+    model = *m;
+    rng_state = m->seed ? m->seed : 1;
+    pthread_mutex_unlock(&card_lock);
+}
+
+void host_vfs_get_stats(host_sd_stats_t *out)
+{
+    pthread_mutex_lock(&card_lock);
+    *out = stats;
+    pthread_mutex_unlock(&card_lock);
+}
+
+/* CARD TIMING */
+
+static double rng_uniform()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// blocks the caller for as long as the card takes to write len bytes at
+// offset, queued behind whatever the card is still busy with
+static void card_write(uint64_t offset, size_t len)
+{
+    int64_t now = host_now_us();
+    pthread_mutex_lock(&card_lock);
+    int64_t cost = model.write_base_us;
+    if (model.write_kbps)
+        cost += (int64_t)len * 1000 / model.write_kbps;
+    uint64_t clusters_before = (offset + cluster_size - 1) / cluster_size;
+    uint64_t clusters_after = (offset + len + cluster_size - 1) / cluster_size;
+    if (clusters_after > clusters_before) {
+        stats.cluster_allocs += (uint32_t)(clusters_after - clusters_before);
+        cost += (int64_t)(clusters_after - clusters_before) * model.cluster_alloc_us;
+    }
+    if (model.stall_every_kb) {
+        since_stall_bytes += len;
+        if (since_stall_bytes >= (uint64_t)model.stall_every_kb * 1024) {
+            since_stall_bytes -= (uint64_t)model.stall_every_kb * 1024;
+            stats.stalls++;
+            cost += model.stall_us;
+        }
+    }
+    if (model.spike_permille && rng_uniform() * 1000 < model.spike_permille) {
+        stats.spikes++;
+        cost += model.spike_us;
+    }
+
+    int64_t start = card_free_us > now ? card_free_us : now;
+    card_free_us = start + cost;
+    int64_t blocked = card_free_us - now;
+    stats.writes++;
+    stats.bytes += len;
+    stats.write_us_total += blocked;
+    if ((uint64_t)blocked > stats.write_us_max)
+        stats.write_us_max = blocked;
+    int64_t done = card_free_us;
+    pthread_mutex_unlock(&card_lock);
+
+    if (blocked > 0)
+        host_sleep_until_us(done);
+}
+
+/* FILES */
+
+static ssize_t sd_read(void *cookie, char *buf, size_t size)
+{
+    sd_file_t *f = (sd_file_t *)cookie;
+    if (f->fd >= 0) {
+        ssize_t n = pread(f->fd, buf, size, (off_t)f->pos);
+        if (n > 0)
+            f->pos += n;
+        return n;
+    }
+    pthread_mutex_lock(&card_lock);
+    size_t n = 0;
+    if (f->pos < f->ram->size()) {
+        n = f->ram->size() - f->pos;
+        if (n > size)
+            n = size;
+        memcpy(buf, f->ram->data() + f->pos, n);
+        f->pos += n;
+    }
+    pthread_mutex_unlock(&card_lock);
+    return (ssize_t)n;
+}
+
+static ssize_t sd_write(void *cookie, const char *buf, size_t size)
+{
+    sd_file_t *f = (sd_file_t *)cookie;
+    if (f->append)
+        f->pos = f->size;
+    uint64_t offset = f->pos;
+
+    if (f->fd >= 0) {
+        ssize_t n = pwrite(f->fd, buf, size, (off_t)offset);
+        if (n < 0)
+            return -1;
+        size = (size_t)n;
+    } else {
+        pthread_mutex_lock(&card_lock);
+        if (f->ram->size() < offset + size)
+            f->ram->resize(offset + size);
+        memcpy(f->ram->data() + offset, buf, size);
+        pthread_mutex_unlock(&card_lock);
+    }
+    f->pos += size;
+    if (f->pos > f->size)
+        f->size = f->pos;
+
+    card_write(offset, size);
+    return (ssize_t)size;
+}
+
+static int sd_seek(void *cookie, off64_t *offset, int whence)
+{
+    sd_file_t *f = (sd_file_t *)cookie;
+    int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (int64_t)f->pos : (int64_t)f->size;
+    if (base + *offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->pos = (uint64_t)(base + *offset);
+    *offset = (off64_t)f->pos;
+    return 0;
+}
+
+static int sd_close(void *cookie)
+{
+    sd_file_t *f = (sd_file_t *)cookie;
+    int ret = f->fd >= 0 ? close(f->fd) : 0;
+    pthread_mutex_lock(&card_lock);
+    open_files--;
+    pthread_mutex_unlock(&card_lock);
+    delete f;
+    return ret;
+}
+
+static FILE *sd_open(const char *host_path, const char *mode)
+{
+    bool plus = strchr(mode, '+') != NULL;
+    int flags;
+    switch (mode[0]) {
+    case 'r': flags = plus ? O_RDWR : O_RDONLY; break;
+    case 'w': flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC; break;
+    case 'a': flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND; break;
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&card_lock);
+    // FATFS only has max_files file objects
+    if (max_files > 0 && open_files >= max_files) {
+        pthread_mutex_unlock(&card_lock);
+        errno = ENFILE;
+        return NULL;
+    }
+    sd_file_t *f = new sd_file_t{-1, NULL, 0, 0, mode[0] == 'a'};
+    if (use_ram) {
+        auto it = ram_files.find(host_path);
+        if (it == ram_files.end()) {
+            if (!(flags & O_CREAT)) {
+                pthread_mutex_unlock(&card_lock);
+                delete f;
+                errno = ENOENT;
+                return NULL;
+            }
+            it = ram_files.emplace(host_path, std::vector<uint8_t>()).first;
+        }
+        if (flags & O_TRUNC)
+            it->second.clear();
+        f->ram = &it->second;
+        f->size = it->second.size();
+    } else {
+        f->fd = open(host_path, flags & ~O_APPEND, 0644);
+        struct stat st;
+        if (f->fd < 0 || fstat(f->fd, &st) != 0) {
+            int err = errno;
+            pthread_mutex_unlock(&card_lock);
+            if (f->fd >= 0)
+                close(f->fd);
+            delete f;
+            errno = err;
+            return NULL;
+        }
+        f->size = (uint64_t)st.st_size;
+    }
+    open_files++;
+    stats.opens++;
+    pthread_mutex_unlock(&card_lock);
+
+    cookie_io_functions_t io = {sd_read, sd_write, sd_seek, sd_close};
+    FILE *fp = fopencookie(f, mode, io);
+    if (!fp)
+        sd_close(f);
+    return fp;
+}
+
+extern "C" FILE *__wrap_fopen(const char *path, const char *mode)
+{
+    size_t base_len = strlen(base_path);
+    if (base_len == 0 || strncmp(path, base_path, base_len) != 0 || path[base_len] != '/')
+        return __real_fopen(path, mode);
+
+    char host_path[512];
+    snprintf(host_path, sizeof(host_path), "%s%s", root_dir, path + base_len);
+    return sd_open(host_path, mode);
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id, const spi_bus_config_t *bus_config, spi_dma_chan_t dma_chan)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *path,
+                                  const sdmmc_host_t *host_config_input,
+                                  const sdspi_device_config_t *slot_config,
+                                  const esp_vfs_fat_mount_config_t *mount_config,
+                                  sdmmc_card_t **out_card)
+{
+    if (base_path[0] != '\0')
+        return ESP_ERR_INVALID_STATE;
+    if (!use_ram && mkdir(root_dir, 0755) != 0) {
+        struct stat st;
+        if (stat(root_dir, &st) != 0 || !S_ISDIR(st.st_mode))
+            return ESP_FAIL;
+    }
+    snprintf(base_path, sizeof(base_path), "%s", path);
+    snprintf(card.cid.name, sizeof(card.cid.name), "HOST");
+    card.capacity_bytes = 0;
+    // taken as the card's cluster size, as if it had been formatted with it
+    max_files = mount_config ? mount_config->max_files : 0;
+    if (mount_config && mount_config->allocation_unit_size)
+        cluster_size = mount_config->allocation_unit_size;
+    ESP_LOGI(TAG, "%s mapped to %s", base_path, use_ram ? "ram" : root_dir);
+    if (out_card)
+        *out_card = &card;
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdcard_unmount(const char *path, sdmmc_card_t *out_card)
+{
+    base_path[0] = '\0';
+    return ESP_OK;
+}
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *c)
+{
+    if (use_ram)
+        fprintf(stream, "Name: %s\nType: host ram\n", c->cid.name);
+    else
+        fprintf(stream, "Name: %s\nType: host directory %s\n", c->cid.name, root_dir);
+}
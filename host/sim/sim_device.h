@@ -0,0 +1,57 @@
+#pragma once
+// Simulated devices behind the 3-bit UART mux of the logger PCB.
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "driver/uart.h"
+
+class SimDevice {
+public:
+    virtual ~SimDevice() {}
+
+    virtual const char *name() = 0;
+
+    // bytes the firmware wrote while the mux pointed at this device,
+    // at_us is when the last byte finished arriving
+    virtual void on_rx(const uint8_t *data, size_t len, int64_t at_us) = 0;
+
+    // unsolicited output, called with the current time whenever the port is serviced
+    virtual void pump(int64_t now_us) {}
+
+    // one or two lines for the end of run report
+    virtual void print_stats(FILE *out) {}
+
+    // line rate the device talks at, a mismatch garbles both directions
+    int baud = 115200;
+
+    // time after the mux selects it before the device hears writes
+    int settle_us = 0;
+
+    // where it is wired, set by sim_mux_attach or sim_port_attach;
+    // mux_addr is -1 for a device with a UART of its own
+    uart_port_t port = UART_NUM_MAX;
+    int mux_addr = -1;
+
+protected:
+    // queue bytes towards the ESP starting at at_us, dropped unless selected
+    // (or on a port of its own) at a matching baud, returns when the last
+    // byte lands (or at_us if dropped)
+    int64_t send(const uint8_t *data, size_t len, int64_t at_us);
+};
+
+typedef struct {
+    uint32_t switches;          // changes of the selected address
+    uint32_t garbled_tx;        // writes that reached a device at the wrong baud
+    uint32_t unrouted_tx;       // writes to an address with no device attached
+    uint32_t unsettled_tx;      // writes lost because the device had not settled since the switch
+} sim_mux_stats_t;
+
+void sim_mux_init(uart_port_t port);
+void sim_mux_attach(int addr, SimDevice *dev);
+int sim_mux_selected();
+void sim_mux_get_stats(sim_mux_stats_t *stats);
+void sim_mux_print_devices(FILE *out);
+
+// a device on a UART of its own, for boards that spread them over controllers
+void sim_port_attach(uart_port_t port, SimDevice *dev);
+void sim_port_print_devices(FILE *out);
@@ -0,0 +1,112 @@
+#include "sim_device.h"
+#include "host_uart.h"
+#include "host_gpio.h"
+#include "driver/gpio.h"
+#include "hardware.h"
+#include "esp_timer.h"
+
+#define MUX_ADDRESSES 8
+
+static uart_port_t mux_port = UART_PORT;
+static SimDevice *devices[MUX_ADDRESSES];
+static int selected = 0;
+static int64_t selected_us;
+static sim_mux_stats_t stats;
+
+static int read_address()
+{
+    return (gpio_get_level(MUX_A0) << 0) |
+           (gpio_get_level(MUX_A1) << 1) |
+           (gpio_get_level(MUX_A2) << 2);
+}
+
+static void on_gpio(gpio_num_t gpio_num, uint32_t level, void *ctx)
+{
+    if (gpio_num != MUX_A0 && gpio_num != MUX_A1 && gpio_num != MUX_A2)
+        return;
+    int addr = read_address();
+    if (addr == selected)
+        return;
+    // whatever the old device still had on the wire never reaches the ESP
+    host_uart_drop_in_flight(mux_port);
+    selected = addr;
+    selected_us = esp_timer_get_time();
+    stats.switches++;
+}
+
+static void on_tx(void *ctx, uart_port_t port, const uint8_t *data, size_t len, int baud, int64_t done_us)
+{
+    SimDevice *dev = devices[selected];
+    if (!dev) {
+        stats.unrouted_tx++;
+        return;
+    }
+    if (dev->baud != baud) {
+        stats.garbled_tx++;
+        return;
+    }
+    if (done_us - selected_us < dev->settle_us) {
+        stats.unsettled_tx++;
+        return;
+    }
+    dev->on_rx(data, len, done_us);
+}
+
+static void pump(void *ctx, uart_port_t port, int64_t now_us)
+{
+    for (int i = 0; i < MUX_ADDRESSES; i++) {
+        if (devices[i])
+            devices[i]->pump(now_us);
+    }
+}
+
+static const host_uart_peer_t mux_peer = {
+    .on_tx = on_tx,
+    .pump = pump,
+};
+
+int64_t SimDevice::send(const uint8_t *data, size_t len, int64_t at_us)
+{
+    if (port < 0 || port >= UART_NUM_MAX || baud != host_uart_get_baud(port))
+        return at_us;
+    if (mux_addr >= 0 && mux_addr != selected)
+        return at_us;
+    return host_uart_deliver(port, data, len, at_us);
+}
+
+void sim_mux_init(uart_port_t port)
+{
+    mux_port = port;
+    selected = read_address();
+    host_gpio_set_hook(on_gpio, NULL);
+    host_uart_attach(port, &mux_peer, NULL);
+}
+
+void sim_mux_attach(int addr, SimDevice *dev)
+{
+    if (addr < 0 || addr >= MUX_ADDRESSES)
+        return;
+    dev->port = mux_port;
+    dev->mux_addr = addr;
+    devices[addr] = dev;
+}
+
+int sim_mux_selected()
+{
+    return selected;
+}
+
+void sim_mux_get_stats(sim_mux_stats_t *out)
+{
+    *out = stats;
+}
+
+void sim_mux_print_devices(FILE *out)
+{
+    for (int i = 0; i < MUX_ADDRESSES; i++) {
+        if (devices[i]) {
+            fprintf(out, "[%d] %s: ", i, devices[i]->name());
+            devices[i]->print_stats(out);
+        }
+    }
+}
@@ -0,0 +1,298 @@
+#include "sim_ping1d.h"
+#include <math.h>
+#include <string.h>
+
+// https://docs.bluerobotics.com/ping-protocol/pingmessage-common/
+// https://docs.bluerobotics.com/ping-protocol/pingmessage-ping1d/
+
+#define PING_DEVICE_ID 1
+#define MAX_PAYLOAD 502     // what fits the firmware's 512 byte PingParser
+
+/* UTILS */
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+SimPing1D::SimPing1D(const sim_ping1d_config_t &config)
+    : cfg(config)
+    , rng(config.seed)
+{
+    if (cfg.points > MAX_PAYLOAD - 26)
+        cfg.points = MAX_PAYLOAD - 26;
+    if (cfg.profile_file)
+        load_profiles(cfg.profile_file);
+}
+
+// keep the profile (1300) frames of a raw capture, anything else is skipped
+void SimPing1D::load_profiles(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "ping1d: cannot open %s\n", path);
+        return;
+    }
+    PingParser file_parser(1024);
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+        if (file_parser.parseByte((uint8_t)c) != PingParser::State::NEW_MESSAGE)
+            continue;
+        const ping_message &msg = file_parser.rxMessage;
+        if (msg.message_id() != 1300 || msg.payload_length() < 26 || msg.payload_length() > MAX_PAYLOAD)
+            continue;
+        replay.emplace_back(msg.payload_data(), msg.payload_data() + msg.payload_length());
+    }
+    fclose(f);
+    fprintf(stderr, "ping1d: %zu profiles loaded from %s\n", replay.size(), path);
+}
+
+/* FRAMES */
+
+int64_t SimPing1D::respond(uint16_t id, const uint8_t *payload, uint16_t len, int64_t at_us)
+{
+    ping_message msg(ping_message::headerLength + len + ping_message::checksumLength);
+    msg.set_payload_length(len);
+    msg.set_message_id(id);
+    msg.set_source_device_id(PING_DEVICE_ID);
+    msg.set_destination_device_id(0);
+    if (len)
+        memcpy(msg.payload_data(), payload, len);
+    msg.updateChecksum();
+    return send(msg.msgData, msg.msgDataLength(), at_us);
+}
+
+int64_t SimPing1D::respond_ack(uint16_t acked_id, int64_t at_us)
+{
+    uint8_t p[2];
+    put_u16(p, acked_id);
+    return respond(1, p, sizeof(p), at_us);
+}
+
+int64_t SimPing1D::respond_nack(uint16_t nacked_id, const char *text, int64_t at_us)
+{
+    uint8_t p[64];
+    size_t n = strlen(text);
+    if (n > sizeof(p) - 2)
+        n = sizeof(p) - 2;
+    put_u16(p, nacked_id);
+    memcpy(p + 2, text, n);
+    nacks++;
+    return respond(2, p, (uint16_t)(n + 2), at_us);
+}
+
+// 1300 payload, from the capture if one was loaded
+uint16_t SimPing1D::build_profile(uint8_t *p, int64_t at_us)
+{
+    ping_number++;
+
+    if (!replay.empty()) {
+        const std::vector<uint8_t> &src = replay[replay_index];
+        replay_index = (replay_index + 1) % replay.size();
+        memcpy(p, src.data(), src.size());
+        put_u32(p + 8, ping_number);
+        return (uint16_t)src.size();
+    }
+
+    // slow swell plus a little per ping noise
+    double t = at_us / 1e6;
+    double depth = cfg.depth_mm + cfg.swell_mm * sin(2.0 * M_PI * t / 8.0) + 20.0 * (rng.uniform() - 0.5);
+    if (depth < 0)
+        depth = 0;
+
+    uint16_t n = cfg.points;
+    put_u32(p + 0, (uint32_t)depth);
+    put_u16(p + 4, 95);                     // confidence
+    put_u16(p + 6, 100);                    // transmit_duration_us
+    put_u32(p + 8, ping_number);
+    put_u32(p + 12, scan_start_mm);
+    put_u32(p + 16, scan_length_mm);
+    put_u32(p + 20, gain_setting);
+    put_u16(p + 24, n);
+
+    // ring down near the transducer, an echo at the bottom, noise floor
+    double bin_mm = (double)scan_length_mm / (n ? n : 1);
+    double bottom_bin = (depth - scan_start_mm) / (bin_mm > 0 ? bin_mm : 1);
+    for (uint16_t i = 0; i < n; i++) {
+        double v = 8.0 + 6.0 * rng.uniform();
+        v += 200.0 * exp(-(double)i / 4.0);
+        double d = (i - bottom_bin) / 2.5;
+        v += 230.0 * exp(-d * d);
+        p[26 + i] = (uint8_t)(v > 255.0 ? 255.0 : v);
+    }
+    return (uint16_t)(26 + n);
+}
+
+// answer for a "get" style id, as a general_request or a bare request
+int64_t SimPing1D::respond_get(uint16_t id, int64_t at_us)
+{
+    uint8_t p[MAX_PAYLOAD];
+    switch (id) {
+    case 4: // device_information
+        p[0] = 1;   // device_type: Ping1D
+        p[1] = 1;   // device_revision
+        p[2] = 3;   // firmware major
+        p[3] = 29;  // firmware minor
+        p[4] = 0;   // firmware patch
+        p[5] = 0;
+        return respond(id, p, 6, at_us);
+    case 5: // protocol_version
+        p[0] = 1;
+        p[1] = 0;
+        p[2] = 0;
+        p[3] = 0;
+        return respond(id, p, 4, at_us);
+    case 1203:
+        put_u32(p, speed_of_sound);
+        return respond(id, p, 4, at_us);
+    case 1204:
+        put_u32(p, scan_start_mm);
+        put_u32(p + 4, scan_length_mm);
+        return respond(id, p, 8, at_us);
+    case 1205:
+        p[0] = mode_auto;
+        return respond(id, p, 1, at_us);
+    case 1206:
+        put_u16(p, cfg.ping_interval_ms);
+        return respond(id, p, 2, at_us);
+    case 1207:
+        put_u32(p, gain_setting);
+        return respond(id, p, 4, at_us);
+    case 1211:
+    case 1212: {
+        // distance is the fixed part of a profile, distance_simple its
+        // first 5 bytes (distance and the low byte of confidence)
+        build_profile(p, at_us);
+        return respond(id, p, id == 1211 ? 5 : 24, at_us);
+    }
+    case 1300: {
+        uint16_t len = build_profile(p, at_us);
+        profiles++;
+        return respond(id, p, len, at_us);
+    }
+    default:
+        return respond_nack(id, "unknown request", at_us);
+    }
+}
+
+void SimPing1D::handle(const ping_message &msg, int64_t at_us)
+{
+    requests++;
+    int64_t t = at_us + cfg.response_delay_us + rng.jitter(cfg.response_jitter_us);
+    if (t < at_us)
+        t = at_us;
+
+    const uint8_t *p = msg.payload_data();
+    uint16_t len = msg.payload_length();
+    uint16_t id = msg.message_id();
+
+    switch (id) {
+    case 6: // general_request
+        if (len < 2) {
+            respond_nack(id, "missing requested_id", t);
+            return;
+        }
+        respond_get(get_u16(p), t);
+        return;
+    case 1001: // set_range
+        if (len < 8)
+            break;
+        scan_start_mm = get_u32(p);
+        scan_length_mm = get_u32(p + 4);
+        respond_ack(id, t);
+        return;
+    case 1002: // set_speed_of_sound
+        if (len < 4)
+            break;
+        speed_of_sound = get_u32(p);
+        respond_ack(id, t);
+        return;
+    case 1003: // set_mode_auto
+        if (len < 1)
+            break;
+        mode_auto = p[0];
+        respond_ack(id, t);
+        return;
+    case 1004: // set_ping_interval
+        if (len < 2)
+            break;
+        cfg.ping_interval_ms = get_u16(p);
+        respond_ack(id, t);
+        return;
+    case 1005: // set_gain_setting
+        if (len < 1)
+            break;
+        gain_setting = p[0];
+        respond_ack(id, t);
+        return;
+    case 1006: // set_ping_enable
+        respond_ack(id, t);
+        return;
+    case 1400: // continuous_start
+        if (len < 2)
+            break;
+        stream_id = get_u16(p);
+        next_stream_us = t;
+        respond_ack(id, t);
+        return;
+    case 1401: // continuous_stop
+        stream_id = 0;
+        respond_ack(id, t);
+        return;
+    default:
+        // a bare message with a get id is treated as a request for it
+        if (id >= 1200 && id <= 1300) {
+            respond_get(id, t);
+            return;
+        }
+        respond_nack(id, "unknown message", t);
+        return;
+    }
+    respond_nack(id, "payload too short", t);
+}
+
+/* SIM DEVICE */
+
+void SimPing1D::on_rx(const uint8_t *data, size_t len, int64_t at_us)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (parser.parseByte(data[i]) == PingParser::State::NEW_MESSAGE)
+            handle(parser.rxMessage, at_us);
+    }
+}
+
+void SimPing1D::pump(int64_t now_us)
+{
+    if (!stream_id || cfg.ping_interval_ms == 0)
+        return;
+    while (next_stream_us <= now_us) {
+        respond_get(stream_id, next_stream_us);
+        next_stream_us += (int64_t)cfg.ping_interval_ms * 1000;
+    }
+}
+
+void SimPing1D::print_stats(FILE *out)
+{
+    fprintf(out, "%u requests, %u profiles (ping %u), %u nacks, %s\n",
+            requests, profiles, ping_number, nacks,
+            replay.empty() ? "synthetic bottom" : "replayed profiles");
+}
@@ -0,0 +1,76 @@
+#pragma once
+// Ping1D echosounder model answering the ping protocol over the mux.
+//
+// Requests are answered with checksummed ping_message frames after a
+// configurable response delay and jitter. Profiles come from a synthetic
+// bottom or are replayed from a file of raw captured ping frames.
+#include "sim_device.h"
+#include "sim_random.h"
+#include "ping-parser.h"
+#include <vector>
+
+typedef struct {
+    const char *profile_file;   // raw ping frames, NULL for a synthetic bottom
+    uint32_t depth_mm;          // synthetic bottom, mean depth
+    uint32_t swell_mm;          // synthetic bottom, amplitude of a slow depth change
+    uint16_t points;            // synthetic profile length
+    uint32_t response_delay_us; // request fully received -> first response byte
+    uint32_t response_jitter_us;
+    uint16_t ping_interval_ms;  // continuous mode rate
+    uint64_t seed;
+} sim_ping1d_config_t;
+
+#define SIM_PING1D_CONFIG_DEFAULT() {   \
+    .profile_file = NULL,               \
+    .depth_mm = 2500,                   \
+    .swell_mm = 300,                    \
+    .points = 200,                      \
+    .response_delay_us = 2000,          \
+    .response_jitter_us = 500,          \
+    .ping_interval_ms = 50,             \
+    .seed = 1,                          \
+}
+
+class SimPing1D : public SimDevice {
+public:
+    explicit SimPing1D(const sim_ping1d_config_t &config);
+
+    const char *name() override { return "ping1d"; }
+    void on_rx(const uint8_t *data, size_t len, int64_t at_us) override;
+    void pump(int64_t now_us) override;
+    void print_stats(FILE *out) override;
+
+    // number of profiles loaded from profile_file
+    size_t loaded_profiles() const { return replay.size(); }
+
+private:
+    void handle(const ping_message &msg, int64_t at_us);
+    int64_t respond(uint16_t id, const uint8_t *payload, uint16_t len, int64_t at_us);
+    int64_t respond_ack(uint16_t acked_id, int64_t at_us);
+    int64_t respond_nack(uint16_t nacked_id, const char *text, int64_t at_us);
+    int64_t respond_get(uint16_t id, int64_t at_us);
+    uint16_t build_profile(uint8_t *payload, int64_t at_us);
+    void load_profiles(const char *path);
+
+    sim_ping1d_config_t cfg;
+    PingParser parser;
+    SimRandom rng;
+    std::vector<std::vector<uint8_t>> replay;
+    size_t replay_index = 0;
+
+    // device settings
+    uint32_t scan_start_mm = 0;
+    uint32_t scan_length_mm = 5000;
+    uint32_t gain_setting = 0;
+    uint8_t mode_auto = 1;
+    uint32_t speed_of_sound = 1500000;
+    uint32_t ping_number = 0;
+
+    // continuous_start
+    uint16_t stream_id = 0;
+    int64_t next_stream_us = 0;
+
+    uint32_t requests = 0;
+    uint32_t profiles = 0;
+    uint32_t nacks = 0;
+};
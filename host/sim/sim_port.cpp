@@ -0,0 +1,48 @@
+#include "sim_device.h"
+#include "host_uart.h"
+
+// devices wired straight to a UART of their own, no mux in between
+static SimDevice *devices[UART_NUM_MAX];
+static uint32_t garbled_tx[UART_NUM_MAX];
+
+static void on_tx(void *ctx, uart_port_t port, const uint8_t *data, size_t len, int baud, int64_t done_us)
+{
+    SimDevice *dev = (SimDevice *)ctx;
+    if (dev->baud != baud) {
+        garbled_tx[port]++;
+        return;
+    }
+    dev->on_rx(data, len, done_us);
+}
+
+static void pump(void *ctx, uart_port_t port, int64_t now_us)
+{
+    ((SimDevice *)ctx)->pump(now_us);
+}
+
+static const host_uart_peer_t direct_peer = {
+    .on_tx = on_tx,
+    .pump = pump,
+};
+
+void sim_port_attach(uart_port_t port, SimDevice *dev)
+{
+    if (port < 0 || port >= UART_NUM_MAX)
+        return;
+    dev->port = port;
+    dev->mux_addr = -1;
+    devices[port] = dev;
+    host_uart_attach(port, &direct_peer, dev);
+}
+
+void sim_port_print_devices(FILE *out)
+{
+    for (int i = 0; i < UART_NUM_MAX; i++) {
+        if (devices[i]) {
+            fprintf(out, "[uart%d] %s: ", i, devices[i]->name());
+            devices[i]->print_stats(out);
+            if (garbled_tx[i])
+                fprintf(out, "    %u writes at the wrong baud\n", garbled_tx[i]);
+        }
+    }
+}
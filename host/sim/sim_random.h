@@ -0,0 +1,30 @@
+#pragma once
+// Small seeded generator so simulated runs are repeatable.
+#include <stdint.h>
+
+class SimRandom {
+public:
+    explicit SimRandom(uint64_t seed = 1) : s(seed ? seed : 1) {}
+
+    uint64_t next()
+    {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return s;
+    }
+
+    // uniform in [0, 1)
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    // uniform in [-range, range]
+    int64_t jitter(int64_t range)
+    {
+        if (range <= 0)
+            return 0;
+        return (int64_t)(next() % (uint64_t)(2 * range + 1)) - range;
+    }
+
+private:
+    uint64_t s;
+};
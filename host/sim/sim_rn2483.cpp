@@ -0,0 +1,277 @@
+#include "sim_rn2483.h"
+#include "esp_timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// RN2483 LoRa Technology Module Command Reference User's Guide (DS40001784)
+
+#define MAX_LINE 530            // "radio tx " and 255 bytes of hex, with margin
+#define MAX_PAYLOAD 255
+
+int64_t sim_lora_airtime_us(int sf, int bw_khz, int cr, int preamble, bool crc, int payload_len)
+{
+    double t_sym_us = (double)(1 << sf) * 1000.0 / bw_khz;
+    // low data rate optimisation is forced on once a symbol takes 16 ms
+    int de = t_sym_us >= 16000.0 ? 1 : 0;
+    int num = 8 * payload_len - 4 * sf + 28 + (crc ? 16 : 0);
+    int den = 4 * (sf - 2 * de);
+    int blocks = num > 0 ? (num + den - 1) / den : 0;
+    int payload_symbols = 8 + blocks * (cr + 4);
+    return (int64_t)((preamble + 4.25) * t_sym_us + payload_symbols * t_sym_us);
+}
+
+static bool parse_int(const char *s, long lo, long hi, long *out)
+{
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (!*s || *end || v < lo || v > hi)
+        return false;
+    *out = v;
+    return true;
+}
+
+SimRN2483::SimRN2483(const sim_rn2483_config_t &config)
+    : cfg(config)
+    , rng(config.seed)
+    , created_us(esp_timer_get_time())
+{
+    baud = 57600;
+}
+
+/* REPLIES */
+
+// a "busy" can be due before the "radio_tx_ok" queued ahead of it
+void SimRN2483::reply(const std::string &text, int64_t at_us)
+{
+    auto it = out.end();
+    while (it != out.begin() && (it - 1)->at_us > at_us)
+        --it;
+    out.insert(it, {text + "\r\n", at_us});
+}
+
+const char *SimRN2483::radio_set(const char *param, const char *value)
+{
+    long v;
+    if (strcmp(param, "mod") == 0) {
+        if (strcmp(value, "lora") && strcmp(value, "fsk"))
+            return "invalid_param";
+        mod = value;
+    } else if (strcmp(param, "freq") == 0) {
+        if (!parse_int(value, 433050000, 870000000, &v) || (v > 434790000 && v < 863000000))
+            return "invalid_param";
+        freq = (uint32_t)v;
+    } else if (strcmp(param, "bw") == 0) {
+        if (!parse_int(value, 125, 500, &v) || (v != 125 && v != 250 && v != 500))
+            return "invalid_param";
+        bw_khz = (int)v;
+    } else if (strcmp(param, "sf") == 0) {
+        if (strncmp(value, "sf", 2) || !parse_int(value + 2, 7, 12, &v))
+            return "invalid_param";
+        sf = (int)v;
+    } else if (strcmp(param, "cr") == 0) {
+        if (strncmp(value, "4/", 2) || !parse_int(value + 2, 5, 8, &v))
+            return "invalid_param";
+        cr = (int)v - 4;
+    } else if (strcmp(param, "prlen") == 0) {
+        if (!parse_int(value, 0, 65535, &v))
+            return "invalid_param";
+        prlen = (int)v;
+    } else if (strcmp(param, "crc") == 0) {
+        if (strcmp(value, "on") && strcmp(value, "off"))
+            return "invalid_param";
+        crc = strcmp(value, "on") == 0;
+    } else if (strcmp(param, "sync") == 0) {
+        if (!*value || strlen(value) > 2 || strspn(value, "0123456789abcdefABCDEF") != strlen(value))
+            return "invalid_param";
+        sync = value;
+    } else if (strcmp(param, "pwr") == 0) {
+        if (!parse_int(value, -3, 15, &v))
+            return "invalid_param";
+        pwr = (int)v;
+    } else if (strcmp(param, "wdt") == 0) {
+        if (!parse_int(value, 0, 4294967295L, &v))
+            return "invalid_param";
+        wdt_ms = (uint32_t)v;
+    } else if (strcmp(param, "iqi") == 0 || strcmp(param, "afcbw") == 0 || strcmp(param, "rxbw") == 0 ||
+               strcmp(param, "bitrate") == 0 || strcmp(param, "fdev") == 0 || strcmp(param, "bt") == 0) {
+        // FSK and receive settings, accepted but not modelled
+        if (!*value)
+            return "invalid_param";
+    } else {
+        return "invalid_param";
+    }
+    return "ok";
+}
+
+std::string SimRN2483::radio_get(const char *param)
+{
+    char buf[32];
+    if (strcmp(param, "mod") == 0) return mod;
+    if (strcmp(param, "freq") == 0) { snprintf(buf, sizeof(buf), "%u", freq); return buf; }
+    if (strcmp(param, "bw") == 0) { snprintf(buf, sizeof(buf), "%d", bw_khz); return buf; }
+    if (strcmp(param, "sf") == 0) { snprintf(buf, sizeof(buf), "sf%d", sf); return buf; }
+    if (strcmp(param, "cr") == 0) { snprintf(buf, sizeof(buf), "4/%d", cr + 4); return buf; }
+    if (strcmp(param, "prlen") == 0) { snprintf(buf, sizeof(buf), "%d", prlen); return buf; }
+    if (strcmp(param, "crc") == 0) return crc ? "on" : "off";
+    if (strcmp(param, "sync") == 0) return sync;
+    if (strcmp(param, "pwr") == 0) { snprintf(buf, sizeof(buf), "%d", pwr); return buf; }
+    if (strcmp(param, "wdt") == 0) { snprintf(buf, sizeof(buf), "%u", wdt_ms); return buf; }
+    return "invalid_param";
+}
+
+void SimRN2483::radio_tx(const char *hex, int64_t t)
+{
+    size_t n = strlen(hex);
+    if (n == 0 || n % 2 || n / 2 > MAX_PAYLOAD || strspn(hex, "0123456789abcdefABCDEF") != n || mod != "lora") {
+        invalid++;
+        reply("invalid_param", t);
+        return;
+    }
+    // the radio only takes commands while the LoRaWAN stack is paused
+    if (!mac_paused || t < tx_end_us) {
+        tx_busy++;
+        reply("busy", t);
+        return;
+    }
+
+    int len = (int)(n / 2);
+    int64_t air = sim_lora_airtime_us(sf, bw_khz, cr, prlen, crc, len);
+    reply("ok", t);
+    if (wdt_ms && air > (int64_t)wdt_ms * 1000) {
+        tx_err++;
+        tx_end_us = t + (int64_t)wdt_ms * 1000;
+        airtime_us += (int64_t)wdt_ms * 1000;
+        reply("radio_err", tx_end_us);
+        return;
+    }
+    tx_end_us = t + air;
+    tx_ok++;
+    tx_payload_bytes += len;
+    airtime_us += air;
+    reply("radio_tx_ok", tx_end_us);
+}
+
+void SimRN2483::handle(const std::string &text, int64_t at_us)
+{
+    commands++;
+    int64_t t = at_us + cfg.response_delay_us + rng.jitter(cfg.response_jitter_us);
+    if (t < at_us)
+        t = at_us;
+
+    char buf[MAX_LINE + 1];
+    snprintf(buf, sizeof(buf), "%s", text.c_str());
+    char *save = NULL;
+    const char *w1 = strtok_r(buf, " ", &save);
+    const char *w2 = strtok_r(NULL, " ", &save);
+    const char *w3 = strtok_r(NULL, " ", &save);
+    const char *w4 = strtok_r(NULL, "", &save);
+    if (!w1)
+        w1 = "";
+    if (!w2)
+        w2 = "";
+    if (!w3)
+        w3 = "";
+    if (!w4)
+        w4 = "";
+
+    if (strcmp(w1, "sys") == 0) {
+        if (strcmp(w2, "get") == 0 && strcmp(w3, "ver") == 0) {
+            reply("RN2483 1.0.5 Oct 31 2018 15:06:52", t);
+            return;
+        }
+        if (strcmp(w2, "set") == 0 && strcmp(w3, "pindig") == 0 && *w4) {
+            reply("ok", t);
+            return;
+        }
+        if (strcmp(w2, "reset") == 0) {
+            mac_paused = false;
+            tx_end_us = 0;
+            reply("RN2483 1.0.5 Oct 31 2018 15:06:52", t);
+            return;
+        }
+    } else if (strcmp(w1, "mac") == 0) {
+        if (strcmp(w2, "pause") == 0) {
+            mac_paused = true;
+            reply("4294967245", t);
+            return;
+        }
+        if (strcmp(w2, "resume") == 0) {
+            mac_paused = false;
+            reply("ok", t);
+            return;
+        }
+        if (strcmp(w2, "reset") == 0 || strcmp(w2, "set") == 0 || strcmp(w2, "save") == 0) {
+            reply("ok", t);
+            return;
+        }
+        if (strcmp(w2, "join") == 0) {
+            // the default all zero keys never join
+            reply("keys_not_init", t);
+            return;
+        }
+        if (strcmp(w2, "tx") == 0) {
+            reply("not_joined", t);
+            return;
+        }
+    } else if (strcmp(w1, "radio") == 0) {
+        if (strcmp(w2, "set") == 0) {
+            const char *r = radio_set(w3, w4);
+            if (strcmp(r, "ok"))
+                invalid++;
+            reply(r, t);
+            return;
+        }
+        if (strcmp(w2, "get") == 0) {
+            reply(radio_get(w3), t);
+            return;
+        }
+        if (strcmp(w2, "tx") == 0) {
+            radio_tx(w3, t);
+            return;
+        }
+    }
+    invalid++;
+    reply("invalid_param", t);
+}
+
+/* SIM DEVICE */
+
+void SimRN2483::on_rx(const uint8_t *data, size_t len, int64_t at_us)
+{
+    for (size_t i = 0; i < len; i++) {
+        char c = (char)data[i];
+        if (c == '\n') {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.size() > MAX_LINE) {
+                invalid++;
+                reply("invalid_param", at_us + cfg.response_delay_us);
+            } else if (!line.empty()) {
+                handle(line, at_us);
+            }
+            line.clear();
+            continue;
+        }
+        if (line.size() <= MAX_LINE)
+            line += c;
+    }
+}
+
+void SimRN2483::pump(int64_t now_us)
+{
+    while (!out.empty() && out.front().at_us <= now_us) {
+        const pending_t &p = out.front();
+        send((const uint8_t *)p.text.data(), p.text.size(), p.at_us);
+        out.pop_front();
+    }
+}
+
+void SimRN2483::print_stats(FILE *out_file)
+{
+    double run_s = (esp_timer_get_time() - created_us) / 1e6;
+    fprintf(out_file, "%u commands (%u invalid), radio tx: %u ok, %u busy, %u watchdog\n",
+            commands, invalid, tx_ok, tx_busy, tx_err);
+    fprintf(out_file, "    sf%d bw%d cr4/%d: %.2f s on air (%.1f%% duty), %llu B payload, %.2f packets/s\n",
+            sf, bw_khz, cr + 4, airtime_us / 1e6, run_s > 0 ? 100.0 * airtime_us / 1e6 / run_s : 0.0,
+            (unsigned long long)tx_payload_bytes, run_s > 0 ? tx_ok / run_s : 0.0);
+}
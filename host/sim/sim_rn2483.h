@@ -0,0 +1,79 @@
+#pragma once
+// RN2483 model answering the ASCII command set over the mux at 57600 baud.
+//
+// "radio set / get" keep the LoRa modem settings, "radio tx <hex>" answers
+// "ok" and then "radio_tx_ok" once the packet's airtime has passed (or
+// "radio_err" when the watchdog fires first). A radio tx while the previous
+// packet is still on air answers "busy", as the module does.
+#include "sim_device.h"
+#include "sim_random.h"
+#include <deque>
+#include <string>
+
+typedef struct {
+    uint32_t response_delay_us; // command line received -> first byte of the reply
+    uint32_t response_jitter_us;
+    uint64_t seed;
+} sim_rn2483_config_t;
+
+#define SIM_RN2483_CONFIG_DEFAULT() {   \
+    .response_delay_us = 2000,          \
+    .response_jitter_us = 500,          \
+    .seed = 1,                          \
+}
+
+// LoRa time on air of one packet (Semtech AN1200.13), explicit header
+int64_t sim_lora_airtime_us(int sf, int bw_khz, int cr, int preamble, bool crc, int payload_len);
+
+class SimRN2483 : public SimDevice {
+public:
+    explicit SimRN2483(const sim_rn2483_config_t &config);
+
+    const char *name() override { return "rn2483"; }
+    void on_rx(const uint8_t *data, size_t len, int64_t at_us) override;
+    void pump(int64_t now_us) override;
+    void print_stats(FILE *out) override;
+
+private:
+    void handle(const std::string &line, int64_t at_us);
+    const char *radio_set(const char *param, const char *value);
+    std::string radio_get(const char *param);
+    void radio_tx(const char *hex, int64_t at_us);
+    void reply(const std::string &line, int64_t at_us);
+
+    sim_rn2483_config_t cfg;
+    SimRandom rng;
+    std::string line;
+    int64_t created_us;
+
+    // lines waiting for their time, put on the wire by pump()
+    struct pending_t {
+        std::string text;
+        int64_t at_us;
+    };
+    std::deque<pending_t> out;
+
+    // modem settings, power on defaults
+    bool mac_paused = false;
+    std::string mod = "lora";
+    uint32_t freq = 868100000;
+    int bw_khz = 125;
+    int sf = 12;
+    int cr = 1;                 // 4/5
+    int prlen = 8;
+    bool crc = true;
+    std::string sync = "34";
+    int pwr = 1;
+    uint32_t wdt_ms = 15000;
+
+    // the packet on air
+    int64_t tx_end_us = 0;
+
+    uint32_t commands = 0;
+    uint32_t invalid = 0;
+    uint32_t tx_ok = 0;
+    uint32_t tx_busy = 0;
+    uint32_t tx_err = 0;
+    uint64_t tx_payload_bytes = 0;
+    int64_t airtime_us = 0;
+};
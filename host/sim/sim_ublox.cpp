@@ -0,0 +1,610 @@
+#include "sim_ublox.h"
+#include <math.h>
+#include <string.h>
+
+// u-blox 8 / M8 receiver description and protocol specification (UBX-13003221)
+
+#define CLASS_NAV 0x01
+#define CLASS_RXM 0x02
+#define CLASS_ACK 0x05
+#define CLASS_CFG 0x06
+#define CLASS_MON 0x0A
+
+#define UBX_MAX_PAYLOAD 1024
+#define UBX_TX_BUFFER 4096      // receiver side, output that does not fit is dropped
+#define UBX_PORT_UART1 1
+
+// a boat circling near the origin
+#define ORIGIN_LAT_DEG 52.3700
+#define ORIGIN_LON_DEG 4.9000
+#define CIRCLE_RADIUS_M 40.0
+#define BOAT_SPEED_MS 1.5
+#define START_TOW_MS 259200000u // wednesday 00:00
+#define GPS_WEEK 2400
+
+typedef struct {
+    uint8_t cls;
+    uint8_t id;
+    const char *name;
+} ubx_msg_def_t;
+
+static const ubx_msg_def_t msg_defs[SIM_UBX_MSG_COUNT] = {
+    // in sim_ubx_msg_t order
+    {CLASS_NAV, 0x07, "pvt"},
+    {CLASS_NAV, 0x02, "posllh"},
+    {CLASS_NAV, 0x03, "status"},
+    {CLASS_NAV, 0x12, "velned"},
+    {CLASS_MON, 0x09, "hw"},
+    {CLASS_RXM, 0x15, "rawx"},
+};
+
+/* UTILS */
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+// UBX floats are little endian IEEE, like the host
+static void put_f32(uint8_t *p, float v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put_f64(uint8_t *p, double v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint16_t msg_key(uint8_t cls, uint8_t id)
+{
+    return (uint16_t)(cls << 8 | id);
+}
+
+static void checksum(const uint8_t *data, size_t len, uint8_t *ck_a, uint8_t *ck_b)
+{
+    uint8_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += data[i];
+        b += a;
+    }
+    *ck_a = a;
+    *ck_b = b;
+}
+
+bool sim_ublox_parse_msgs(const char *list, uint32_t *mask)
+{
+    *mask = 0;
+    while (*list) {
+        size_t n = strcspn(list, ",");
+        int found = -1;
+        for (int i = 0; i < SIM_UBX_MSG_COUNT; i++) {
+            if (strlen(msg_defs[i].name) == n && strncmp(list, msg_defs[i].name, n) == 0)
+                found = i;
+        }
+        if (found < 0)
+            return false;
+        *mask |= SIM_UBX_BIT(found);
+        list += n;
+        if (*list == ',')
+            list++;
+    }
+    return true;
+}
+
+SimUblox::SimUblox(const sim_ublox_config_t &config)
+    : cfg(config)
+    , rng(config.seed)
+{
+    if (cfg.rawx_meas > 32)
+        cfg.rawx_meas = 32;
+    itow_ms = START_TOW_MS;
+
+    for (int i = 0; i < SIM_UBX_MSG_COUNT; i++) {
+        if (cfg.boot_msgs & SIM_UBX_BIT(i))
+            rates[msg_key(msg_defs[i].cls, msg_defs[i].id)] = 1;
+    }
+
+    // CFG-NAV5 defaults: portable, 3D auto, 5 deg elevation mask
+    memset(nav5, 0, sizeof(nav5));
+    put_u16(nav5 + 0, 0xFFFF);
+    nav5[2] = 0;
+    nav5[3] = 3;
+    put_u32(nav5 + 8, 10000);
+    nav5[12] = 5;
+    put_u16(nav5 + 14, 250);
+    put_u16(nav5 + 16, 250);
+    put_u16(nav5 + 18, 100);
+    put_u16(nav5 + 20, 300);
+    nav5[23] = 60;
+
+    // CFG-SBAS: enabled, ranging and corrections, 3 channels
+    memset(sbas, 0, sizeof(sbas));
+    sbas[0] = 1;
+    sbas[1] = 3;
+    sbas[2] = 3;
+
+    // CFG-GNSS: the M8 default of GPS, SBAS, QZSS and GLONASS
+    static const uint8_t blocks[7][4] = {
+        // gnssId, resTrkCh, maxTrkCh, enabled
+        {0, 8, 16, 1}, {1, 1, 3, 1}, {2, 4, 8, 0}, {3, 8, 16, 0},
+        {4, 0, 8, 0}, {5, 0, 3, 1}, {6, 8, 14, 1},
+    };
+    memset(gnss, 0, sizeof(gnss));
+    gnss[1] = 32;
+    gnss[2] = 32;
+    gnss[3] = 7;
+    for (int i = 0; i < 7; i++) {
+        uint8_t *b = gnss + 4 + 8 * i;
+        b[0] = blocks[i][0];
+        b[1] = blocks[i][1];
+        b[2] = blocks[i][2];
+        put_u32(b + 4, 0x00010000u | blocks[i][3]);
+    }
+}
+
+/* FRAMES */
+
+// into the receiver's TX buffer, false when it does not fit
+bool SimUblox::emit_raw(const uint8_t *data, size_t len, int64_t at_us, bool frame)
+{
+    if (txq_bytes + len > UBX_TX_BUFFER)
+        return false;
+    txq.push_back({std::vector<uint8_t>(data, data + len), at_us, 0, 0, frame});
+    txq_bytes += len;
+    return true;
+}
+
+bool SimUblox::emit(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len, int64_t at_us, bool corrupt)
+{
+    uint8_t frame[UBX_MAX_PAYLOAD + 8];
+    frame[0] = 0xB5;
+    frame[1] = 0x62;
+    frame[2] = cls;
+    frame[3] = id;
+    put_u16(frame + 4, len);
+    if (len)
+        memcpy(frame + 6, payload, len);
+    checksum(frame + 2, len + 4, &frame[6 + len], &frame[7 + len]);
+    if (corrupt) {
+        // a bad CK_A makes the parser resync on that byte, a bad CK_B just drops the frame
+        frame[6 + len + (rng.next() & 1)] ^= 0x5A;
+        frames_corrupted++;
+    }
+
+    if (!emit_raw(frame, len + 8, at_us, true)) {
+        frames_dropped++;
+        return false;
+    }
+    return true;
+}
+
+// put every byte due by now on the line, the mux decides who hears it
+void SimUblox::drain(int64_t now_us)
+{
+    double byte_us = 10.0 * 1000000.0 / baud;
+    while (!txq.empty()) {
+        pending_t &q = txq.front();
+        int64_t start = line_free_us > q.not_before_us ? line_free_us : q.not_before_us;
+        if (start > now_us)
+            return;
+        size_t n = (size_t)((now_us - start) / byte_us) + 1;
+        if (n > q.data.size() - q.sent)
+            n = q.data.size() - q.sent;
+
+        if (send(q.data.data() + q.sent, n, start) != start)
+            q.delivered += n;
+        q.sent += n;
+        line_free_us = start + (int64_t)(n * byte_us);
+        bytes_sent += n;
+        txq_bytes -= n;
+        if (q.sent < q.data.size())
+            return;
+
+        bytes_delivered += q.delivered;
+        if (q.frame && q.delivered == q.data.size())
+            frames_delivered++;
+        txq.pop_front();
+    }
+}
+
+bool SimUblox::ack(uint8_t cls, uint8_t id, bool ok, int64_t at_us)
+{
+    uint8_t p[2] = {cls, id};
+    if (ok)
+        acks++;
+    else
+        nacks++;
+    return emit(CLASS_ACK, ok ? 0x01 : 0x00, p, sizeof(p), at_us);
+}
+
+uint8_t SimUblox::rate_of(uint8_t cls, uint8_t id)
+{
+    auto it = rates.find(msg_key(cls, id));
+    return it == rates.end() ? 0 : it->second;
+}
+
+uint32_t SimUblox::interval_us()
+{
+    if (cfg.nav_rate_hz)
+        return 1000000u / cfg.nav_rate_hz;
+    return (uint32_t)(meas_rate_ms ? meas_rate_ms : 1000) * 1000u;
+}
+
+// payload of an output message for the current epoch
+uint16_t SimUblox::build(sim_ubx_msg_t msg, uint8_t *p)
+{
+    double t = (itow_ms - START_TOW_MS) / 1000.0;
+    double w = BOAT_SPEED_MS / CIRCLE_RADIUS_M;
+    double north = CIRCLE_RADIUS_M * sin(w * t) + 0.3 * (rng.uniform() - 0.5);
+    double east = CIRCLE_RADIUS_M * (1.0 - cos(w * t)) + 0.3 * (rng.uniform() - 0.5);
+    double vel_n = BOAT_SPEED_MS * cos(w * t);
+    double vel_e = BOAT_SPEED_MS * sin(w * t);
+    double heading = atan2(vel_e, vel_n) * 180.0 / M_PI;
+    if (heading < 0)
+        heading += 360.0;
+    int32_t lat = (int32_t)((ORIGIN_LAT_DEG + north / 111320.0) * 1e7);
+    int32_t lon = (int32_t)((ORIGIN_LON_DEG + east / (111320.0 * cos(ORIGIN_LAT_DEG * M_PI / 180.0))) * 1e7);
+    int32_t h_ell = 45000, h_msl = 2000;
+    uint32_t h_acc = 1200 + (uint32_t)(400 * rng.uniform());
+    uint32_t v_acc = 2000 + (uint32_t)(600 * rng.uniform());
+    uint8_t num_sv = 14;
+
+    switch (msg) {
+    case SIM_UBX_PVT: {
+        uint32_t day_ms = itow_ms % 86400000u;
+        memset(p, 0, 92);
+        put_u32(p + 0, itow_ms);
+        put_u16(p + 4, 2026);
+        p[6] = 1;
+        p[7] = 7;
+        p[8] = day_ms / 3600000u;
+        p[9] = day_ms / 60000u % 60;
+        p[10] = day_ms / 1000u % 60;
+        p[11] = 0x07;                               // date, time, fully resolved
+        put_u32(p + 12, 20);                        // tAcc ns
+        p[20] = 3;                                  // 3D fix
+        p[21] = 0x01;                               // gnssFixOK
+        p[23] = num_sv;
+        put_u32(p + 24, (uint32_t)lon);
+        put_u32(p + 28, (uint32_t)lat);
+        put_u32(p + 32, (uint32_t)h_ell);
+        put_u32(p + 36, (uint32_t)h_msl);
+        put_u32(p + 40, h_acc);
+        put_u32(p + 44, v_acc);
+        put_u32(p + 48, (uint32_t)(int32_t)(vel_n * 1000));
+        put_u32(p + 52, (uint32_t)(int32_t)(vel_e * 1000));
+        put_u32(p + 56, 0);
+        put_u32(p + 60, (uint32_t)(BOAT_SPEED_MS * 1000));
+        put_u32(p + 64, (uint32_t)(int32_t)(heading * 1e5));
+        put_u32(p + 68, 300);                       // sAcc mm/s
+        put_u32(p + 72, 50000);                     // headAcc
+        put_u16(p + 76, 120);                       // pDOP 1.2
+        return 92;
+    }
+    case SIM_UBX_POSLLH:
+        put_u32(p + 0, itow_ms);
+        put_u32(p + 4, (uint32_t)lon);
+        put_u32(p + 8, (uint32_t)lat);
+        put_u32(p + 12, (uint32_t)h_ell);
+        put_u32(p + 16, (uint32_t)h_msl);
+        put_u32(p + 20, h_acc);
+        put_u32(p + 24, v_acc);
+        return 28;
+    case SIM_UBX_STATUS:
+        put_u32(p + 0, itow_ms);
+        p[4] = 3;                                   // 3D fix
+        p[5] = 0x0D;                                // gpsFixOk, wknSet, towSet
+        p[6] = 0;
+        p[7] = 0;
+        put_u32(p + 8, 28000);                      // ttff
+        put_u32(p + 12, itow_ms - START_TOW_MS);    // msss
+        return 16;
+    case SIM_UBX_VELNED:
+        put_u32(p + 0, itow_ms);
+        put_u32(p + 4, (uint32_t)(int32_t)(vel_n * 100));
+        put_u32(p + 8, (uint32_t)(int32_t)(vel_e * 100));
+        put_u32(p + 12, 0);
+        put_u32(p + 16, (uint32_t)(BOAT_SPEED_MS * 100));
+        put_u32(p + 20, (uint32_t)(BOAT_SPEED_MS * 100));
+        put_u32(p + 24, (uint32_t)(int32_t)(heading * 1e5));
+        put_u32(p + 28, 30);                        // sAcc cm/s
+        put_u32(p + 32, 50000);                     // cAcc
+        return 36;
+    case SIM_UBX_MON_HW:
+        memset(p, 0, 60);
+        put_u16(p + 16, 80 + (uint16_t)(20 * rng.uniform()));  // noisePerMS
+        put_u16(p + 18, 5000);                      // agcCnt
+        p[20] = 2;                                  // antenna OK
+        p[21] = 1;                                  // antenna powered
+        p[22] = 0x05;                               // rtcCalib, jamming OK
+        p[45] = 10 + (uint8_t)(10 * rng.uniform()); // jamInd
+        return 60;
+    case SIM_UBX_RAWX: {
+        uint8_t n = cfg.rawx_meas;
+        memset(p, 0, 16 + 32 * n);
+        put_f64(p + 0, itow_ms / 1000.0);
+        put_u16(p + 8, GPS_WEEK);
+        p[10] = 18;                                 // leap seconds
+        p[11] = n;
+        p[12] = 0x01;                               // leapSec valid
+        p[13] = 1;                                  // version
+        for (uint8_t i = 0; i < n; i++) {
+            uint8_t *m = p + 16 + 32 * i;
+            double pr = 2.0e7 + 1.0e6 * i + 3.0 * rng.uniform();
+            put_f64(m + 0, pr);
+            put_f64(m + 8, pr / 0.19029367);        // L1 cycles
+            put_f32(m + 16, (float)(-2000.0 + 300.0 * i + rng.uniform()));
+            m[20] = i < 10 ? 0 : 6;                 // GPS, then GLONASS
+            m[21] = i < 10 ? 2 + i : 1 + (i - 10);
+            put_u16(m + 24, 64500);                 // locktime
+            m[26] = 30 + (uint8_t)(15 * rng.uniform());
+            m[27] = 4;
+            m[28] = 3;
+            m[29] = 6;
+            m[30] = 0x07;                           // pr, cp valid, half cycle resolved
+        }
+        return (uint16_t)(16 + 32 * n);
+    }
+    default:
+        return 0;
+    }
+}
+
+void SimUblox::output_epoch(int64_t at_us)
+{
+    uint8_t p[UBX_MAX_PAYLOAD];
+
+    if (cfg.noise_bytes) {
+        size_t n = rng.next() % (2u * cfg.noise_bytes + 1);
+        if (n > sizeof(p))
+            n = sizeof(p);
+        for (size_t i = 0; i < n; i++)
+            p[i] = (uint8_t)rng.next();
+        if (emit_raw(p, n, at_us, false))
+            noise_sent += n;
+    }
+
+    for (int i = 0; i < SIM_UBX_MSG_COUNT; i++) {
+        const ubx_msg_def_t &def = msg_defs[i];
+        uint8_t rate = (cfg.forced_msgs & SIM_UBX_BIT(i)) ? 1 : rate_of(def.cls, def.id);
+        if (!rate || epoch % rate)
+            continue;
+        uint16_t len = build((sim_ubx_msg_t)i, p);
+        bool corrupt = cfg.bad_ck_permille && rng.next() % 1000 < cfg.bad_ck_permille;
+        if (emit(def.cls, def.id, p, len, at_us, corrupt))
+            frames[i]++;
+    }
+
+    epoch++;
+    itow_ms += interval_us() / 1000;
+}
+
+/* POLLS */
+
+void SimUblox::handle_cfg(uint8_t id, const uint8_t *p, uint16_t len, int64_t t)
+{
+    uint8_t r[40];
+    switch (id) {
+    case 0x00: // CFG-PRT
+        if (len <= 1) {
+            polls++;
+            memset(r, 0, 20);
+            r[0] = UBX_PORT_UART1;
+            put_u32(r + 4, 0x000008C0);             // 8N1
+            put_u32(r + 8, (uint32_t)baud);
+            put_u16(r + 12, 0x0007);                // in: UBX, NMEA, RTCM
+            put_u16(r + 14, 0x0003);                // out: UBX, NMEA
+            emit(CLASS_CFG, id, r, 20, t);
+            return;
+        }
+        ack(CLASS_CFG, id, true, t);
+        return;
+    case 0x01: // CFG-MSG
+        if (len == 2) {
+            polls++;
+            memset(r, 0, 8);
+            r[0] = p[0];
+            r[1] = p[1];
+            r[2 + UBX_PORT_UART1] = rate_of(p[0], p[1]);
+            emit(CLASS_CFG, id, r, 8, t);
+            return;
+        }
+        if (len == 3 || len == 8) {
+            rates[msg_key(p[0], p[1])] = len == 3 ? p[2] : p[2 + UBX_PORT_UART1];
+            ack(CLASS_CFG, id, true, t);
+            return;
+        }
+        break;
+    case 0x08: // CFG-RATE
+        if (len == 0) {
+            polls++;
+            put_u16(r + 0, meas_rate_ms);
+            put_u16(r + 2, 1);
+            put_u16(r + 4, 0);
+            emit(CLASS_CFG, id, r, 6, t);
+            return;
+        }
+        if (len == 6 && get_u16(p) >= 25) {
+            meas_rate_ms = get_u16(p);
+            ack(CLASS_CFG, id, true, t);
+            return;
+        }
+        break;
+    case 0x09: // CFG-CFG, nothing to save to
+        ack(CLASS_CFG, id, true, t);
+        return;
+    case 0x16: // CFG-SBAS
+        if (len == 0) {
+            polls++;
+            emit(CLASS_CFG, id, sbas, sizeof(sbas), t);
+            return;
+        }
+        if (len == sizeof(sbas)) {
+            memcpy(sbas, p, len);
+            ack(CLASS_CFG, id, true, t);
+            return;
+        }
+        break;
+    case 0x24: // CFG-NAV5
+        if (len == 0) {
+            polls++;
+            emit(CLASS_CFG, id, nav5, sizeof(nav5), t);
+            return;
+        }
+        if (len == sizeof(nav5)) {
+            memcpy(nav5 + 2, p + 2, len - 2);
+            ack(CLASS_CFG, id, true, t);
+            return;
+        }
+        break;
+    case 0x3E: // CFG-GNSS
+        if (len == 0) {
+            polls++;
+            emit(CLASS_CFG, id, gnss, 4 + 8 * gnss[3], t);
+            return;
+        }
+        if (len >= 4 && len <= sizeof(gnss) && len == 4 + 8 * p[3]) {
+            memcpy(gnss, p, len);
+            ack(CLASS_CFG, id, true, t);
+            return;
+        }
+        break;
+    default:
+        // TP5, VALGET / VALSET (F9 only) and the rest are not modelled
+        break;
+    }
+    ack(CLASS_CFG, id, false, t);
+}
+
+void SimUblox::handle(uint8_t cls, uint8_t id, const uint8_t *p, uint16_t len, int64_t at_us)
+{
+    int64_t t = at_us + cfg.response_delay_us + rng.jitter(cfg.response_jitter_us);
+    if (t < at_us)
+        t = at_us;
+
+    if (cls == CLASS_CFG) {
+        handle_cfg(id, p, len, t);
+        return;
+    }
+
+    uint8_t r[UBX_MAX_PAYLOAD];
+    if (cls == CLASS_MON && id == 0x04 && len == 0) {
+        // MON-VER of a NEO-M8N
+        static const char *ext[] = {"FWVER=SPG 3.01", "PROTVER=18.00", "GPS;GLO;GAL;BDS", "SBAS;IMES;QZSS"};
+        polls++;
+        memset(r, 0, 40 + 30 * 4);
+        strcpy((char *)r, "ROM CORE 3.01 (107888)");
+        strcpy((char *)r + 30, "00080000");
+        for (int i = 0; i < 4; i++)
+            strcpy((char *)r + 40 + 30 * i, ext[i]);
+        emit(cls, id, r, 40 + 30 * 4, t);
+        return;
+    }
+    if (cls == CLASS_NAV && id == 0x30 && len == 0) {
+        // NAV-SVINFO, only the header matters to the driver (hardware generation)
+        const uint8_t num_ch = 12;
+        polls++;
+        memset(r, 0, 8 + 12 * num_ch);
+        put_u32(r, itow_ms);
+        r[4] = num_ch;
+        r[5] = 4;                                   // u-blox 8 / M8
+        for (uint8_t i = 0; i < num_ch; i++) {
+            uint8_t *c = r + 8 + 12 * i;
+            c[0] = i;
+            c[1] = 2 + i;
+            c[2] = 0x0D;
+            c[3] = 7;
+            c[4] = 30 + (uint8_t)(15 * rng.uniform());
+            c[5] = 20 + 5 * i % 60;
+        }
+        emit(cls, id, r, 8 + 12 * num_ch, t);
+        return;
+    }
+    // polls of periodic output are not answered
+}
+
+/* SIM DEVICE */
+
+// NMEA (the $PUBX in the init blob) and anything else between frames is skipped
+void SimUblox::on_rx(const uint8_t *data, size_t len, int64_t at_us)
+{
+    drain(at_us);
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = data[i];
+        if (rx_pos == 0) {
+            if (b == 0xB5)
+                rx[rx_pos++] = b;
+            continue;
+        }
+        if (rx_pos == 1) {
+            if (b == 0x62)
+                rx[rx_pos++] = b;
+            else
+                rx_pos = b == 0xB5 ? 1 : 0;
+            continue;
+        }
+        rx[rx_pos++] = b;
+        if (rx_pos == 6) {
+            rx_len = get_u16(rx + 4);
+            if (rx_len > UBX_MAX_PAYLOAD)
+                rx_pos = 0;
+            continue;
+        }
+        if (rx_pos < 6 || rx_pos < (size_t)rx_len + 8)
+            continue;
+
+        uint8_t ck_a, ck_b;
+        checksum(rx + 2, rx_len + 4, &ck_a, &ck_b);
+        size_t n = rx_pos;
+        rx_pos = 0;
+        if (ck_a == rx[6 + rx_len] && ck_b == rx[7 + rx_len]) {
+            handle(rx[2], rx[3], rx + 6, rx_len, at_us);
+            continue;
+        }
+        // look for a frame starting inside the broken one, gnss_task's poll
+        // frame is a byte short and would otherwise take the next frame with it
+        uint8_t again[sizeof(rx)];
+        memcpy(again, rx + 1, n - 1);
+        on_rx(again, n - 1, at_us);
+    }
+}
+
+void SimUblox::pump(int64_t now_us)
+{
+    if (next_epoch_us == 0)
+        next_epoch_us = now_us;
+    while (next_epoch_us + cfg.output_delay_us <= now_us) {
+        drain(next_epoch_us + cfg.output_delay_us);
+        output_epoch(next_epoch_us + cfg.output_delay_us);
+        next_epoch_us += interval_us();
+    }
+    drain(now_us);
+}
+
+void SimUblox::print_stats(FILE *out)
+{
+    fprintf(out, "%u polls, %u acks, %u nacks, %u epochs at %.1f Hz\n",
+            polls, acks, nacks, epoch, 1e6 / interval_us());
+    fprintf(out, "    out:");
+    for (int i = 0; i < SIM_UBX_MSG_COUNT; i++)
+        fprintf(out, " %s %u", msg_defs[i].name, frames[i]);
+    fprintf(out, "\n    %llu B sent, %llu B reached the ESP (%u frames), %llu B noise, "
+            "%u corrupted, %u dropped on a full TX buffer\n",
+            (unsigned long long)bytes_sent, (unsigned long long)bytes_delivered, frames_delivered,
+            (unsigned long long)noise_sent, frames_corrupted, frames_dropped);
+}
@@ -0,0 +1,127 @@
+#pragma once
+// u-blox M8 model streaming UBX over the mux.
+//
+// Answers the CFG / MON polls AP_GPS_UBLOX makes while configuring and
+// outputs NAV-PVT, NAV-POSLLH, NAV-STATUS, NAV-VELNED, MON-HW and RXM-RAWX
+// every navigation epoch at the rates set with CFG-MSG. Messages can be
+// forced on at any nav rate, with noise bytes between frames and frames
+// with corrupted checksums, to load the byte-at-a-time parser.
+//
+// The receiver has its own TX buffer and line: output drains at the line
+// rate whether or not the mux points at it, only bytes on the wire while
+// selected reach the ESP, and frames that do not fit the TX buffer are
+// dropped the way the real receiver drops them.
+#include "sim_device.h"
+#include "sim_random.h"
+#include <deque>
+#include <map>
+#include <vector>
+
+typedef enum {
+    SIM_UBX_PVT,
+    SIM_UBX_POSLLH,
+    SIM_UBX_STATUS,
+    SIM_UBX_VELNED,
+    SIM_UBX_MON_HW,
+    SIM_UBX_RAWX,
+    SIM_UBX_MSG_COUNT
+} sim_ubx_msg_t;
+
+#define SIM_UBX_BIT(msg) (1u << (msg))
+
+typedef struct {
+    uint16_t nav_rate_hz;       // 0 follows CFG-RATE, else fixed whatever the driver sets
+    uint32_t boot_msgs;         // SIM_UBX_BIT()s enabled at rate 1 from power on (saved config)
+    uint32_t forced_msgs;       // SIM_UBX_BIT()s output every epoch whatever CFG-MSG says
+    uint8_t rawx_meas;          // measurements per RXM-RAWX, at most 32
+    uint16_t noise_bytes;       // random bytes between epochs, average
+    uint16_t bad_ck_permille;   // output frames sent with a corrupted checksum
+    uint32_t output_delay_us;   // measurement epoch -> first byte of its output
+    uint32_t response_delay_us; // poll fully received -> first response byte
+    uint32_t response_jitter_us;
+    uint64_t seed;
+} sim_ublox_config_t;
+
+#define SIM_UBLOX_CONFIG_DEFAULT() {            \
+    .nav_rate_hz = 0,                           \
+    .boot_msgs = SIM_UBX_BIT(SIM_UBX_PVT),      \
+    .forced_msgs = 0,                           \
+    .rawx_meas = 16,                            \
+    .noise_bytes = 0,                           \
+    .bad_ck_permille = 0,                       \
+    .output_delay_us = 30000,                   \
+    .response_delay_us = 5000,                  \
+    .response_jitter_us = 2000,                 \
+    .seed = 1,                                  \
+}
+
+// "pvt,posllh,status,velned,hw,rawx" -> SIM_UBX_BIT()s, false on an unknown name
+bool sim_ublox_parse_msgs(const char *list, uint32_t *mask);
+
+class SimUblox : public SimDevice {
+public:
+    explicit SimUblox(const sim_ublox_config_t &config);
+
+    const char *name() override { return "ublox"; }
+    void on_rx(const uint8_t *data, size_t len, int64_t at_us) override;
+    void pump(int64_t now_us) override;
+    void print_stats(FILE *out) override;
+
+    // frames that reached the ESP, the rest went out while the mux pointed elsewhere
+    uint32_t delivered_frames() const { return frames_delivered; }
+
+private:
+    void handle(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len, int64_t at_us);
+    void handle_cfg(uint8_t id, const uint8_t *payload, uint16_t len, int64_t at_us);
+    bool emit(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len, int64_t at_us, bool corrupt = false);
+    bool emit_raw(const uint8_t *data, size_t len, int64_t at_us, bool frame);
+    void drain(int64_t now_us);
+    bool ack(uint8_t cls, uint8_t id, bool ok, int64_t at_us);
+    void output_epoch(int64_t at_us);
+    uint16_t build(sim_ubx_msg_t msg, uint8_t *p);
+    uint8_t rate_of(uint8_t cls, uint8_t id);
+    uint32_t interval_us();
+
+    sim_ublox_config_t cfg;
+    SimRandom rng;
+
+    // UBX input parser
+    uint8_t rx[1024 + 8];
+    size_t rx_pos = 0;
+    uint16_t rx_len = 0;
+
+    // receiver configuration
+    std::map<uint16_t, uint8_t> rates;  // CFG-MSG, (class << 8 | id) -> epochs per output
+    uint16_t meas_rate_ms = 1000;
+    uint8_t nav5[36];
+    uint8_t sbas[8];
+    uint8_t gnss[4 + 8 * 7];
+
+    // navigation epochs
+    int64_t next_epoch_us = 0;
+    uint32_t epoch = 0;
+    uint32_t itow_ms = 0;
+
+    // TX buffer, drained onto the line by pump()
+    struct pending_t {
+        std::vector<uint8_t> data;
+        int64_t not_before_us;
+        size_t sent;
+        size_t delivered;
+        bool frame;
+    };
+    std::deque<pending_t> txq;
+    size_t txq_bytes = 0;
+    int64_t line_free_us = 0;
+
+    uint32_t polls = 0;
+    uint32_t acks = 0;
+    uint32_t nacks = 0;
+    uint32_t frames[SIM_UBX_MSG_COUNT] = {};
+    uint32_t frames_delivered = 0;
+    uint32_t frames_corrupted = 0;
+    uint32_t frames_dropped = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_delivered = 0;
+    uint64_t noise_sent = 0;
+};
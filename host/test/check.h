@@ -0,0 +1,25 @@
+#pragma once
+// Host tests: each one is an executable that ctest runs, CHECK prints the
+// failed condition and the test exits with the number of failures.
+#include <stdio.h>
+
+static int check_failures;
+
+#define CHECK(cond, ...)                                                    \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);      \
+            fprintf(stderr, __VA_ARGS__);                                   \
+            fprintf(stderr, "\n");                                          \
+            check_failures++;                                               \
+        }                                                                   \
+    } while (0)
+
+static inline int check_result(const char *name)
+{
+    if (check_failures)
+        fprintf(stderr, "%s: %d checks failed\n", name, check_failures);
+    else
+        printf("%s: ok\n", name);
+    return check_failures ? 1 : 0;
+}
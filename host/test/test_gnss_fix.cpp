@@ -0,0 +1,88 @@
+// gnss_get_fix against a writer publishing as fast as it can: every copy a
+// reader gets has to be one whole published fix, the one its version says,
+// and versions never go back.
+#include "gnss_task.h"
+#include "check.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define PUBLISHES 2000000
+#define READERS 3
+
+// every field of fix k follows from k, so a torn copy shows
+static void make(uint32_t k, gnss_fix_t *fix)
+{
+    fix->itow_ms = k;
+    fix->lat = (int32_t)(k * 7);
+    fix->lng = -(int32_t)k;
+    fix->alt_mm = (int32_t)(k ^ 0x5a5a5a5a);
+    fix->hacc_mm = (int32_t)(k * 3);
+    fix->vacc_mm = (int32_t)(k + 1);
+    fix->capture_us = ((int64_t)k << 32) | k;
+    fix->fix = (uint8_t)k;
+    fix->num_sats = (uint8_t)(k >> 8);
+}
+
+static bool same(const gnss_fix_t *a, const gnss_fix_t *b)
+{
+    return a->itow_ms == b->itow_ms && a->lat == b->lat && a->lng == b->lng && a->alt_mm == b->alt_mm &&
+           a->hacc_mm == b->hacc_mm && a->vacc_mm == b->vacc_mm && a->capture_us == b->capture_us &&
+           a->fix == b->fix && a->num_sats == b->num_sats;
+}
+
+typedef struct {
+    uint32_t reads;
+    uint32_t torn;
+    uint32_t wrong_version;
+    uint32_t went_back;
+} reader_t;
+
+static std::atomic<bool> done;
+
+static void reader(reader_t *r)
+{
+    uint32_t last = 0;
+    gnss_fix_t fix, expect;
+    while (!done.load(std::memory_order_relaxed)) {
+        uint32_t v = gnss_get_fix(&fix);
+        r->reads++;
+        if (v == 0)
+            continue;
+        if (v < last)
+            r->went_back++;
+        last = v;
+        make(fix.itow_ms, &expect);
+        if (!same(&fix, &expect))
+            r->torn++;
+        else if (fix.itow_ms != v)
+            r->wrong_version++;
+    }
+}
+
+int main()
+{
+    gnss_fix_t fix;
+    CHECK(gnss_get_fix(&fix) == 0, "a fix before the first was published");
+
+    reader_t readers[READERS] = {};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < READERS; i++)
+        threads.emplace_back(reader, &readers[i]);
+    for (uint32_t k = 1; k <= PUBLISHES; k++) {
+        make(k, &fix);
+        gnss_publish_fix(&fix);
+    }
+    done = true;
+    for (auto &t : threads)
+        t.join();
+
+    for (int i = 0; i < READERS; i++) {
+        const reader_t *r = &readers[i];
+        CHECK(r->torn == 0 && r->wrong_version == 0 && r->went_back == 0,
+              "reader %d: %u torn, %u under the wrong version, %u older than the one before, of %u reads", i,
+              (unsigned)r->torn, (unsigned)r->wrong_version, (unsigned)r->went_back, (unsigned)r->reads);
+    }
+    CHECK(gnss_get_fix(&fix) == PUBLISHES && fix.itow_ms == PUBLISHES, "the last fix is not the newest");
+    return check_result("test_gnss_fix");
+}
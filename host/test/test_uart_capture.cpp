@@ -0,0 +1,121 @@
+// uart_capture's record ring: records of every length, written around the
+// end of the ring between sd_task style flushes, have to come out of
+// UART_CAPTURE_FILE whole and in order; records that do not fit are
+// dropped and counted, never cut.
+#include "uart_capture.h"
+#include "config.h"
+#include "sd_task.h"
+#include "esp_vfs_fat.h"
+#include "host_vfs.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static uart_transaction_t trans;
+
+static void make(uint32_t n)
+{
+    trans.device = (mux_device_t)(n % UART_DEVICES);
+    trans.baud = 9600 + (int)n;
+    // lengths sweep the whole range so records end at every ring offset
+    trans.tx_len = (n * 7) % sizeof(trans.tx_buf);
+    trans.rx_len = (n * 131 + 3) % sizeof(trans.rx_buf);
+    trans.timeout_ms = n % 1000;
+    for (size_t i = 0; i < trans.tx_len; i++)
+        trans.tx_buf[i] = (uint8_t)(n + i);
+    for (size_t i = 0; i < trans.rx_len; i++)
+        trans.rx_buf[i] = (uint8_t)(n * 3 + i);
+    trans.rx_done_us = 1000 * (int64_t)n + 250;
+}
+
+static void verify(const uint8_t *p, size_t len, const std::vector<uint32_t> &kept)
+{
+    size_t pos = 0;
+    for (uint32_t n : kept) {
+        make(n);
+        uart_capture_rec_t rec;
+        if (pos + sizeof(rec) > len) {
+            CHECK(false, "file ends before record %u", (unsigned)n);
+            return;
+        }
+        memcpy(&rec, p + pos, sizeof(rec));
+        pos += sizeof(rec);
+        CHECK(rec.device == trans.device && rec.tx_len == trans.tx_len && rec.rx_len == trans.rx_len &&
+                  rec.baud == (uint32_t)trans.baud && rec.timeout_ms == trans.timeout_ms &&
+                  rec.start_us == 1000 * (int64_t)n && rec.duration_us == 250,
+              "record %u header", (unsigned)n);
+        if (pos + rec.tx_len + rec.rx_len > len) {
+            CHECK(false, "file ends in record %u", (unsigned)n);
+            return;
+        }
+        CHECK(memcmp(p + pos, trans.tx_buf, trans.tx_len) == 0, "record %u tx bytes", (unsigned)n);
+        pos += rec.tx_len;
+        CHECK(memcmp(p + pos, trans.rx_buf, trans.rx_len) == 0, "record %u rx bytes", (unsigned)n);
+        pos += rec.rx_len;
+    }
+    CHECK(pos == len, "%u bytes after the last record", (unsigned)(len - pos));
+}
+
+int main()
+{
+    host_vfs_use_ram();
+    sdmmc_card_t *card;
+    if (esp_vfs_fat_sdspi_mount(MOUNT_POINT, NULL, NULL, NULL, &card) != ESP_OK) {
+        fprintf(stderr, "cannot mount %s\n", MOUNT_POINT);
+        return 1;
+    }
+    g_uart_capture = 1;
+
+    // a few records between flushes, with a burst now and then that
+    // overruns the ring while sd_task is "behind"
+    std::vector<uint32_t> kept;
+    uint32_t dropped = 0;
+    size_t used = 0;
+    for (uint32_t n = 0; n < 4000; n++) {
+        make(n);
+        size_t need = sizeof(uart_capture_rec_t) + trans.tx_len + trans.rx_len;
+        uart_capture_record(&trans, 1000 * (int64_t)n);
+        if (used + need <= UART_CAPTURE_BUFFER) {
+            kept.push_back(n);
+            used += need;
+        } else {
+            dropped++;
+        }
+        if (n % 500 < 450 ? n % 5 == 4 : n % 500 == 499) {
+            uart_capture_flush();
+            used = 0;
+        }
+    }
+    uart_capture_flush();
+
+    uart_capture_stats_t stats;
+    uart_capture_get_stats(&stats);
+    CHECK(dropped > 0, "the test never filled the ring");
+    CHECK(stats.recorded == kept.size() && stats.record_dropped == dropped,
+          "%u recorded, %u dropped, expected %u and %u", (unsigned)stats.recorded, (unsigned)stats.record_dropped,
+          (unsigned)kept.size(), (unsigned)dropped);
+
+    FILE *f = fopen(MOUNT_POINT "/" UART_CAPTURE_FILE, "r");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", UART_CAPTURE_FILE);
+        return 1;
+    }
+    std::vector<uint8_t> file;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        file.insert(file.end(), chunk, chunk + n);
+    fclose(f);
+
+    uart_capture_header_t hdr;
+    CHECK(file.size() >= sizeof(hdr), "no header");
+    if (file.size() >= sizeof(hdr)) {
+        memcpy(&hdr, file.data(), sizeof(hdr));
+        CHECK(hdr.magic == UART_CAPTURE_MAGIC && hdr.record_header_len == sizeof(uart_capture_rec_t), "header");
+        CHECK(stats.bytes_written == file.size() - sizeof(hdr), "%llu bytes counted, %u in the file",
+              (unsigned long long)stats.bytes_written, (unsigned)(file.size() - sizeof(hdr)));
+        verify(file.data() + sizeof(hdr), file.size() - sizeof(hdr), kept);
+    }
+    return check_result("test_uart_capture");
+}
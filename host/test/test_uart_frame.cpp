@@ -0,0 +1,179 @@
+// uart_frame_missing decides when every framed read ends. Each response
+// here is cut at every offset: before the answer is whole the result has to
+// be at least 1 and no more than the bytes it still lacks (the manager
+// blocks for that many), and 0 once it is whole.
+#include "uart_frame.h"
+#include "check.h"
+#include <string.h>
+#include <vector>
+
+typedef std::vector<uint8_t> bytes_t;
+
+static void add_ping(bytes_t &out, uint16_t id, uint16_t len, uint8_t seed)
+{
+    size_t start = out.size();
+    out.push_back('B');
+    out.push_back('R');
+    out.push_back(len & 0xff);
+    out.push_back(len >> 8);
+    out.push_back(id & 0xff);
+    out.push_back(id >> 8);
+    out.push_back(0);
+    out.push_back(0);
+    for (uint16_t i = 0; i < len; i++)
+        out.push_back((uint8_t)(i * 29 + seed));
+    uint16_t sum = 0;
+    for (size_t i = start; i < out.size(); i++)
+        sum += out[i];
+    out.push_back(sum & 0xff);
+    out.push_back(sum >> 8);
+}
+
+static void add_ubx(bytes_t &out, uint8_t cls, uint8_t id, const bytes_t &payload)
+{
+    size_t start = out.size();
+    out.push_back(0xB5);
+    out.push_back(0x62);
+    out.push_back(cls);
+    out.push_back(id);
+    out.push_back(payload.size() & 0xff);
+    out.push_back(payload.size() >> 8);
+    out.insert(out.end(), payload.begin(), payload.end());
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = start + 2; i < out.size(); i++) {
+        ck_a += out[i];
+        ck_b += ck_a;
+    }
+    out.push_back(ck_a);
+    out.push_back(ck_b);
+}
+
+static bytes_t filler(size_t len, uint8_t seed)
+{
+    bytes_t b;
+    for (size_t i = 0; i < len; i++)
+        b.push_back((uint8_t)(i * 37 + seed));
+    return b;
+}
+
+// noise that holds no frame start
+static void add_noise(bytes_t &out, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        out.push_back((uint8_t)(0x20 + i % 0x20));
+}
+
+// rx is complete after its first done bytes and not before
+static void check_cuts(const char *name, uart_frame_t frame, const bytes_t &tx, const bytes_t &rx, size_t done)
+{
+    for (size_t k = 0; k <= rx.size(); k++) {
+        size_t m = uart_frame_missing(frame, tx.data(), tx.size(), rx.data(), k);
+        if (k < done)
+            CHECK(m >= 1 && m <= done - k, "%s cut at %u of %u: %u missing, %u to go", name, (unsigned)k,
+                  (unsigned)done, (unsigned)m, (unsigned)(done - k));
+        else
+            CHECK(m == 0, "%s cut at %u, complete at %u: %u missing", name, (unsigned)k, (unsigned)done,
+                  (unsigned)m);
+    }
+}
+
+static void test_ping()
+{
+    const bytes_t none;
+    bytes_t rx;
+    add_ping(rx, 1300, 200, 1);
+    check_cuts("ping profile", UART_FRAME_PING, none, rx, rx.size());
+
+    rx.clear();
+    add_ping(rx, 5, 0, 2);
+    check_cuts("ping empty payload", UART_FRAME_PING, none, rx, rx.size());
+
+    // "BR" in the noise, with a length that would run past the real frame
+    rx.clear();
+    add_noise(rx, 10);
+    rx.insert(rx.end(), {'B', 'R', 0x90, 0x01});
+    add_noise(rx, 5);
+    rx.push_back('B');
+    add_ping(rx, 1211, 10, 3);
+    check_cuts("ping after BR in noise", UART_FRAME_PING, none, rx, rx.size());
+
+    // a frame with a bad checksum, then a good one
+    rx.clear();
+    add_ping(rx, 1211, 10, 4);
+    rx[rx.size() - 1] ^= 0x01;
+    size_t bad = rx.size();
+    add_ping(rx, 1211, 10, 5);
+    check_cuts("ping bad checksum then good", UART_FRAME_PING, none, rx, rx.size());
+    CHECK(uart_frame_missing(UART_FRAME_PING, NULL, 0, rx.data(), bad) >= 1, "a bad ping frame completed");
+}
+
+static void test_ubx()
+{
+    // CFG-PRT poll
+    bytes_t tx;
+    add_ubx(tx, 0x06, 0x00, {});
+
+    bytes_t rx;
+    add_ubx(rx, 0x06, 0x00, filler(20, 1));
+    check_cuts("ubx reply", UART_FRAME_UBX, tx, rx, rx.size());
+
+    // other frames on the way are skipped, only the answer ends the read
+    rx.clear();
+    add_ubx(rx, 0x01, 0x07, filler(92, 2));
+    add_ubx(rx, 0x0A, 0x09, filler(60, 3));
+    add_ubx(rx, 0x06, 0x00, filler(20, 4));
+    check_cuts("ubx reply after other frames", UART_FRAME_UBX, tx, rx, rx.size());
+
+    // ACK-ACK and ACK-NAK of this request answer it, of another one not
+    rx.clear();
+    add_ubx(rx, 0x05, 0x01, {0x06, 0x01});
+    add_ubx(rx, 0x05, 0x01, {0x06, 0x00});
+    check_cuts("ubx ack", UART_FRAME_UBX, tx, rx, rx.size());
+    rx.clear();
+    add_ubx(rx, 0x05, 0x00, {0x06, 0x00});
+    check_cuts("ubx nak", UART_FRAME_UBX, tx, rx, rx.size());
+
+    // preambles in the noise, one with a length that runs past the answer
+    rx.clear();
+    add_noise(rx, 7);
+    rx.insert(rx.end(), {0xB5, 0x62, 0x01, 0x07, 0x00, 0x01});
+    add_noise(rx, 3);
+    rx.insert(rx.end(), {0xB5, 0x00, 0xB5});
+    add_ubx(rx, 0x06, 0x00, filler(20, 5));
+    check_cuts("ubx after preambles in noise", UART_FRAME_UBX, tx, rx, rx.size());
+
+    // a bad checksum, then a good frame
+    rx.clear();
+    add_ubx(rx, 0x06, 0x00, filler(20, 6));
+    rx[rx.size() - 2] ^= 0x01;
+    add_ubx(rx, 0x06, 0x00, filler(20, 7));
+    check_cuts("ubx bad checksum then good", UART_FRAME_UBX, tx, rx, rx.size());
+
+    // no UBX request, e.g. a baud change: the first frame will do
+    rx.clear();
+    add_ubx(rx, 0x01, 0x07, filler(92, 8));
+    size_t first = rx.size();
+    add_ubx(rx, 0x06, 0x00, filler(20, 9));
+    check_cuts("ubx any frame", UART_FRAME_UBX, bytes_t{'$', 'P'}, rx, first);
+}
+
+static void test_line()
+{
+    const bytes_t none;
+    const char *reply = "radio_tx_ok\r\n";
+    bytes_t rx(reply, reply + strlen(reply));
+    check_cuts("line", UART_FRAME_LINE, none, rx, rx.size());
+
+    // a bare \r or \n is not the end of the line
+    const char *split = "o\rk\n\n\r\r\n";
+    bytes_t rx2(split, split + strlen(split));
+    check_cuts("line with bare cr and lf", UART_FRAME_LINE, none, rx2, rx2.size());
+}
+
+int main()
+{
+    test_ping();
+    test_ubx();
+    test_line();
+    return check_result("test_uart_frame");
+}
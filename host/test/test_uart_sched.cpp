@@ -0,0 +1,108 @@
+// uart_manager's order for one device's pending transactions: late ones
+// first by deadline, then by priority, then earliest deadline, then the
+// order they were submitted in. The manager runs in replay mode, so no
+// device is touched, and waits for the replay load, so every transaction
+// is pending before it picks the first.
+#include "uart_manager.h"
+#include "uart_capture.h"
+#include "config.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "check.h"
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define N_TRANS 30
+#define REPLAY_PATH "test_uart_sched.cap"
+
+typedef struct {
+    bool late;
+    uint8_t priority;
+    int64_t deadline_us;
+    int submitted;
+} order_key_t;
+
+static uart_transaction_t trans[N_TRANS];
+static order_key_t keys[N_TRANS];
+static int ran[N_TRANS];
+static int n_ran;
+
+static void on_done(uart_transaction_t *t, void *arg)
+{
+    int i = __atomic_fetch_add(&n_ran, 1, __ATOMIC_RELAXED);
+    if (i < N_TRANS)
+        ran[i] = (int)(intptr_t)arg;
+}
+
+static bool runs_first(const order_key_t &a, const order_key_t &b)
+{
+    if (a.late != b.late)
+        return a.late;
+    if (!a.late && a.priority != b.priority)
+        return a.priority > b.priority;
+    if (a.deadline_us != b.deadline_us)
+        return a.deadline_us < b.deadline_us;
+    return a.submitted < b.submitted;
+}
+
+int main()
+{
+    // a capture with no records: every transaction is answered as missing
+    FILE *f = fopen(REPLAY_PATH, "wb");
+    uart_capture_header_t hdr = {UART_CAPTURE_MAGIC, UART_CAPTURE_VERSION, sizeof(uart_capture_rec_t)};
+    if (!f || fwrite(&hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        fprintf(stderr, "cannot write %s\n", REPLAY_PATH);
+        return 1;
+    }
+    fclose(f);
+    esp_log_level_set("*", ESP_LOG_WARN);
+    g_uart_replay = 1;
+    g_uart_replay_speed = 0;
+    init_uart_manager();
+
+    // late ones with their priorities mixed up, ones due later at three
+    // priorities, and ties on both that keep the submit order
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < N_TRANS; i++) {
+        order_key_t *k = &keys[i];
+        k->submitted = i;
+        k->priority = (uint8_t)(1 + (i * 7) % 3);
+        if (i % 5 == 0)
+            k->deadline_us = now - 1000 - (i * 13) % 9 * 100;
+        else if (i % 4 == 0)
+            k->deadline_us = now + 10000000;
+        else
+            k->deadline_us = now + 10000000 + (i * 17) % 11 * 1000;
+        k->late = k->deadline_us < now;
+
+        uart_transaction_t *t = &trans[i];
+        t->device = PING;
+        t->timeout_ms = 10;
+        t->priority = k->priority;
+        t->deadline_us = k->deadline_us;
+        t->on_done = on_done;
+        t->done_arg = (void *)(intptr_t)i;
+        CHECK(uart_submit(t, 0), "submit %d", i);
+    }
+
+    uart_replay_load(REPLAY_PATH);
+    for (int ms = 0; __atomic_load_n(&n_ran, __ATOMIC_RELAXED) < N_TRANS && ms < 5000; ms++)
+        usleep(1000);                   // pdMS_TO_TICKS(1) is 0 ticks at 100 Hz
+    remove(REPLAY_PATH);
+    CHECK(n_ran == N_TRANS, "%d of %d transactions ran", n_ran, N_TRANS);
+    if (n_ran != N_TRANS)
+        return check_result("test_uart_sched");
+
+    order_key_t expect[N_TRANS];
+    memcpy(expect, keys, sizeof(keys));
+    std::stable_sort(expect, expect + N_TRANS, runs_first);
+    for (int i = 0; i < N_TRANS; i++) {
+        const order_key_t *k = &keys[ran[i]];
+        CHECK(ran[i] == expect[i].submitted, "%d ran as number %d (%s, priority %u, deadline %+lld us), expected %d",
+              ran[i], i, k->late ? "late" : "due", (unsigned)k->priority, (long long)(k->deadline_us - now),
+              expect[i].submitted);
+    }
+    return check_result("test_uart_sched");
+}
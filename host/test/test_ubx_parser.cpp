@@ -0,0 +1,154 @@
+// AP_GPS_UBLOX's span parser (_parse_frames and the bulk payload copy in
+// _parse_bytes) against the byte at a time state machine: on the same
+// stream, cut into spans of any size, both have to hand the same frames to
+// the same handlers and leave the driver in the same state.
+#include "qqqlab_GPS_UBLOX.h"
+#include "check.h"
+#include <string.h>
+#include <vector>
+
+static void add_ubx(std::vector<uint8_t> &out, uint8_t cls, uint8_t id, uint16_t len, uint32_t n)
+{
+    size_t start = out.size();
+    out.push_back(0xB5);
+    out.push_back(0x62);
+    out.push_back(cls);
+    out.push_back(id);
+    out.push_back(len & 0xff);
+    out.push_back(len >> 8);
+    for (uint16_t i = 0; i < len; i++)
+        out.push_back((uint8_t)(i * 13 + n));
+    // iTOW first, so the driver sees epochs move on
+    uint32_t itow = 1000 * n;
+    if (len >= 4)
+        memcpy(&out[start + 6], &itow, 4);
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = start + 2; i < out.size(); i++) {
+        ck_a += out[i];
+        ck_b += ck_a;
+    }
+    out.push_back(ck_a);
+    out.push_back(ck_b);
+}
+
+// the driver fed from memory in spans of at most span bytes, the way
+// gnss_task hands it a transaction's rx_buf
+class TestGPS : public AP_GPS_UBLOX {
+public:
+    TestGPS(bool span, size_t span_len) : max_span(span_len)
+    {
+        // gnss_task's driver is a static, zeroed before it starts
+        _step = 0;
+        state = {};
+        span_parse = span;
+    }
+
+    void feed(const std::vector<uint8_t> &stream)
+    {
+        for (size_t pos = 0; pos < stream.size(); pos += rx_len) {
+            rx_len = stream.size() - pos < max_span ? stream.size() - pos : max_span;
+            memcpy(rx_buf, stream.data() + pos, rx_len);
+            rx_head = 0;
+            read();
+        }
+    }
+
+    static size_t buffer_size() { return sizeof(_buffer); }
+    uint8_t step() const { return _step; }
+
+    void I_setBaud(int baud) override {}
+    int I_available() override { return (int)(rx_len - rx_head); }
+    int I_read(uint8_t *data, size_t len) override
+    {
+        if (rx_head == rx_len)
+            return 0;
+        *data = rx_buf[rx_head++];
+        return 1;
+    }
+    size_t I_peek(const uint8_t **data) override
+    {
+        *data = rx_buf + rx_head;
+        return rx_len - rx_head;
+    }
+    void I_consume(size_t len) override { rx_head += len; }
+    int I_write(uint8_t *data, size_t len) override { return (int)len; }
+    int I_availableForWrite() override { return 128; }
+    uint32_t I_millis() override { return 0; }
+    void I_print(const char *str) override {}
+
+private:
+    size_t max_span;
+    uint8_t rx_buf[2048];
+    size_t rx_len = 0;
+    size_t rx_head = 0;
+};
+
+static void compare(const char *name, const std::vector<uint8_t> &stream, size_t span)
+{
+    TestGPS bytes(false, 512), spans(true, span);
+    bytes.feed(stream);
+    spans.feed(stream);
+
+    const char *msg;
+    AP_GPS_UBLOX::ubx_msg_stats_t a, b;
+    uint32_t frames = 0;
+    for (size_t i = 0; bytes.msg_stats(i, &msg, &a); i++) {
+        CHECK(spans.msg_stats(i, &msg, &b), "%s", name);
+        CHECK(a.count == b.count && a.short_length == b.short_length,
+              "%s span %u: %s %u / %u frames with the state machine, %u / %u with spans", name, (unsigned)span,
+              msg, (unsigned)a.count, (unsigned)a.short_length, (unsigned)b.count, (unsigned)b.short_length);
+        frames += a.count;
+    }
+    CHECK(frames > 0, "%s: no frames parsed", name);
+
+    const auto &s = bytes.state, &t = spans.state;
+    CHECK(s.time_week_ms == t.time_week_ms && s.lat == t.lat && s.lng == t.lng && s.alt == t.alt &&
+              s.num_sats == t.num_sats && s.status == t.status,
+          "%s span %u: the fixes differ", name, (unsigned)span);
+    CHECK(bytes.step() == spans.step(), "%s span %u: state machine at step %u, span parser at %u", name,
+          (unsigned)span, (unsigned)bytes.step(), (unsigned)spans.step());
+}
+
+int main()
+{
+    std::vector<uint8_t> mixed, rawx, noisy;
+    for (uint32_t n = 0; n < 10; n++) {
+        add_ubx(mixed, 0x01, 0x07, 92, n);          // NAV-PVT
+        add_ubx(mixed, 0x01, 0x02, 28, n);          // NAV-POSLLH
+        add_ubx(mixed, 0x01, 0x03, 16, n);          // NAV-STATUS
+        add_ubx(mixed, 0x01, 0x12, 36, n);          // NAV-VELNED
+        add_ubx(mixed, 0x0A, 0x09, 60, n);          // MON-HW
+
+        // longer than a span, and than two at the longest
+        add_ubx(rawx, 0x02, 0x15, 16 + 32 * 16, n); // RXM-RAWX, 16 measurements
+        add_ubx(rawx, 0x01, 0x07, 92, n);
+        add_ubx(rawx, 0x02, 0x15, TestGPS::buffer_size(), n);
+
+        // noise with stray preambles, bad checksums, a frame cut off by the
+        // next one, a length the driver cannot hold, and short and empty frames
+        for (int i = 0; i < 40; i++)
+            noisy.push_back((uint8_t)(i * 37 + n));
+        noisy.push_back(0xB5);
+        add_ubx(noisy, 0x01, 0x07, 92, n);
+        noisy[noisy.size() - 2] ^= 0x55;            // CK_A
+        add_ubx(noisy, 0x01, 0x02, 28, n);
+        noisy[noisy.size() - 1] ^= 0x55;            // CK_B
+        add_ubx(noisy, 0x01, 0x07, 92, n);
+        noisy.resize(noisy.size() - 50);
+        add_ubx(noisy, 0x01, 0x07, 92, n);
+        add_ubx(noisy, 0x01, 0x12, (uint16_t)(TestGPS::buffer_size() + 1), n);
+        add_ubx(noisy, 0x01, 0x02, 28, n);
+        add_ubx(noisy, 0x01, 0x07, 40, n);          // shorter than NAV-PVT
+        add_ubx(noisy, 0x0A, 0x04, 0, n);           // MON-VER poll, no payload
+        noisy.push_back(0xB5);
+        noisy.push_back(0x62);
+    }
+
+    const size_t spans[] = {1, 2, 5, 7, 64, 100, 511, 512, 2048};
+    for (size_t span : spans) {
+        compare("mixed", mixed, span);
+        compare("rawx", rawx, span);
+        compare("noisy", noisy, span);
+    }
+    return check_result("test_ubx_parser");
+}
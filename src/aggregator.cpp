@@ -12,23 +12,21 @@ QueueHandle_t get_record_queue()
 
 static void aggregator_task(void *arg)
 {
-    gps_data_t gps;
     ping_distance_t ping;
+    gnss_fix_t fix;
     record_t rec;
 
     while (1)
     {
-        if (xQueueReceive(get_gps_queue(), &gps, portMAX_DELAY))
+        if (xQueueReceive(get_ping_queue(), &ping, portMAX_DELAY))
         {
-            rec.lat = gps.lat;
-            rec.lon = gps.lon;
-            rec.timestamp = gps.timestamp;
-
-            // Try to match latest ping
-            if (xQueueReceive(get_ping_queue(), &ping, pdMS_TO_TICKS(200)))
-            {
-                rec.depth = ping.distance_mm;
-            }
+            // place the sounding at the newest fix, gnss_task is not waited for
+            if (!gnss_get_fix(&fix))
+                continue;
+            rec.lat = fix.lat * 1e-7;
+            rec.lon = fix.lng * 1e-7;
+            rec.depth = ping.distance_mm;
+            rec.timestamp = ping.timestamp;
 
             xQueueSend(record_queue, &rec, 0);
         }
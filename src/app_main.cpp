@@ -9,7 +9,10 @@
 #include "lora_task.h"
 #include "uart_manager.h"
 #include "hardware.h"
+#include "latency.h"
+#include "metrics.h"
 #include "driver/gpio.h"
+#include "nvs_flash.h"
 
 static const char *TAG = "MAIN";
 
@@ -24,6 +27,15 @@ extern "C" void app_main()
     g_sample_interval_ms = 50;
     g_log_interval_ms = 500;
 
+    // calibration data, e.g. the mux settle times
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
+
     // Initialize tasks
     ESP_LOGI(TAG, "Initializing UART task...");
     init_uart_manager();
@@ -44,15 +56,23 @@ extern "C" void app_main()
     ESP_LOGI(TAG, "Initializing LoRa task...");
     init_lora_task();
 
+    ESP_LOGI(TAG, "Initializing metrics...");
+    init_metrics_task();
+
     ESP_LOGI(TAG, "All tasks started. System running.");
 
     // Main loop
     bool on = true;
+    uint32_t alive_s = 0;
     while (1)
     {
         vTaskDelay(pdMS_TO_TICKS(1000));
         ESP_LOGI(TAG, "System alive...");
         gpio_set_level(LED, on);
         on = !on;
+
+        alive_s++;
+        if (g_latency_report_s && alive_s % g_latency_report_s == 0)
+            latency_print(stdout);
     }
 }
\ No newline at end of file
@@ -2,4 +2,13 @@
 
 volatile uint32_t g_sample_interval_ms = 1000; // 1hz
 volatile uint32_t g_log_interval_ms = 5000; // every 5 sec
-
+volatile uint32_t g_latency_report_s = 0;
+volatile uint32_t g_metrics_interval_ms = 10000;
+volatile uint32_t g_metrics_lora = 0;
+volatile uint32_t g_uart_capture = 0;
+volatile uint32_t g_uart_replay = 0;
+volatile uint32_t g_uart_replay_speed = 1;
+volatile uint32_t g_uart_calibrate = 0;
+volatile uint32_t g_gnss_stream = 0;
+volatile uint32_t g_gnss_rate_ms = 100; // 10hz
+volatile uint32_t g_uart_trace_dump = 0;
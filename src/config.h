@@ -2,4 +2,14 @@
 #include <stdint.h>
 
 extern volatile uint32_t g_sample_interval_ms; // GNSS, ping data sampling
-extern volatile uint32_t g_log_interval_ms;  // sd, lora batching
\ No newline at end of file
+extern volatile uint32_t g_log_interval_ms;  // sd, lora batching
+extern volatile uint32_t g_latency_report_s; // latency histograms to the console, 0 off
+extern volatile uint32_t g_metrics_interval_ms; // telemetry record to SD, 0 off
+extern volatile uint32_t g_metrics_lora;     // also send the telemetry record over LoRa
+extern volatile uint32_t g_uart_capture;     // record UART transactions to the SD
+extern volatile uint32_t g_uart_replay;      // answer UART transactions from a recording
+extern volatile uint32_t g_uart_replay_speed; // replay N times faster than recorded, 0 no waiting
+extern volatile uint32_t g_uart_calibrate;   // measure mux settle times at start, store in NVS
+extern volatile uint32_t g_gnss_stream;      // idle the mux on the GPS and parse its stream, no polls
+extern volatile uint32_t g_gnss_rate_ms;     // GPS navigation period (CFG-RATE), 50..200
+extern volatile uint32_t g_uart_trace_dump;  // write the UART trace ring to the SD once, then cleared
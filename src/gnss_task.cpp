@@ -1,19 +1,22 @@
 #include "gnss_task.h"
 #include "uart_manager.h"
+#include "uart_pool.h"
+#include "uart_stream.h"
 #include "esp_timer.h"
 #include "config.h"
 #include "esp_log.h"
 #include "qqqlab_GPS_UBLOX.h"
 #include "sd_task.h" 
 #include "lora_task.h"
+#include "latency.h"
 #include <string.h>
 
 static const char *TAG = "GNSS_TASK";
-static uart_transaction_t trans;
 static int currBaud = 115200;
 static lora_request_t lora_req;
 static char lora_tx_static_buf[256];
 static uint32_t default_timeout_ms = 100;
+#define GNSS_PUSH_TIMEOUT_MS 3000
 
 // ---------------- GPS Interface ----------------
 class GPS_Interface_IDF : public AP_GPS_UBLOX {
@@ -21,47 +24,94 @@ public:
     void I_setBaud(int newbaud) override {currBaud = newbaud;}
 
     int I_available() override {
-        return rx_len;
+        if (stream) return (int)uart_stream_available();
+        return rx ? rx->rx_len - rx_pos : 0;
     }
 
     int I_read(uint8_t *data, size_t len) override {
-        if (rx_len == 0) return 0;
+        if (stream) return (int)uart_stream_read(data, len);
+        size_t avail = I_available();
+        size_t n = len < avail ? len : avail;
+        if (n) memcpy(data, &rx->rx_buf[rx_pos], n);
+        rx_pos += n;
+        return (int)n;
+    }
+
+    // the parser works on the response or the ring in place
+    size_t I_peek(const uint8_t **data) override {
+        if (stream) return uart_stream_peek(data);
+        if (I_available() == 0) return 0;
+        *data = &rx->rx_buf[rx_pos];
+        peeked = rx;
+        return rx->rx_len - rx_pos;
+    }
 
-        // Only read 1 byte at a time (parser expects stream)
-        *data = rx_buf[0];
-        rx_len--;
-        memmove(rx_buf, rx_buf + 1, rx_len);
-        return 1;
+    void I_consume(size_t len) override {
+        if (stream) {
+            uart_stream_consume(len);
+            return;
+        }
+        // a message the parser sent has replaced the response under the
+        // span, which was kept for it until now
+        if (peeked != rx)
+            uart_trans_free(peeked);
+        else
+            rx_pos += len;
+        peeked = NULL;
     }
 
     int I_write(uint8_t *data, size_t len) override {
-        if(len > sizeof(trans.tx_buf)) return 0;
-
-        // Prepare UART transaction
-        memset(&trans, 0, sizeof(trans));
-        memcpy(trans.tx_buf, data, len);
-        trans.tx_len = len;
-        trans.device = GPS;
-        trans.baud = currBaud;
-        trans.timeout_ms = default_timeout_ms;
-        trans.caller = xTaskGetCurrentTaskHandle();  // Notifies GNSS task
-
-        uart_transaction_t *ptr = &trans;
-        if (xQueueSend(get_uart_queue(), &ptr, portMAX_DELAY) != pdPASS) return 0;
-
-        // Wait for transaction to complete (GNSS task will block here)
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-
-        // Feed parser **incrementally** from received bytes
-        rx_len = 0;
-        for (size_t i = 0; i < trans.rx_len; i++) {
-            if (rx_len < sizeof(rx_buf)) {
-                rx_buf[rx_len++] = trans.rx_buf[i];
-            }
+        if(len > sizeof(rx->tx_buf)) return 0;
+
+        // the previous response has been parsed by now, unless the driver
+        // writes from inside the span it parses; then it and a queued poll
+        // are held while this waits for a transaction, so not for long
+        take(NULL);
+
+        uart_transaction_t *trans = request(data, len, pdMS_TO_TICKS(default_timeout_ms));
+        if (!trans)
+            return 0;
+        // GNSS task blocks here until the response is in
+        if (!uart_transact(trans)) {
+            uart_trans_free(trans);
+            return 0;
         }
+
+        // the parser reads the response straight out of the transaction,
+        // or out of the stream ring where uart_manager put it
+        if (stream)
+            uart_trans_free(trans);
+        else
+            take(trans);
         return len;
     }
 
+    // queue a request without waiting for its response, collect() makes it
+    // the one update() parses; false if no transaction came free within wait
+    bool poll(const uint8_t *data, size_t len, TickType_t wait) {
+        if (polled || len > sizeof(rx->tx_buf)) return false;
+        uart_transaction_t *trans = request(data, len, wait);
+        if (!trans) return false;
+        if (!uart_submit(trans, portMAX_DELAY)) {
+            uart_trans_free(trans);
+            return false;
+        }
+        polled = trans;
+        return true;
+    }
+
+    // give back the parsed response, before waiting for a transaction
+    void release() {
+        take(NULL);
+    }
+
+    void collect() {
+        if (!polled) return;
+        uart_trans_wait(polled, portMAX_DELAY);
+        take(polled);
+        polled = NULL;
+    }
+
     int I_availableForWrite() override {
         return 128;
     }
@@ -70,33 +120,164 @@ public:
         return xTaskGetTickCount() * portTICK_PERIOD_MS;
     }
 
+    uint32_t I_micros() override {
+        return (uint32_t)esp_timer_get_time();
+    }
+
     void I_print(const char *str) override {
         ESP_LOGI(TAG, "%s", str);
     }
 
+    int64_t rx_done_us = 0;     // of the response being parsed
+    bool stream = false;        // read the stream ring (g_gnss_stream), not responses
+
 private:
-    uint8_t rx_buf[512]{};
-    size_t rx_len = 0;
+    uart_transaction_t *request(const uint8_t *data, size_t len, TickType_t wait) {
+        uart_transaction_t *trans = uart_trans_alloc(GPS, wait);
+        if (!trans) return NULL;
+        memcpy(trans->tx_buf, data, len);
+        trans->tx_len = len;
+        trans->baud = currBaud;
+        trans->timeout_ms = default_timeout_ms;
+        trans->frame = UART_FRAME_UBX;
+        trans->period_ms = g_sample_interval_ms;
+        return trans;
+    }
+
+    // parse trans next, giving back the response before it
+    void take(uart_transaction_t *trans) {
+        if (rx != peeked)
+            uart_trans_free(rx);
+        rx = trans;
+        rx_pos = 0;
+        if (trans)
+            rx_done_us = trans->rx_done_us;
+    }
+
+    uart_transaction_t *rx = NULL;      // owned until the next response is taken
+    size_t rx_pos = 0;
+    uart_transaction_t *peeked = NULL;  // under the parser's span, see I_consume()
+    uart_transaction_t *polled = NULL;  // on its way, see poll()
 };
 
+// ---------------- Latest Fix ----------------
+// Two slots, gnss_task fills the one readers are not pointed at and then
+// publishes it. A reader only retries when two fixes were published during
+// its copy; a writer it preempted never holds it up.
+#define FIX_WORDS ((sizeof(gnss_fix_t) + 3) / 4)
+
+typedef struct {
+    uint32_t version;           // of the fix in words, 0 while it is written
+    uint32_t words[FIX_WORDS];
+} fix_slot_t;
+
+static fix_slot_t fix_slots[2];
+static uint32_t fix_version;    // newest published, in fix_slots[fix_version & 1]
+
+void gnss_publish_fix(const gnss_fix_t *fix) {
+    uint32_t words[FIX_WORDS] = {};
+    memcpy(words, fix, sizeof(*fix));
+    uint32_t v = fix_version + 1;
+    fix_slot_t *slot = &fix_slots[v & 1];
+    __atomic_store_n(&slot->version, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i < FIX_WORDS; i++)
+        __atomic_store_n(&slot->words[i], words[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->version, v, __ATOMIC_RELEASE);
+    __atomic_store_n(&fix_version, v, __ATOMIC_RELEASE);
+}
+
+uint32_t gnss_get_fix(gnss_fix_t *out) {
+    uint32_t words[FIX_WORDS];
+    while (1) {
+        uint32_t v = __atomic_load_n(&fix_version, __ATOMIC_ACQUIRE);
+        if (v == 0)
+            return 0;
+        const fix_slot_t *slot = &fix_slots[v & 1];
+        if (__atomic_load_n(&slot->version, __ATOMIC_ACQUIRE) != v)
+            continue;
+        for (size_t i = 0; i < FIX_WORDS; i++)
+            words[i] = __atomic_load_n(&slot->words[i], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->version, __ATOMIC_RELAXED) == v) {
+            memcpy(out, words, sizeof(*out));
+            return v;
+        }
+    }
+}
+
 // ---------------- GNSS Task ----------------
 static GPS_Interface_IDF gps;
 static save_req_t save_req;
 
+// g_gnss_rate_ms within what the driver's CFG-RATE takes
+static uint8_t gnss_rate_ms() {
+    uint32_t ms = g_gnss_rate_ms;
+    return ms < 50 ? 50 : ms > 200 ? 200 : (uint8_t)ms;
+}
+
 
 void gnss_task(void *arg) {
     ESP_LOGI(TAG, "GNSS task started");
 
     vTaskDelay(pdMS_TO_TICKS(5000));
     // TODO: Handle 230400->115200 change on startup
-    while (1) {
+    // send msg to access rx buf
+    static const uint8_t msg[] = {0xB5,0x62,0x06,0x01,0x03,0x00,0x00,0x00,0x0A,0x0D};
+    TickType_t last_wake = xTaskGetTickCount();
+    gnss_fix_t fix = {};
+    gps.stream = g_gnss_stream;
+    gps.set_rate_ms(gnss_rate_ms());
+    if (gps.stream) {
+        // the receiver pushes NAV-PVT at rate_ms; gnss_task sends nothing per sample and the
+        // driver only polls its configuration again when the fixes stop. The stream is only
+        // heard while the mux is idle, so allow a few seconds without one
+        gps.push_timeout_ms = GNSS_PUSH_TIMEOUT_MS + g_sample_interval_ms;
+    }
+    else {
         ESP_LOGI(TAG, "Sending GPS request...");
-        // send msg to access rx buf
-        uint8_t msg[] = {0xB5,0x62,0x06,0x01,0x03,0x00,0x00,0x00,0x0A,0x0D};
-        gps.I_write(msg, sizeof(msg));
+        gps.poll(msg, sizeof(msg), portMAX_DELAY);
+    }
+    while (1) {
+        bool polled = false;
+        bool due = false;
+        TickType_t period = pdMS_TO_TICKS(g_sample_interval_ms);
+        if (gps.stream) {
+            // uart_manager fills the stream ring, parse what came in since
+            vTaskDelayUntil(&last_wake, period);
+            gps.rx_done_us = uart_stream_last_us();
+        }
+        else {
+            gps.collect();
+
+            // when the sample period has already run out, queue the next poll
+            // before parsing this response, if the pool has a transaction to
+            // spare while this one is held
+            due = xTaskGetTickCount() - last_wake >= period;
+            if (due) {
+                vTaskDelayUntil(&last_wake, period);
+                ESP_LOGI(TAG, "Sending GPS request...");
+                polled = gps.poll(msg, sizeof(msg), 0);
+            }
+        }
 
+        if (gps.rate_ms != gnss_rate_ms())
+            gps.set_rate_ms(gnss_rate_ms());
         gps.update();
 
+        if (gps.state.time_week_ms != 0 && gps.state.time_week_ms != fix.itow_ms) {
+            fix.itow_ms = gps.state.time_week_ms;
+            fix.lat = gps.state.lat;
+            fix.lng = gps.state.lng;
+            fix.alt_mm = gps.state.alt;
+            fix.hacc_mm = gps.state.horizontal_accuracy;
+            fix.vacc_mm = gps.state.vertical_accuracy;
+            fix.capture_us = gps.rx_done_us;
+            fix.fix = gps.state.status;
+            fix.num_sats = gps.state.num_sats;
+            gnss_publish_fix(&fix);
+        }
+
 
         ESP_LOGI(TAG, "tow:%d dt:%d sats:%d lat:%d lng:%d alt:%d hacc:%d vacc:%d fix:%d\n"
                         , (int)gps.state.time_week_ms
@@ -133,9 +314,12 @@ void gnss_task(void *arg) {
                 snprintf(save_req.fname, sizeof(save_req.fname), "%s", "gps_log.csv");
                 save_req.device = GPS;
                 save_req.len = (len < sizeof(save_req.data)) ? len : sizeof(save_req.data);
+                save_req.capture_us = gps.rx_done_us;
+                latency_stamp(LAT_PARSED, GPS, save_req.capture_us);
                 ESP_LOGI(TAG, "queued %lu bytes for file: %s", save_req.len, save_req.fname);
                
                 xQueueSend(get_save_queue(), &save_req, portMAX_DELAY);
+                latency_stamp(LAT_SAVE_QUEUED, GPS, save_req.capture_us);
                 
 
 
@@ -148,15 +332,41 @@ void gnss_task(void *arg) {
                     lora_tx_static_buf[i] = save_req.data[i];
                 lora_tx_static_buf[tx_len] = '\0';
                 lora_req.lora_tx_len = tx_len;
+                lora_req.capture_us = save_req.capture_us;
 
                 // send to queue
                 
                 xQueueSend(get_lora_queue(), &lora_req, portMAX_DELAY);
+                latency_stamp(LAT_LORA_QUEUED, GPS, lora_req.capture_us);
                 
                 }
         }
 
-        vTaskDelay(pdMS_TO_TICKS(g_sample_interval_ms));
+        if (!gps.stream && !polled) {
+            if (!due)
+                vTaskDelayUntil(&last_wake, period);
+            ESP_LOGI(TAG, "Sending GPS request...");
+            gps.release();
+            gps.poll(msg, sizeof(msg), portMAX_DELAY);
+        }
+    }
+}
+
+// ---------------- Message Stats ----------------
+void gnss_print_msg_stats(FILE *out) {
+    uint32_t unconfigured;
+    gps.get_error_codes(unconfigured);
+    fprintf(out, "gps rate %u ms, unconfigured 0x%x, %u configuration walks after NAV-PVT stopped\n",
+            (unsigned)gps.rate_ms, (unsigned)unconfigured, (unsigned)gps.push_restarts);
+    fprintf(out, "%-12s %8s %6s %8s %8s %9s\n", "ubx msg", "count", "short", "avg_us", "max_us", "write_ms");
+    const char *name;
+    AP_GPS_UBLOX::ubx_msg_stats_t st;
+    for (size_t i = 0; gps.msg_stats(i, &name, &st); i++) {
+        if (!st.count)
+            continue;
+        fprintf(out, "%-12s %8u %6u %8.1f %8u %9.1f\n", name, (unsigned)st.count, (unsigned)st.short_length,
+                (double)st.us_total / (st.count - st.short_length ? st.count - st.short_length : 1),
+                (unsigned)st.us_max, st.write_us_total / 1000.0);
     }
 }
 
@@ -2,15 +2,30 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include <stdint.h>
+#include <stdio.h>
 
+// The newest fix, published by gnss_task after each new one. Units as
+// AP_GPS_UBLOX::GPS_State: degrees * 1e7, millimetres.
 typedef struct {
-    double lat;
-    double lon;
-    float alt_m;
-    uint8_t fix_type; // 0 = no fix, 1 = 2D fix, 2 = 3D fix
+    uint32_t itow_ms;       // GPS time of week
+    int32_t lat;
+    int32_t lng;
+    int32_t alt_mm;         // above mean sea level
+    int32_t hacc_mm;
+    int32_t vacc_mm;
+    int64_t capture_us;     // esp_timer time the bytes it came from were read
+    uint8_t fix;            // AP_GPS_UBLOX::GPS_Status
     uint8_t num_sats;
-    int64_t timestamp;
-} gps_data_t;
+} gnss_fix_t;
 
-QueueHandle_t get_gps_queue();
-void init_gnss_task();
\ No newline at end of file
+// Copy the newest fix into *out without locking or waiting on gnss_task.
+// Returns its version, counting up from 1 with each fix, or 0 before the first.
+uint32_t gnss_get_fix(gnss_fix_t *out);
+
+// gnss_task's side: make *fix the newest, one writer only
+void gnss_publish_fix(const gnss_fix_t *fix);
+
+void init_gnss_task();
+
+// frames the UBX parser saw per message, and how long their handlers took
+void gnss_print_msg_stats(FILE *out);
@@ -0,0 +1,106 @@
+#include "latency.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include <string.h>
+
+static lat_hist_t hists[LAT_DEVICES][LAT_STAGE_COUNT];
+static portMUX_TYPE lat_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *stage_names[LAT_STAGE_COUNT] = {
+    "parsed",
+    "save_queued",
+    "sd_buffered",
+    "sd_written",
+    "lora_queued",
+    "radio_tx",
+};
+
+static const char *device_names[LAT_DEVICES] = {"GPS", "PING", "FC", "LORA"};
+
+static int bucket_of(uint32_t us)
+{
+    uint32_t ms = us / 1000;
+    int b = 0;
+    while (ms && b < LAT_BUCKETS - 1) {
+        ms >>= 1;
+        b++;
+    }
+    return b;
+}
+
+// upper bound of bucket b in ms
+static uint32_t bucket_limit_ms(int b)
+{
+    return 1u << b;
+}
+
+void latency_stamp(lat_stage_t stage, int device, int64_t capture_us)
+{
+    if (capture_us <= 0 || device < 0 || device >= LAT_DEVICES || stage >= LAT_STAGE_COUNT)
+        return;
+    int64_t age = esp_timer_get_time() - capture_us;
+    uint32_t us = age < 0 ? 0 : age > UINT32_MAX ? UINT32_MAX : (uint32_t)age;
+
+    lat_hist_t *h = &hists[device][stage];
+    portENTER_CRITICAL(&lat_mux);
+    h->count++;
+    h->total_us += us;
+    if (us > h->max_us)
+        h->max_us = us;
+    h->buckets[bucket_of(us)]++;
+    portEXIT_CRITICAL(&lat_mux);
+}
+
+void latency_get(lat_stage_t stage, int device, lat_hist_t *out)
+{
+    if (device < 0 || device >= LAT_DEVICES || stage >= LAT_STAGE_COUNT) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    portENTER_CRITICAL(&lat_mux);
+    *out = hists[device][stage];
+    portEXIT_CRITICAL(&lat_mux);
+}
+
+void latency_reset()
+{
+    portENTER_CRITICAL(&lat_mux);
+    memset(hists, 0, sizeof(hists));
+    portEXIT_CRITICAL(&lat_mux);
+}
+
+const char *latency_stage_name(lat_stage_t stage)
+{
+    return stage < LAT_STAGE_COUNT ? stage_names[stage] : "?";
+}
+
+static uint32_t percentile_ms(const lat_hist_t *h, uint32_t pct)
+{
+    uint64_t want = ((uint64_t)h->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want)
+            return bucket_limit_ms(b);
+    }
+    return bucket_limit_ms(LAT_BUCKETS - 1);
+}
+
+void latency_print(FILE *out)
+{
+    fprintf(out, "%-5s %-12s %7s %9s %7s %7s %7s %9s\n",
+            "dev", "stage", "count", "avg_ms", "p50<", "p90<", "p99<", "max_ms");
+    for (int d = 0; d < LAT_DEVICES; d++) {
+        for (int s = 0; s < LAT_STAGE_COUNT; s++) {
+            lat_hist_t h;
+            latency_get((lat_stage_t)s, d, &h);
+            if (!h.count)
+                continue;
+            fprintf(out, "%-5s %-12s %7u %9.1f %7u %7u %7u %9.1f\n",
+                    device_names[d], stage_names[s], (unsigned)h.count,
+                    h.total_us / 1000.0 / h.count,
+                    (unsigned)percentile_ms(&h, 50), (unsigned)percentile_ms(&h, 90),
+                    (unsigned)percentile_ms(&h, 99), h.max_us / 1000.0);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+// Age of a record at each stage of the pipeline, measured from the
+// esp_timer time uart_manager finished reading the response it came from.
+// One histogram per device per stage, in power of two millisecond buckets.
+
+#define LAT_DEVICES 4       // mux_device_t
+#define LAT_BUCKETS 18      // < 1 ms, < 2 ms, < 4 ms ... < 65.5 s, longer
+
+typedef enum {
+    LAT_PARSED,             // record built from the parsed response
+    LAT_SAVE_QUEUED,        // xQueueSend(save_queue) returned
+    LAT_SD_BUFFERED,        // copied into its file's write buffer by sd_task
+    LAT_SD_WRITTEN,         // that buffer went through fwrite / fflush
+    LAT_LORA_QUEUED,        // xQueueSend(lora_queue) returned
+    LAT_RADIO_TX,           // radio tx answered by the RN2483
+    LAT_STAGE_COUNT
+} lat_stage_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t buckets[LAT_BUCKETS];
+} lat_hist_t;
+
+// records now - capture_us for stage, capture_us 0 means not traced
+void latency_stamp(lat_stage_t stage, int device, int64_t capture_us);
+
+void latency_get(lat_stage_t stage, int device, lat_hist_t *out);
+void latency_reset();
+const char *latency_stage_name(lat_stage_t stage);
+
+// count, mean, p50 / p90 / p99 (bucket upper bounds) and max per device and stage
+void latency_print(FILE *out);
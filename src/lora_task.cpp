@@ -5,8 +5,11 @@
 #include "esp_log.h"
 #include "config.h"
 #include "uart_manager.h"
+#include "uart_pool.h"
 #include "lora_task.h"
 #include "rn2483.h"
+#include "latency.h"
+#include <ctype.h>
 
 
 static const char *TAG = "LORA";
@@ -14,7 +17,7 @@ static int currBaud = 57600;
 static uint32_t default_timeout_ms = 25;
 static QueueHandle_t lora_queue;
 static lora_request_t lora_req;
-static uart_transaction_t trans;
+static uart_transaction_t *rx_trans;     // holds the last response until the next command
 char response[128];
 
 // Forward declaration of the task
@@ -50,29 +53,29 @@ lora_request_t* get_curr_request()
 
 void write_uart(const char* data, size_t len)
 {
-    memset(&trans, 0, sizeof(trans));
-
-    memcpy(trans.tx_buf, data, len);
-    trans.tx_len = len;
-    trans.device = LORA;
-    trans.baud = currBaud;
-    trans.timeout_ms = default_timeout_ms;
-    trans.caller = xTaskGetCurrentTaskHandle();
-    uart_transaction_t *ptr = &trans;
-    if(xQueueSend(get_uart_queue(), &ptr, portMAX_DELAY) != pdTRUE)
+    // RN2483_response has read the previous response by now
+    uart_trans_free(rx_trans);
+    rx_trans = NULL;
+    lora_req.lora_rx_buf = NULL;
+    lora_req.lora_rx_len = 0;
+
+    if (len > sizeof(rx_trans->tx_buf))
+        return;
+    uart_transaction_t *trans = uart_trans_alloc(LORA, portMAX_DELAY);
+    memcpy(trans->tx_buf, data, len);
+    trans->tx_len = len;
+    trans->baud = currBaud;
+    trans->timeout_ms = default_timeout_ms;
+    trans->frame = UART_FRAME_LINE;
+    if (!uart_transact(trans))
     {
+        uart_trans_free(trans);
         return;
     }
 
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-
-    size_t copy_len = trans.rx_len;
-    if (copy_len >= sizeof(lora_req.lora_rx_buf))
-        copy_len = sizeof(lora_req.lora_rx_buf) - 1;
-
-    memcpy(lora_req.lora_rx_buf, trans.rx_buf, copy_len);
-    lora_req.lora_rx_buf[copy_len] = '\0';
-    lora_req.lora_rx_len = copy_len;
+    rx_trans = trans;
+    lora_req.lora_rx_buf = (const char *)trans->rx_buf;
+    lora_req.lora_rx_len = trans->rx_len;
 }
 
 // set gpio led on RN
@@ -143,11 +146,11 @@ void hex_to_ascii(const char* hex, char* ascii, size_t max_len) {
     ascii[i] = '\0';
 }
 
-// Convert a string to hex representation
-void str_to_hex(const char* input, char* output)
+// Convert len bytes to hex representation, binary payloads included
+void str_to_hex(const char* input, size_t len, char* output)
 {
     const char hex_chars[] = "0123456789ABCDEF";
-    while (*input)
+    while (len--)
     {
         uint8_t c = *input++;
         *output++ = hex_chars[(c >> 4) & 0x0F];
@@ -159,7 +162,7 @@ void str_to_hex(const char* input, char* output)
 void radio_tx(const char* input, size_t len)
 {
     char payload_hex[2*len + 1]; // 2 hex chars per byte + null terminator
-    str_to_hex(input, payload_hex); // convert your input to hex
+    str_to_hex(input, len, payload_hex); // convert your input to hex
 
     char cmd[2*len + 20]; // enough for "radio tx " + payload + "\r\n"
     snprintf(cmd, sizeof(cmd), "radio tx %s\r\n", payload_hex);
@@ -177,6 +180,22 @@ void radio_tx(const char* input, size_t len)
     
 }
 
+// a sent payload by its length: text as it is, binary ones (the metrics
+// record) in hex, neither needs a terminator
+static void log_payload(const char *buf, size_t len)
+{
+    bool text = true;
+    for (size_t i = 0; i < len && text; i++)
+        text = isprint((unsigned char)buf[i]) || buf[i] == '\n' || buf[i] == '\r';
+    if (text) {
+        ESP_LOGI(TAG, "%.*s", (int)len, buf);
+        return;
+    }
+    char hex[2*len + 1];
+    str_to_hex(buf, len, hex);
+    ESP_LOGI(TAG, "%u B: %s", (unsigned)len, hex);
+}
+
 // reset gpio led
 void reset_led1()
 {
@@ -205,7 +224,8 @@ static void lora_task(void *arg)
         {
             
             radio_tx(lora_req.lora_tx_buf, lora_req.lora_tx_len);
-            ESP_LOGI(TAG, "%s", lora_req.lora_tx_buf);
+            latency_stamp(LAT_RADIO_TX, lora_req.device, lora_req.capture_us);
+            log_payload(lora_req.lora_tx_buf, lora_req.lora_tx_len);
         }
         vTaskDelay(pdMS_TO_TICKS(g_sample_interval_ms));
         // if ((now - last_wake) >= pdMS_TO_TICKS(g_log_interval_ms))
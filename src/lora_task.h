@@ -6,8 +6,9 @@ typedef struct {
     int id;
     char* lora_tx_buf;
     size_t lora_tx_len;
-    char lora_rx_buf[64];
+    const char *lora_rx_buf;    // response to the last command, in its pooled transaction
     size_t lora_rx_len;
+    int64_t capture_us;     // rx_done_us of the transaction it came from
 }lora_request_t;
 
 QueueHandle_t get_lora_queue();
@@ -0,0 +1,201 @@
+#include "metrics.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "config.h"
+#include "hardware.h"
+#include "uart_manager.h"
+#include "uart_pool.h"
+#include "ping_task.h"
+#include "sd_task.h"
+#include "lora_task.h"
+#include <string.h>
+
+#define METRICS_MAX_TASKS 24
+
+static const char *TAG = "METRICS";
+
+static const char *task_names[METRICS_TASKS - METRICS_UART_PORTS] = {"gnss", "ping", "sd_task", "LORA_TASK"};
+
+static uint8_t peaks[METRICS_QUEUES];
+static uint32_t last_cpu[METRICS_TASKS];
+static uint32_t last_total;
+static int64_t last_publish_us;
+static uint8_t dropped;
+
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+static save_req_t save_req;
+static lora_request_t lora_req;
+static char lora_tx_static_buf[sizeof(metrics_record_t)];
+
+static UBaseType_t depth_of(int i)
+{
+    if (i < METRICS_UART_PORTS)
+    {
+        int backlog = uart_manager_backlog((uart_port_t)i);
+        return backlog > 0 ? backlog : 0;
+    }
+    QueueHandle_t q = NULL;
+    switch (i - METRICS_UART_PORTS)
+    {
+    case 0: q = get_save_queue(); break;
+    case 1: q = get_lora_queue(); break;
+    case 2: q = get_ping_queue(); break;
+    case 3:
+    {
+        uart_pool_stats_t ps;
+        uart_pool_get_stats(&ps);
+        return ps.in_use;
+    }
+    }
+    return q ? uxQueueMessagesWaiting(q) : 0;
+}
+
+// NULL for a port no uart_manager task serves
+static const char *task_name_of(int t)
+{
+    if (t < METRICS_UART_PORTS)
+        return uart_manager_task_name((uart_port_t)t);
+    return task_names[t - METRICS_UART_PORTS];
+}
+
+static uint8_t clamp_u8(UBaseType_t v)
+{
+    return v > 0xFF ? 0xFF : (uint8_t)v;
+}
+
+//
+// Track the deepest each queue got between publishes
+//
+static void sample_queues()
+{
+    for (int i = 0; i < METRICS_QUEUES; i++)
+    {
+        uint8_t depth = clamp_u8(depth_of(i));
+        if (depth > peaks[i])
+            peaks[i] = depth;
+    }
+}
+
+void metrics_collect(metrics_record_t *rec)
+{
+    int64_t now = esp_timer_get_time();
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = METRICS_MAGIC;
+    rec->version = METRICS_VERSION;
+    rec->dropped = dropped;
+    rec->uptime_ms = (uint32_t)(now / 1000);
+    rec->interval_ms = (uint32_t)((now - last_publish_us) / 1000);
+    last_publish_us = now;
+
+    for (int i = 0; i < METRICS_QUEUES; i++)
+    {
+        uint8_t depth = clamp_u8(depth_of(i));
+        rec->queues[i].depth = depth;
+        rec->queues[i].peak = depth > peaks[i] ? depth : peaks[i];
+        peaks[i] = depth;
+    }
+
+    uint32_t total = 0;
+    UBaseType_t n = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, &total);
+    uint32_t total_delta = total - last_total;
+    last_total = total;
+    for (int t = 0; t < METRICS_TASKS; t++)
+    {
+        rec->tasks[t].cpu_permille = METRICS_TASK_MISSING;
+        rec->tasks[t].stack_free = 0;
+        const char *name = task_name_of(t);
+        for (UBaseType_t i = 0; name && i < n; i++)
+        {
+            if (strcmp(task_status[i].pcTaskName, name) != 0)
+                continue;
+            uint32_t cpu_delta = task_status[i].ulRunTimeCounter - last_cpu[t];
+            last_cpu[t] = task_status[i].ulRunTimeCounter;
+            uint64_t permille = total_delta ? (uint64_t)cpu_delta * 1000 / total_delta : 0;
+            rec->tasks[t].cpu_permille = permille > 1000 ? 1000 : (uint16_t)permille;
+            uint32_t stack_free = task_status[i].usStackHighWaterMark;
+            rec->tasks[t].stack_free = stack_free > 0xFFFE ? 0xFFFE : (uint16_t)stack_free;
+            break;
+        }
+    }
+}
+
+//
+// Append the record to the card and hand it to the radio, never blocking
+// on a full queue: telemetry must not hold up the data it measures
+//
+static void publish(const metrics_record_t *rec)
+{
+    bool lost = false;
+
+    memset(&save_req, 0, sizeof(save_req));
+    snprintf(save_req.fname, sizeof(save_req.fname), "%s", METRICS_FILE);
+    save_req.device = -1;
+    memcpy(save_req.data, rec, sizeof(*rec));
+    save_req.len = sizeof(*rec);
+    if (xQueueSend(get_save_queue(), &save_req, 0) != pdTRUE)
+        lost = true;
+
+    if (g_metrics_lora)
+    {
+        memcpy(lora_tx_static_buf, rec, sizeof(*rec));
+        lora_req.device = -1;
+        lora_req.id = LORA;
+        lora_req.lora_tx_buf = lora_tx_static_buf;
+        lora_req.lora_tx_len = sizeof(*rec);
+        lora_req.capture_us = 0;
+        if (xQueueSend(get_lora_queue(), &lora_req, 0) != pdTRUE)
+            lost = true;
+    }
+
+    if (lost)
+    {
+        if (dropped < 0xFF)
+            dropped++;
+        ESP_LOGW(TAG, "metrics record dropped, queue full");
+    }
+    else
+    {
+        dropped = 0;
+    }
+}
+
+static void metrics_task(void *arg)
+{
+    metrics_record_t rec;
+    metrics_collect(&rec);   // start the CPU counters
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1)
+    {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(METRICS_SAMPLE_MS));
+        sample_queues();
+
+        if (g_metrics_interval_ms == 0)
+            continue;
+        if (esp_timer_get_time() - last_publish_us < (int64_t)g_metrics_interval_ms * 1000)
+            continue;
+
+        metrics_collect(&rec);
+        publish(&rec);
+        ESP_LOGI(TAG, "uart %u/%u %u/%u %u/%u save %u/%u lora %u/%u ping %u/%u pool %u/%u",
+                 rec.queues[0].depth, rec.queues[0].peak, rec.queues[1].depth, rec.queues[1].peak,
+                 rec.queues[2].depth, rec.queues[2].peak, rec.queues[3].depth, rec.queues[3].peak,
+                 rec.queues[4].depth, rec.queues[4].peak, rec.queues[5].depth, rec.queues[5].peak,
+                 rec.queues[6].depth, rec.queues[6].peak);
+    }
+}
+
+void init_metrics_task()
+{
+    last_publish_us = esp_timer_get_time();
+
+    xTaskCreatePinnedToCore(
+        metrics_task,
+        "metrics",
+        3072,
+        NULL,
+        2,
+        NULL,
+        0
+    );
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include <stdint.h>
+
+// Runtime telemetry: queue depths, task CPU share and stack high water
+// marks, sampled every METRICS_SAMPLE_MS and published every
+// g_metrics_interval_ms as one metrics_record_t appended to
+// METRICS_FILE on the SD card, and sent over LoRa when g_metrics_lora is set.
+
+#define METRICS_SAMPLE_MS 100
+#define METRICS_FILE "metrics.bin"
+#define METRICS_MAGIC 0x4D54        // "TM", little endian on the card
+#define METRICS_VERSION 3
+
+// order of the queues[] entries of a record: the transactions waiting for
+// UART0..2 (uart_manager_backlog, 0 on a port not in use), the save / lora /
+// ping queues, and the transactions out of the UART pool; of the tasks[]
+// entries: the uart_manager task of UART0..2 (METRICS_TASK_MISSING on a port
+// not in use), gnss, ping, sd_task and LORA_TASK
+#define METRICS_UART_PORTS 3
+#define METRICS_QUEUES (METRICS_UART_PORTS + 4)
+#define METRICS_TASKS (METRICS_UART_PORTS + 4)
+
+#define METRICS_TASK_MISSING 0xFFFF
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t dropped;                // records lost on a full save / lora queue since the last one
+    uint32_t uptime_ms;
+    uint32_t interval_ms;           // time this record covers
+    struct __attribute__((packed)) {
+        uint8_t depth;              // at publish time
+        uint8_t peak;               // highest sampled depth over the interval
+    } queues[METRICS_QUEUES];
+    struct __attribute__((packed)) {
+        uint16_t cpu_permille;      // of one core over the interval, METRICS_TASK_MISSING if not running
+        uint16_t stack_free;        // high water mark, bytes never used
+    } tasks[METRICS_TASKS];
+} metrics_record_t;
+
+// fills rec from the samples taken since the previous call
+void metrics_collect(metrics_record_t *rec);
+
+void init_metrics_task();
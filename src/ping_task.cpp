@@ -1,5 +1,6 @@
 #include "ping_task.h"
 #include "uart_manager.h"
+#include "uart_pool.h"
 #include "config.h"
 #include "esp_timer.h"
 #include <string.h>
@@ -9,6 +10,7 @@
 #include "ping-parser.h"
 #include "sd_task.h"
 #include "lora_task.h"
+#include "latency.h"
 
 // https://docs.bluerobotics.com/ping-protocol/
 // https://docs.bluerobotics.com/ping-protocol/pingmessage-common/
@@ -37,6 +39,32 @@ static void write_u16_le(uint8_t *buf, uint16_t val)
     buf[1] = (val >> 8) & 0xFF;
 }
 
+// Ping1D answers a set command with an ack holding the id it acked
+#define ACK_PAYLOAD_LEN 2
+
+static uint16_t profile_points;    // of the last profile, the next one is as long
+
+// payload of the answer to requested_id, 0 if not known
+static size_t get_payload_len(uint16_t requested_id)
+{
+    switch (requested_id)
+    {
+    case 4:    return 6;    // device_information
+    case 1204: return 8;    // range
+    case 1205: return 1;    // mode_auto
+    case 1211: return 5;    // distance_simple
+    case 1212: return 24;   // distance
+    case 1300: return profile_points ? 26 + profile_points : 0;  // profile
+    default:   return 0;
+    }
+}
+
+// whole message for a payload_len payload: header, payload and checksum
+static size_t response_len(size_t payload_len)
+{
+    return payload_len ? ping_message::headerLength + payload_len + 2 : 0;
+}
+
 static void send_general_request(uint16_t requested_id, uart_transaction_t *trans)
 {
     ping_message msg(64);   // safe buffer size
@@ -52,17 +80,16 @@ static void send_general_request(uint16_t requested_id, uart_transaction_t *tran
 
     msg.updateChecksum();
 
-    memset(trans, 0, sizeof(*trans));
-    trans->device = PING;
+    uart_trans_reset(trans, PING);
     trans->baud = DEFAULT_BAUD;
     memcpy(trans->tx_buf, msg.msgData, msg.msgDataLength());
     trans->tx_len = msg.msgDataLength();
     trans->timeout_ms = default_timeout_ms;
-    trans->caller = xTaskGetCurrentTaskHandle();
+    trans->frame = UART_FRAME_PING;
+    trans->expect_len = response_len(get_payload_len(requested_id));
 
     ESP_LOGI(TAG, "Requesting %d", requested_id);
-    xQueueSend(get_uart_queue(), &trans, portMAX_DELAY);
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uart_transact(trans);
 
 }
 
@@ -103,16 +130,15 @@ static void set_range(uint32_t scan_start_mm, uint32_t scan_length_mm, uart_tran
     // Fix checksum after setting payload
     msg.updateChecksum();
 
-    memset(trans, 0, sizeof(*trans));
-    trans->device = PING;
+    uart_trans_reset(trans, PING);
     trans->baud = DEFAULT_BAUD;
     memcpy(trans->tx_buf, msg.msgData, msg.msgDataLength());
     trans->tx_len = msg.msgDataLength();
     trans->timeout_ms = default_timeout_ms;
-    trans->caller = xTaskGetCurrentTaskHandle();
+    trans->frame = UART_FRAME_PING;
+    trans->expect_len = response_len(ACK_PAYLOAD_LEN);
 
-    xQueueSend(get_uart_queue(), &trans, portMAX_DELAY);
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uart_transact(trans);
     ESP_LOGI(TAG, "Sent set_range: start=%u mm, length=%u mm",
              scan_start_mm, scan_length_mm);
 }
@@ -141,16 +167,15 @@ static void set_speed_of_sound(float sos_val, uart_transaction_t *trans)
 
     msg.updateChecksum();
 
-    memset(trans, 0, sizeof(*trans));
-    trans->device = PING;
+    uart_trans_reset(trans, PING);
     trans->baud = DEFAULT_BAUD;
     memcpy(trans->tx_buf, msg.msgData, msg.msgDataLength());
     trans->tx_len = msg.msgDataLength();
     trans->timeout_ms = default_timeout_ms;
-    trans->caller = xTaskGetCurrentTaskHandle();
+    trans->frame = UART_FRAME_PING;
+    trans->expect_len = response_len(ACK_PAYLOAD_LEN);
 
-    xQueueSend(get_uart_queue(), &trans, portMAX_DELAY);
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uart_transact(trans);
 
     ESP_LOGI(TAG, "Set speed of sound to %.2f mm/s", sos_val);
 
@@ -171,16 +196,15 @@ static void send_set_mode_auto(uint8_t mode_auto, uart_transaction_t *trans)
 
     msg.updateChecksum();
 
-    memset(trans, 0, sizeof(*trans));
-    trans->device = PING;
+    uart_trans_reset(trans, PING);
     trans->baud = DEFAULT_BAUD;
     memcpy(trans->tx_buf, msg.msgData, msg.msgDataLength());
     trans->tx_len = msg.msgDataLength();
     trans->timeout_ms = default_timeout_ms;
-    trans->caller = xTaskGetCurrentTaskHandle();
+    trans->frame = UART_FRAME_PING;
+    trans->expect_len = response_len(ACK_PAYLOAD_LEN);
 
-    xQueueSend(get_uart_queue(), &trans, portMAX_DELAY);
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uart_transact(trans);
 
     ESP_LOGI("PING_SEND", "Sent set_mode_auto: %u (%s)",
              mode_auto,
@@ -202,16 +226,15 @@ static void set_gain_setting(uint8_t gain_setting, uart_transaction_t *trans)
 
     msg.updateChecksum();
 
-    memset(trans, 0, sizeof(*trans));
-    trans->device = PING;
+    uart_trans_reset(trans, PING);
     trans->baud = DEFAULT_BAUD;
     memcpy(trans->tx_buf, msg.msgData, msg.msgDataLength());
     trans->tx_len = msg.msgDataLength();
     trans->timeout_ms = default_timeout_ms;
-    trans->caller = xTaskGetCurrentTaskHandle();
+    trans->frame = UART_FRAME_PING;
+    trans->expect_len = response_len(ACK_PAYLOAD_LEN);
 
-    xQueueSend(get_uart_queue(), &trans, portMAX_DELAY);
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uart_transact(trans);
 
     ESP_LOGI(TAG, "set_gain_setting: %u", gain_setting);
 }
@@ -241,7 +264,7 @@ static void ping_distance(uart_transaction_t *trans)
     send_general_request(1212, trans);
 }
 
-// 1300 profile
+// 1300 profile, only queued: wait for it with uart_trans_wait
 static void send_profile_request( uart_transaction_t *trans,uint16_t profile_id = 0)
 {
     ping_message msg(64);  // safe buffer size
@@ -257,16 +280,16 @@ static void send_profile_request( uart_transaction_t *trans,uint16_t profile_id
 
     msg.updateChecksum();
 
-    memset(trans, 0, sizeof(*trans));
-    trans->device = PING;
+    uart_trans_reset(trans, PING);
     trans->baud = DEFAULT_BAUD;
     memcpy(trans->tx_buf, msg.msgData, msg.msgDataLength());
     trans->tx_len = msg.msgDataLength();
     trans->timeout_ms = default_timeout_ms;
-    trans->caller = xTaskGetCurrentTaskHandle();
+    trans->frame = UART_FRAME_PING;
+    trans->expect_len = response_len(get_payload_len(1300));
+    trans->period_ms = g_sample_interval_ms;
 
-    xQueueSend(get_uart_queue(), &trans, portMAX_DELAY);
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uart_submit(trans, portMAX_DELAY);
     //xQueueSend(get_uart_queue(), &trans, pdMS_TO_TICKS(100));
     //ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
 
@@ -505,16 +528,19 @@ void make_csv(const ping_profile_t *p, char **csvln, size_t *csvlen)
     *csvlen = (size_t)len;
 }
 
-static void record_data(char *tosave)
+static void record_data(char *tosave, int64_t capture_us)
 {
     // file saving queue
     int len = snprintf(save_req.data, sizeof(save_req.data)+1,"%s\n",tosave);
     snprintf(save_req.fname, sizeof(save_req.fname), "%s", "ping_log.csv");
     save_req.device = PING;
     save_req.len = (len < sizeof(save_req.data)) ? len : sizeof(save_req.data);
+    save_req.capture_us = capture_us;
+    latency_stamp(LAT_PARSED, PING, capture_us);
     ESP_LOGI(TAG, "queued %lu bytes for file: %s", save_req.len, save_req.fname);
 
     xQueueSend(get_save_queue(), &save_req, portMAX_DELAY);
+    latency_stamp(LAT_SAVE_QUEUED, PING, capture_us);
     
 
 
@@ -527,140 +553,186 @@ static void record_data(char *tosave)
         lora_tx_static_buf[i] = save_req.data[i];
     lora_tx_static_buf[tx_len] = '\0';
     lora_req.lora_tx_len = tx_len;
+    lora_req.capture_us = capture_us;
 
     // send to queue
     xQueueSend(get_lora_queue(), &lora_req, portMAX_DELAY);
+    latency_stamp(LAT_LORA_QUEUED, PING, capture_us);
     
 }
-// FREE RTOS TASK
 
-void ping_task(void *arg)
+//
+// Hand every message in trans to its parser, true if it held a profile
+//
+static bool parse_response(PingParser &parser, const uart_transaction_t *trans, ping_profile_t *profile)
 {
-    // message structs
-    PingParser parser;
-    uart_transaction_t trans;
     ping_distance_t ping_distance_response;
     ping_speed_of_sound_t ping_speed_of_sound_response;
     ping_ack_t ack;
     ping_nack_t nack;
     ping_device_info_t device_info;
-    ping_profile_t profile;
     ping_range_t ping_range_response;
     ping_mode_auto_t ping_mode_auto_response;
+    bool made = false;
+
+    if (trans->rx_len > 0)
+    {
+        parser.reset();
+
+        for (int i = 0; i < trans->rx_len; i++)
+        {
+            auto state = parser.parseByte(trans->rx_buf[i]);
+
+            // check for new message
+            if (state == PingParser::State::NEW_MESSAGE)
+            {
+                uint16_t msg_id = parser.rxMessage.message_id();
+                uint8_t *p = parser.rxMessage.payload_data();
+
+                // check message ID and send payload to correct parser
+                // bad implementation but it works for now
+                if (msg_id == 1) {   // ACK
+                    parse_ack(p, parser.rxMessage.payload_length(), &ack);
+                }
+                else if (msg_id == 2) {   // NACK
+                    parse_nack(p, parser.rxMessage.payload_length(), &nack);
+                }
+                else if (msg_id == 4) {  // Device Info
+                    parse_device_info(p, parser.rxMessage.payload_length(), &device_info);
+                }
+                else if (msg_id == 1212) // Distance response
+                {
+                    parse_distance(p, parser.rxMessage.payload_length(), &ping_distance_response);
+                }
+                else if (msg_id == 1002)  // Speed-of-sound response
+                {
+                    parse_speed_of_sound(p, parser.rxMessage.payload_length(), &ping_speed_of_sound_response);
+                }
+                else if (msg_id == 1204) // range response
+                { 
+                    parse_range(p, parser.rxMessage.payload_length(), &ping_range_response);
+                }
+                else if (msg_id == 1205 || msg_id == 1003) // mode_auto response or echo from set_mode_auto
+                {
+                    parse_mode_auto(p, parser.rxMessage.payload_length(), &ping_mode_auto_response);
+                }
+                else if (msg_id == 1300) // profile response
+                {
+                    parse_profile(p, parser.rxMessage.payload_length(), profile);
+                    made = true;
+                    // char* csvln;
+                    // size_t csvlen;
+                    // make_csv(&profile, &csvln, &csvlen);
+                    // record_data(csvln);
+                }
+                else
+                {
+                    ESP_LOGW(TAG, "No response");
+                }
+            }
+                
+        }
+    }
+    return made;
+}
+
+// NULL if no transaction came free within wait
+static uart_transaction_t *request_profile(TickType_t wait)
+{
+    uart_transaction_t *trans = uart_trans_alloc(PING, wait);
+    if (trans)
+        send_profile_request(trans, 0);
+    return trans;
+}
+
+// FREE RTOS TASK
+
+void ping_task(void *arg)
+{
+    // message structs
+    PingParser parser;
+    uart_transaction_t *trans;
+    ping_profile_t profile;
 
     // toggle for testing in a loop
     bool flip = false;
     
     // send request
     // ask for device_info on init
-    send_general_request(4, &trans);   // device_info
+    trans = uart_trans_alloc(PING, portMAX_DELAY);
+    send_general_request(4, trans);   // device_info
 
-    if (trans.rx_len <= 0) {
+    if (trans->rx_len <= 0) {
         ESP_LOGE(TAG, "No response during init");
     } else {
-        ESP_LOGI(TAG, "Ping1D responded (%d bytes)", trans.rx_len);
+        ESP_LOGI(TAG, "Ping1D responded (%d bytes)", trans->rx_len);
     }
     
-    send_set_mode_auto(0, &trans);
-    set_speed_of_sound(343000, &trans); // 343 m/s at ~20°C
-    set_range(100, 3000, &trans);
-    set_gain_setting(6, &trans);
+    send_set_mode_auto(0, trans);
+    set_speed_of_sound(343000, trans); // 343 m/s at ~20°C
+    set_range(100, 3000, trans);
+    set_gain_setting(6, trans);
+    uart_trans_free(trans);
     vTaskDelay(pdMS_TO_TICKS(50));
    
-    bool profile_made = false;
+    TickType_t last_wake = xTaskGetTickCount();
+    trans = request_profile(portMAX_DELAY);
     while (1)
     {
         // Send Request
 
-        //send_general_request(1212, &trans);   // distance
+        //send_general_request(1212, trans);   // distance
         // if (flip){
-        //     //ping_distance(&trans);
-        //     //get_range(&trans);
-        //     //set_range(0, 2000, &trans); // scan_start=1 m, scan_length=2 m
-        //     set_gain_setting(6, &trans);
+        //     //ping_distance(trans);
+        //     //get_range(trans);
+        //     //set_range(0, 2000, trans); // scan_start=1 m, scan_length=2 m
+        //     set_gain_setting(6, trans);
         //     flip = !flip;
         // }
         // else{
-        //     //set_speed_of_sound(340.0f, &trans);
-        //     //send_general_request(4, &trans);
-        //     //get_device_info(&trans);
-        //     //send_profile_request(&trans, 0);
-        //     //set_range(0, 2000, &trans); // scan_start=1 m, scan_length=2 m
-        //     //get_mode_auto(&trans);
+        //     //set_speed_of_sound(340.0f, trans);
+        //     //send_general_request(4, trans);
+        //     //get_device_info(trans);
+        //     //send_profile_request(trans, 0);
+        //     //set_range(0, 2000, trans); // scan_start=1 m, scan_length=2 m
+        //     //get_mode_auto(trans);
         //     //ESP_LOGI(TAG, "Requested speed of sound");
-        //     send_profile_request(&trans, 0);
+        //     send_profile_request(trans, 0);
         //     flip = !flip;
         // }
-        send_profile_request(&trans, 0);
-        profile_made = false;
-        // Parse Response
-        if (trans.rx_len > 0)
+        uart_trans_wait(trans, portMAX_DELAY);
+
+        // when the sample period has already run out, put the next request
+        // on the wire first and parse this profile while it is out. That
+        // takes a second transaction while holding this one, so only if the
+        // pool has one free; otherwise it follows the parse as usual
+        uart_transaction_t *next = NULL;
+        TickType_t period = pdMS_TO_TICKS(g_sample_interval_ms);
+        bool due = xTaskGetTickCount() - last_wake >= period;
+        if (due)
         {
-            parser.reset();
-
-            for (int i = 0; i < trans.rx_len; i++)
-            {
-                auto state = parser.parseByte(trans.rx_buf[i]);
-
-                // check for new message
-                if (state == PingParser::State::NEW_MESSAGE)
-                {
-                    uint16_t msg_id = parser.rxMessage.message_id();
-                    uint8_t *p = parser.rxMessage.payload_data();
-
-                    // check message ID and send payload to correct parser
-                    // bad implementation but it works for now
-                    if (msg_id == 1) {   // ACK
-                        parse_ack(p, parser.rxMessage.payload_length(), &ack);
-                    }
-                    else if (msg_id == 2) {   // NACK
-                        parse_nack(p, parser.rxMessage.payload_length(), &nack);
-                    }
-                    else if (msg_id == 4) {  // Device Info
-                        parse_device_info(p, parser.rxMessage.payload_length(), &device_info);
-                    }
-                    else if (msg_id == 1212) // Distance response
-                    {
-                        parse_distance(p, parser.rxMessage.payload_length(), &ping_distance_response);
-                    }
-                    else if (msg_id == 1002)  // Speed-of-sound response
-                    {
-                        parse_speed_of_sound(p, parser.rxMessage.payload_length(), &ping_speed_of_sound_response);
-                    }
-                    else if (msg_id == 1204) // range response
-                    { 
-                        parse_range(p, parser.rxMessage.payload_length(), &ping_range_response);
-                    }
-                    else if (msg_id == 1205 || msg_id == 1003) // mode_auto response or echo from set_mode_auto
-                    {
-                        parse_mode_auto(p, parser.rxMessage.payload_length(), &ping_mode_auto_response);
-                    }
-                    else if (msg_id == 1300) // profile response
-                    {
-                        parse_profile(p, parser.rxMessage.payload_length(), &profile);
-                        profile_made = true;
-                        // char* csvln;
-                        // size_t csvlen;
-                        // make_csv(&profile, &csvln, &csvlen);
-                        // record_data(csvln);
-                    }
-                    else
-                    {
-                        ESP_LOGW(TAG, "No response");
-                    }
-                }
-                    
-            }
+            vTaskDelayUntil(&last_wake, period);
+            next = request_profile(0);
         }
-        if (profile_made)
+
+        // Parse Response
+        if (parse_response(parser, trans, &profile))
         {
+            profile_points = profile.profile_data_length;
             char* csvln;
             size_t csvlen;
             make_csv(&profile, &csvln, &csvlen);
-            record_data(csvln);
+            record_data(csvln, trans->rx_done_us);
         }
+        uart_trans_free(trans);
 
-        vTaskDelay(pdMS_TO_TICKS(g_sample_interval_ms));
+        if (!next)
+        {
+            if (!due)
+                vTaskDelayUntil(&last_wake, period);
+            next = request_profile(portMAX_DELAY);
+        }
+        trans = next;
     }
 }
 
@@ -10,6 +10,9 @@
 #include "aggregator.h"
 #include "config.h"
 #include "esp_timer.h"
+#include "latency.h"
+#include "uart_capture.h"
+#include "uart_trace.h"
 
 static file_log_t open_files[MAX_OPEN_FILES];
 static int num_open_files = 0;
@@ -38,10 +41,22 @@ static void init_file_array()
         memset(ft->buffer, 0, LOG_BUFFER_SIZE);
         ft->last_flush_tick = now;
         ft->last_write_tick = now;
+        ft->n_stamps = 0;
     }
 
 }
 
+//
+// The buffer of a file just went through fwrite / fflush,
+// stamp the records that were in it
+//
+static void stamp_written(file_log_t *ft)
+{
+    for (size_t i = 0; i < ft->n_stamps; i++)
+        latency_stamp(LAT_SD_WRITTEN, ft->device, ft->stamps[i]);
+    ft->n_stamps = 0;
+}
+
 //
 // Closes a file that's currently held open in the open files array
 // Basically just fills the struct with 0's
@@ -54,6 +69,7 @@ static void close_file(file_log_t *ft)
         // there's still data in the buffer i need to write
         fwrite(ft->buffer, 1, ft->index, ft->fp);
         fflush(ft->fp);
+        stamp_written(ft);
     }
     
     TickType_t now = xTaskGetTickCount();
@@ -145,6 +161,7 @@ static file_log_t* get_or_open_file(const char *path)
     }
     snprintf(file->fname, sizeof(file->fname), "%s", path);
     file->index = 0;
+    file->n_stamps = 0;
     file->last_flush_tick = now;
     file->last_write_tick = now;
     num_open_files += 1;
@@ -156,7 +173,7 @@ static file_log_t* get_or_open_file(const char *path)
 // Add bytes to the write buffer of a file
 // if buffer is going to fill, it will write to the file
 //
-static void file_buffer_write(file_log_t *file, const char *data, size_t len)
+static void file_buffer_write(file_log_t *file, const char *data, size_t len, int device, int64_t capture_us)
 {
     if (!file || !file->fp) return;
     if (len > LOG_BUFFER_SIZE) len = LOG_BUFFER_SIZE;
@@ -165,12 +182,20 @@ static void file_buffer_write(file_log_t *file, const char *data, size_t len)
         ESP_LOGI(TAG, "Dumping buffer len %d", file->index);
         fwrite(file->buffer, 1, file->index, file->fp);
         fflush(file->fp);
+        stamp_written(file);
         file->index = 0;
         file->last_flush_tick = xTaskGetTickCount();
         file->last_write_tick = xTaskGetTickCount();
     }
     memcpy(&file->buffer[file->index], data, len);
     file->index += len;
+    latency_stamp(LAT_SD_BUFFERED, device, capture_us);
+    // untraced beyond LOG_BUFFER_STAMPS records in one buffer
+    if (capture_us && file->n_stamps < LOG_BUFFER_STAMPS)
+    {
+        file->device = device;
+        file->stamps[file->n_stamps++] = capture_us;
+    }
     ESP_LOGI(TAG, "Added to buffer total len: %d", file->index);
     file->last_write_tick = xTaskGetTickCount();
 }
@@ -208,6 +233,7 @@ static void flush_files_timer()
                 {
                     fwrite(f->buffer, 1, f->index, f->fp);
                     fflush(f->fp);
+                    stamp_written(f);
                     f->index = 0;
                     f->last_flush_tick = now;
                 }
@@ -219,7 +245,7 @@ static void flush_files_timer()
 //
 // Writes data to a file (buffer)
 //
-static esp_err_t write_file(const char *path, char *data)
+static esp_err_t write_file(const char *path, const char *data, size_t len, int device, int64_t capture_us)
 {
     // ESP_LOGI(TAG, "Opening file %s", path);
     // FILE *f = fopen(path, "a");
@@ -239,7 +265,7 @@ static esp_err_t write_file(const char *path, char *data)
         return ESP_FAIL;
     }
 
-    file_buffer_write(file, data, strlen(data));
+    file_buffer_write(file, data, len, device, capture_us);
         return ESP_OK;
 }
 
@@ -279,7 +305,8 @@ static int handle_save(save_req_t *save_req)
     ESP_LOGI(TAG, "GOT FNAME: %s", save_req->fname);
     char path[64];
     snprintf(path, sizeof(path), "%s/%s", MOUNT_POINT, save_req->fname);
-    good = write_file(path, save_req->data);
+    size_t len = save_req->len < sizeof(save_req->data) ? save_req->len : sizeof(save_req->data);
+    good = write_file(path, save_req->data, len, save_req->device, save_req->capture_us);
     if (good != ESP_OK)
     {
         return 1;
@@ -299,7 +326,7 @@ static void sd_task(void *arg)
 
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = false,
-        .max_files = 5,
+        .max_files = MAX_OPEN_FILES + 1,    // + the UART capture
         .allocation_unit_size = 16 * 1024
     };
 
@@ -353,10 +380,13 @@ static void sd_task(void *arg)
     const char *file_hello = MOUNT_POINT"/hello.txt";
     char data[512];
     snprintf(data, 512, "%s %s!\n", "Hello", card->cid.name);
-    ret = write_file(file_hello, data);
+    ret = write_file(file_hello, data, strlen(data), -1, 0);
     if (ret != ESP_OK) {
         return;
     }
+
+    if (g_uart_replay)
+        uart_replay_load(MOUNT_POINT "/" UART_REPLAY_FILE);
         
     TickType_t last_wake = xTaskGetTickCount();
     int pin_level = gpio_get_level(TOGGLE_SW);
@@ -364,8 +394,16 @@ static void sd_task(void *arg)
     {
         vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(g_log_interval_ms));
 
+        // switching logging off dumps the UART trace, the last transactions
+        // before whatever made the operator stop
+        int was_level = pin_level;
         pin_level = gpio_get_level(TOGGLE_SW);
         ESP_LOGI(TAG, "LVL: %d", pin_level);
+        if (was_level && !pin_level)
+        {
+            g_uart_trace_dump = 1;
+            uart_trace_save();
+        }
 
         while (xQueueReceive(get_save_queue(), &save_req, 0))
         {
@@ -383,6 +421,12 @@ static void sd_task(void *arg)
 
         // check and empty file buffers
         flush_files_timer();
+
+        if (pin_level)
+        {
+            uart_capture_flush();
+            uart_trace_save();
+        }
     }
 }
 
@@ -12,11 +12,14 @@
 #define SD_BUFFER_SIZE 4096
 #define MOUNT_POINT "/sdcard"
 
+#define LOG_BUFFER_STAMPS 64     // traced records per write buffer, see latency.h
+
 typedef struct {
     char fname[MAX_FNAME];
     int device;
     char data[MAX_DATA];
     uint32_t len;
+    int64_t capture_us;     // rx_done_us of the transaction it came from
 } save_req_t;
 
 typedef struct {
@@ -26,6 +29,9 @@ typedef struct {
     size_t index;
     TickType_t last_flush_tick;
     TickType_t last_write_tick;
+    int device;
+    int64_t stamps[LOG_BUFFER_STAMPS];  // capture_us of the records in buffer
+    size_t n_stamps;
 } file_log_t;
 
 QueueHandle_t get_save_queue();
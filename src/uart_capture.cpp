@@ -0,0 +1,239 @@
+#include "uart_capture.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "config.h"
+#include "sd_task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_DEVICES 8
+
+static const char *TAG = "UART_CAP";
+
+static uart_capture_stats_t stats;
+static portMUX_TYPE cap_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// record ring, uart_manager writes, sd_task drains
+static uint8_t ring[UART_CAPTURE_BUFFER];
+static size_t ring_head;
+static size_t ring_count;
+static FILE *cap_fp;
+
+// loaded capture and each device's position in it
+static uint8_t *replay_buf;
+static size_t replay_len;
+static size_t cursor[REPLAY_DEVICES];
+static bool replay_settled;         // uart_replay_load has tried
+
+/* RECORD */
+
+// copy len bytes in at the tail, in two pieces when they wrap; the caller
+// checked they fit and advances ring_count once for the whole record
+static size_t ring_put(size_t at, const void *data, size_t len)
+{
+    size_t first = UART_CAPTURE_BUFFER - at < len ? UART_CAPTURE_BUFFER - at : len;
+    memcpy(&ring[at], data, first);
+    memcpy(&ring[0], (const uint8_t *)data + first, len - first);
+    at += len;
+    return at >= UART_CAPTURE_BUFFER ? at - UART_CAPTURE_BUFFER : at;
+}
+
+void uart_capture_record(const uart_transaction_t *trans, int64_t start_us)
+{
+    uart_capture_rec_t rec;
+    rec.device = (uint8_t)trans->device;
+    rec.reserved = 0;
+    rec.tx_len = (uint16_t)trans->tx_len;
+    rec.rx_len = (uint16_t)trans->rx_len;
+    rec.timeout_ms = (uint16_t)trans->timeout_ms;
+    rec.baud = (uint32_t)trans->baud;
+    rec.start_us = start_us;
+    rec.duration_us = (uint32_t)(trans->rx_done_us - start_us);
+
+    size_t need = sizeof(rec) + rec.tx_len + rec.rx_len;
+    portENTER_CRITICAL(&cap_mux);
+    if (ring_count + need > UART_CAPTURE_BUFFER)
+    {
+        stats.record_dropped++;
+        portEXIT_CRITICAL(&cap_mux);
+        return;
+    }
+    size_t at = (ring_head + ring_count) % UART_CAPTURE_BUFFER;
+    at = ring_put(at, &rec, sizeof(rec));
+    at = ring_put(at, trans->tx_buf, rec.tx_len);
+    ring_put(at, trans->rx_buf, rec.rx_len);
+    ring_count += need;
+    stats.recorded++;
+    portEXIT_CRITICAL(&cap_mux);
+}
+
+void uart_capture_flush()
+{
+    if (!g_uart_capture)
+        return;
+    if (!cap_fp)
+    {
+        cap_fp = fopen(MOUNT_POINT "/" UART_CAPTURE_FILE, "a");
+        if (!cap_fp)
+        {
+            ESP_LOGE(TAG, "Failed to open %s", UART_CAPTURE_FILE);
+            return;
+        }
+        fseek(cap_fp, 0, SEEK_END);
+        if (ftell(cap_fp) == 0)
+        {
+            uart_capture_header_t hdr = {UART_CAPTURE_MAGIC, UART_CAPTURE_VERSION, sizeof(uart_capture_rec_t)};
+            fwrite(&hdr, 1, sizeof(hdr), cap_fp);
+        }
+    }
+
+    // only whole records are in the ring, so a snapshot of the count is safe
+    portENTER_CRITICAL(&cap_mux);
+    size_t head = ring_head;
+    size_t count = ring_count;
+    portEXIT_CRITICAL(&cap_mux);
+    if (count == 0)
+        return;
+
+    size_t first = UART_CAPTURE_BUFFER - head < count ? UART_CAPTURE_BUFFER - head : count;
+    fwrite(&ring[head], 1, first, cap_fp);
+    if (count > first)
+        fwrite(&ring[0], 1, count - first, cap_fp);
+    fflush(cap_fp);
+
+    portENTER_CRITICAL(&cap_mux);
+    ring_head = (ring_head + count) % UART_CAPTURE_BUFFER;
+    ring_count -= count;
+    stats.bytes_written += count;
+    portEXIT_CRITICAL(&cap_mux);
+}
+
+/* REPLAY */
+
+static bool load(const char *path)
+{
+    if (replay_buf)
+        return true;
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        ESP_LOGE(TAG, "Failed to open replay %s", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uart_capture_header_t hdr;
+    if (len < (long)sizeof(hdr) || fread(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+        hdr.magic != UART_CAPTURE_MAGIC || hdr.record_header_len != sizeof(uart_capture_rec_t))
+    {
+        ESP_LOGE(TAG, "%s is not a version %d capture", path, UART_CAPTURE_VERSION);
+        fclose(f);
+        return false;
+    }
+
+    size_t body = (size_t)len - sizeof(hdr);
+    uint8_t *buf = (uint8_t *)malloc(body ? body : 1);
+    if (!buf || fread(buf, 1, body, f) != body)
+    {
+        ESP_LOGE(TAG, "Failed to read %u bytes of %s", (unsigned)body, path);
+        free(buf);
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+
+    replay_len = body;
+    for (int i = 0; i < REPLAY_DEVICES; i++)
+        cursor[i] = 0;
+    replay_buf = buf;
+    ESP_LOGI(TAG, "Replaying %u bytes from %s", (unsigned)body, path);
+    return true;
+}
+
+bool uart_replay_load(const char *path)
+{
+    bool loaded = load(path);
+    __atomic_store_n(&replay_settled, true, __ATOMIC_RELEASE);
+    return loaded;
+}
+
+bool uart_replay_wait(uint32_t timeout_ms)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (!__atomic_load_n(&replay_settled, __ATOMIC_ACQUIRE))
+    {
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(timeout_ms))
+            return false;
+        vTaskDelay(1);
+    }
+    return replay_buf != NULL;
+}
+
+// next record for device at or after *pos, NULL when there is none
+static const uart_capture_rec_t *next_record(int device, size_t *pos)
+{
+    while (*pos + sizeof(uart_capture_rec_t) <= replay_len)
+    {
+        const uart_capture_rec_t *rec = (const uart_capture_rec_t *)&replay_buf[*pos];
+        size_t size = sizeof(*rec) + rec->tx_len + rec->rx_len;
+        if (*pos + size > replay_len)
+            break;      // cut short, e.g. power lost mid write
+        if (rec->device == device)
+            return rec;
+        *pos += size;
+    }
+    return NULL;
+}
+
+static void replay_wait(uint32_t us)
+{
+    if (g_uart_replay_speed == 0)
+        return;
+    uint32_t ms = us / 1000 / g_uart_replay_speed;
+    if (ms)
+        vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void uart_replay_transaction(uart_transaction_t *trans)
+{
+    int dev = (int)trans->device;
+    const uart_capture_rec_t *rec = NULL;
+    if (replay_buf && dev >= 0 && dev < REPLAY_DEVICES)
+        rec = next_record(dev, &cursor[dev]);
+
+    if (!rec)
+    {
+        portENTER_CRITICAL(&cap_mux);
+        stats.replay_missing++;
+        portEXIT_CRITICAL(&cap_mux);
+        replay_wait(trans->timeout_ms * 1000);
+        trans->rx_len = 0;
+        return;
+    }
+
+    // one uart_manager task per port replays, each for its own devices
+    const uint8_t *tx = (const uint8_t *)(rec + 1);
+    bool mismatch = rec->tx_len != trans->tx_len || memcmp(tx, trans->tx_buf, rec->tx_len) != 0;
+
+    replay_wait(rec->duration_us);
+    size_t rx_len = rec->rx_len < sizeof(trans->rx_buf) ? rec->rx_len : sizeof(trans->rx_buf);
+    memcpy(trans->rx_buf, tx + rec->tx_len, rx_len);
+    trans->rx_len = rx_len;
+    cursor[dev] += sizeof(*rec) + rec->tx_len + rec->rx_len;
+    portENTER_CRITICAL(&cap_mux);
+    stats.replayed++;
+    if (mismatch)
+        stats.replay_tx_mismatch++;
+    portEXIT_CRITICAL(&cap_mux);
+}
+
+void uart_capture_get_stats(uart_capture_stats_t *out)
+{
+    portENTER_CRITICAL(&cap_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&cap_mux);
+}
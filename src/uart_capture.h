@@ -0,0 +1,65 @@
+#pragma once
+#include "uart_manager.h"
+#include <stdint.h>
+
+// Record / replay of uart_manager transactions.
+//
+// With g_uart_capture set, uart_manager appends every transaction (device,
+// baud, tx and rx bytes, timing) to a RAM ring that sd_task drains into
+// UART_CAPTURE_FILE on the card, so the UART task never waits on the SD.
+//
+// With g_uart_replay set, uart_manager leaves the mux and UART alone and
+// answers each transaction with the next recorded one for the same device,
+// after its recorded duration divided by g_uart_replay_speed (0: at once).
+// A device with no recorded transactions left times out with no bytes.
+
+#define UART_CAPTURE_FILE "uart.cap"
+#define UART_REPLAY_FILE "replay.cap"
+#define UART_CAPTURE_BUFFER (16 * 1024)
+#define UART_CAPTURE_MAGIC 0x50414355   // "UCAP"
+#define UART_CAPTURE_VERSION 1
+#define UART_REPLAY_WAIT_MS 10000       // for sd_task to load the replay before uart_manager starts
+
+// start of a capture file, then records back to back
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_header_len;         // sizeof(uart_capture_rec_t)
+} uart_capture_header_t;
+
+// one transaction, followed by tx_len tx bytes and rx_len rx bytes
+typedef struct __attribute__((packed)) {
+    uint8_t device;
+    uint8_t reserved;
+    uint16_t tx_len;
+    uint16_t rx_len;
+    uint16_t timeout_ms;
+    uint32_t baud;
+    int64_t start_us;                   // taken off uart_queue
+    uint32_t duration_us;               // start_us -> response read finished
+} uart_capture_rec_t;
+
+typedef struct {
+    uint32_t recorded;
+    uint32_t record_dropped;            // ring full, sd_task behind
+    uint64_t bytes_written;
+    uint32_t replayed;
+    uint32_t replay_missing;            // no recorded transaction left for the device
+    uint32_t replay_tx_mismatch;        // firmware wrote something else than recorded
+} uart_capture_stats_t;
+
+// uart_manager side
+void uart_capture_record(const uart_transaction_t *trans, int64_t start_us);
+void uart_replay_transaction(uart_transaction_t *trans);
+
+// sd_task side: append what was recorded since the last call
+void uart_capture_flush();
+
+// loads a capture into memory, once; false if it cannot be read
+bool uart_replay_load(const char *path);
+
+// uart_manager side: wait for the first uart_replay_load, which sd_task only
+// gets to once the card is mounted; false if nothing was loaded in time
+bool uart_replay_wait(uint32_t timeout_ms);
+
+void uart_capture_get_stats(uart_capture_stats_t *stats);
@@ -0,0 +1,147 @@
+#include "uart_frame.h"
+
+#define PING_HEADER_LEN 8   // 'B' 'R' len(2) id(2) src dst
+#define PING_CHECKSUM_LEN 2
+#define UBX_HEADER_LEN 6    // 0xB5 0x62 class id len(2)
+#define UBX_CHECKSUM_LEN 2
+#define UBX_CLASS_ACK 0x05
+#define MAX_FRAME 512       // rx_buf of a transaction
+
+static uint16_t le16(const uint8_t *p)
+{
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+// A start that is not all there yet may be noise, and a real frame may
+// start inside what it claims or after the last byte; the scanners go on
+// past it and return the fewest bytes any of them still needs
+static size_t fewer(size_t best, size_t need)
+{
+    return need < best ? need : best;
+}
+
+static size_t ping_missing(const uint8_t *rx, size_t len)
+{
+    size_t best = PING_HEADER_LEN + PING_CHECKSUM_LEN;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (rx[i] != 'B')
+            continue;
+        if (i + 1 == len)
+            return fewer(best, PING_HEADER_LEN + PING_CHECKSUM_LEN - 1);
+        if (rx[i + 1] != 'R')
+            continue;
+        if (len - i < PING_HEADER_LEN)
+        {
+            best = fewer(best, PING_HEADER_LEN + PING_CHECKSUM_LEN - (len - i));
+            continue;
+        }
+
+        size_t frame = PING_HEADER_LEN + le16(&rx[i + 2]) + PING_CHECKSUM_LEN;
+        if (frame > MAX_FRAME)
+            continue;       // "BR" inside noise
+        if (len - i < frame)
+        {
+            best = fewer(best, frame - (len - i));
+            continue;
+        }
+
+        uint16_t sum = 0;
+        for (size_t k = 0; k < frame - PING_CHECKSUM_LEN; k++)
+            sum += rx[i + k];
+        if (sum == le16(&rx[i + frame - PING_CHECKSUM_LEN]))
+            return 0;
+    }
+    return best;
+}
+
+// does a complete UBX frame answer the request in tx?
+static bool ubx_answers(const uint8_t *frame, const uint8_t *tx, size_t tx_len)
+{
+    if (tx_len < UBX_HEADER_LEN || tx[0] != 0xB5 || tx[1] != 0x62)
+        return true;    // not a UBX request, any frame will do
+    uint8_t cls = frame[2], id = frame[3];
+    if (cls == tx[2] && id == tx[3])
+        return true;
+    return cls == UBX_CLASS_ACK && le16(&frame[4]) >= 2 &&
+           frame[UBX_HEADER_LEN] == tx[2] && frame[UBX_HEADER_LEN + 1] == tx[3];
+}
+
+static size_t ubx_missing(const uint8_t *tx, size_t tx_len, const uint8_t *rx, size_t len)
+{
+    size_t best = UBX_HEADER_LEN + UBX_CHECKSUM_LEN;
+    size_t i = 0;
+    while (i < len)
+    {
+        if (rx[i] != 0xB5)
+        {
+            i++;
+            continue;
+        }
+        if (i + 1 == len)
+            return fewer(best, UBX_HEADER_LEN + UBX_CHECKSUM_LEN - 1);
+        if (rx[i + 1] != 0x62)
+        {
+            i++;
+            continue;
+        }
+        if (len - i < UBX_HEADER_LEN)
+        {
+            best = fewer(best, UBX_HEADER_LEN + UBX_CHECKSUM_LEN - (len - i));
+            i++;
+            continue;
+        }
+
+        size_t frame = UBX_HEADER_LEN + le16(&rx[i + 4]) + UBX_CHECKSUM_LEN;
+        if (frame > MAX_FRAME)
+        {
+            i++;
+            continue;
+        }
+        if (len - i < frame)
+        {
+            best = fewer(best, frame - (len - i));
+            i++;
+            continue;
+        }
+
+        uint8_t ck_a = 0, ck_b = 0;
+        for (size_t k = 2; k < frame - UBX_CHECKSUM_LEN; k++)
+        {
+            ck_a += rx[i + k];
+            ck_b += ck_a;
+        }
+        if (ck_a != rx[i + frame - 2] || ck_b != rx[i + frame - 1])
+        {
+            i++;
+            continue;
+        }
+        if (ubx_answers(&rx[i], tx, tx_len))
+            return 0;
+        i += frame;
+    }
+    return best;
+}
+
+static size_t line_missing(const uint8_t *rx, size_t len)
+{
+    for (size_t i = 1; i < len; i++)
+    {
+        if (rx[i - 1] == '\r' && rx[i] == '\n')
+            return 0;
+    }
+    return len && rx[len - 1] == '\r' ? 1 : 2;
+}
+
+size_t uart_frame_missing(uart_frame_t frame,
+                          const uint8_t *tx, size_t tx_len,
+                          const uint8_t *rx, size_t rx_len)
+{
+    switch (frame)
+    {
+    case UART_FRAME_PING: return ping_missing(rx, rx_len);
+    case UART_FRAME_UBX:  return ubx_missing(tx, tx_len, rx, rx_len);
+    case UART_FRAME_LINE: return line_missing(rx, rx_len);
+    default:              return MAX_FRAME - rx_len;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "uart_manager.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Completion predicates for uart_manager reads. Given the request and what
+// has been received so far, returns 0 once the response frame is complete,
+// otherwise a lower bound on the bytes still missing (at least 1), so the
+// manager can block for that many instead of the whole timeout.
+//
+//   UART_FRAME_PING  a Ping protocol frame: "BR", payload length, id, payload, checksum
+//   UART_FRAME_UBX   the UBX frame answering the request: same class / id, or
+//                    the ACK / NAK of it; other frames are kept and skipped
+//   UART_FRAME_LINE  a "\r\n" terminated line (RN2483)
+size_t uart_frame_missing(uart_frame_t frame,
+                          const uint8_t *tx, size_t tx_len,
+                          const uint8_t *rx, size_t rx_len);
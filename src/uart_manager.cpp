@@ -3,18 +3,166 @@
 #include "driver/uart.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "nvs.h"
 #include "ping_task.h"
+#include "uart_capture.h"
+#include "uart_frame.h"
+#include "uart_pool.h"
+#include "uart_stream.h"
+#include "uart_trace.h"
+#include "config.h"
+#include <string.h>
 
 #define DEFAULT_BAUD 115200
+#define LOAD_CHECK_US 5000000   // how often to warn about a UART that is overcommitted
+#define NVS_NAMESPACE "uart_mgr"
+#define NVS_SETTLE_KEY "settle_us"
+
+// calibration: settle times tried per device, longest first
+static const uint32_t calib_steps_us[] = {10000, 5000, 3000, 2000, 1500, 1000, 700, 500, 300, 200, 100};
+#define CALIB_PROBES 3              // all must answer for a step to pass
+#define CALIB_MARGIN_PERCENT 50     // stored settle = measured + this much, at least CALIB_MARGIN_MIN_US
+#define CALIB_MARGIN_MIN_US 200
+#define CALIB_TIMEOUT_MS 100
+
+// response latency model: moving averages over about this many answers
+#define LATENCY_SHORT 8
+#define LATENCY_USUAL 128
+#define LATENCY_WARMUP 32           // answers before a device is judged
+#define LATENCY_SLACK_US 1000       // slower than twice usual plus this is worth a warning
 
-static QueueHandle_t uart_queue;
 static const char *TAG = "UART_MGR";
 
-static void mux_select(mux_device_t dev)
+static const uint8_t default_priority[UART_DEVICES] = {3, 1, 0, 2};   // GPS, PING, FC, LORA
+static const char *device_names[UART_DEVICES] = {"GPS", "PING", "FC", "LORA"};
+
+// the logger PCB: everything on UART_PORT behind the mux
+static uart_route_t routes[UART_DEVICES] = {
+    {UART_PORT, GPS, UART_TX, UART_RX},
+    {UART_PORT, PING, UART_TX, UART_RX},
+    {UART_PORT, FC, UART_TX, UART_RX},
+    {UART_PORT, LORA, UART_TX, UART_RX},
+};
+
+// one UART controller, the devices routed to it and its scheduler
+typedef struct {
+    uart_port_t port;
+    bool mux;                   // some of its devices are behind the mux
+    QueueHandle_t queue;
+    uart_transaction_t *pending[UART_QUEUE_LEN];
+    int n_pending;
+    int current;                // device the port talks to, -1 before the first
+    int burst;                  // transactions in a row for current
+    int baud;
+    int64_t baud_cost_us;       // running average of a baud change, first guess 100
+    uint32_t baud_switches;
+    int gps_baud;               // of the last GPS transaction, streaming reads at it
+    char name[12];              // of its task
+    // the last transaction, read but not yet handed back, see finish()
+    uart_transaction_t *finished;
+    int64_t finished_start_us;
+    int64_t finished_write_us;
+    bool finished_switched;
+    bool stream_switched;       // stream_idle switched the mux back to the GPS, not counted yet
+    int64_t last_load_check;
+    TaskHandle_t task;          // its manager, woken by settle_timer
+    esp_timer_handle_t settle_timer;
+} uart_bus_t;
+
+static uart_bus_t buses[UART_DEVICES];
+static int n_buses;
+static uart_bus_t *bus_of[UART_DEVICES];
+
+static uart_sched_stats_t sched[UART_DEVICES];
+static portMUX_TYPE sched_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// settle per device after a mux switch, from NVS once calibrated
+static uint32_t settle_us[UART_DEVICES] = {UART_SETTLE_DEFAULT_US, UART_SETTLE_DEFAULT_US,
+                                           UART_SETTLE_DEFAULT_US, UART_SETTLE_DEFAULT_US};
+
+static void mux_select(int addr)
+{
+    gpio_set_level(MUX_A0, (addr >> 0) & 1);
+    gpio_set_level(MUX_A1, (addr >> 1) & 1);
+    gpio_set_level(MUX_A2, (addr >> 2) & 1);
+}
+
+static bool valid_device(int dev)
+{
+    return dev >= 0 && dev < UART_DEVICES;
+}
+
+static TickType_t us_to_ticks(int64_t us)
+{
+    int64_t tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+    return (TickType_t)((us + tick_us - 1) / tick_us);
+}
+
+static void settle_timer_cb(void *arg)
+{
+    xTaskNotifyGive(((uart_bus_t *)arg)->task);
+}
+
+//
+// Wait for the mux and the device line to settle until esp_timer says us
+// have passed. A tick delay can end up to a tick early, so it only sleeps
+// the ticks that surely end before then; a one shot esp_timer wakes it for
+// the rest and only the last UART_SETTLE_SPIN_US are busy waited.
+//
+static void settle_wait(uart_bus_t *bus, uint32_t us)
+{
+    int64_t until = esp_timer_get_time() + us;
+    int64_t tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+    // N ticks end N - 1 to N periods on
+    int64_t left = until - UART_SETTLE_SPIN_US - esp_timer_get_time();
+    if (left >= tick_us)
+        vTaskDelay((TickType_t)(left / tick_us));
+
+    left = until - UART_SETTLE_SPIN_US - esp_timer_get_time();
+    if (left > 0 && esp_timer_start_once(bus->settle_timer, (uint64_t)left) == ESP_OK)
+    {
+        // the tick limit only covers a lost wake up
+        ulTaskNotifyTake(pdTRUE, us_to_ticks(left) + 1);
+        esp_timer_stop(bus->settle_timer);
+        ulTaskNotifyTake(pdTRUE, 0);    // one that fired after the limit
+    }
+
+    left = until - esp_timer_get_time();
+    if (left > 0)
+        esp_rom_delay_us((uint32_t)left);
+}
+
+// a device with a port of its own is always selected
+static uint32_t device_settle_us(int dev)
+{
+    if (!valid_device(dev))
+        return UART_SETTLE_DEFAULT_US;
+    return routes[dev].mux_addr < 0 ? 0 : settle_us[dev];
+}
+
+//
+// Time trans needs on the bus before its write can start
+//
+static int64_t switch_cost_us(const uart_bus_t *bus, const uart_transaction_t *trans)
 {
-    gpio_set_level(MUX_A0, (dev >> 0) & 1);
-    gpio_set_level(MUX_A1, (dev >> 1) & 1);
-    gpio_set_level(MUX_A2, (dev >> 2) & 1);
+    int64_t cost = 0;
+    if (trans->device != bus->current)
+        cost += device_settle_us(trans->device);
+    if (trans->baud != bus->baud)
+        cost += bus->baud_cost_us;
+    return cost;
+}
+
+static void set_baud(uart_bus_t *bus, int baud)
+{
+    int64_t t0 = esp_timer_get_time();
+    uart_set_baudrate(bus->port, baud);
+    int64_t took = esp_timer_get_time() - t0;
+    bus->baud = baud;
+    bus->baud_switches++;
+    bus->baud_cost_us += (took - bus->baud_cost_us) / 8;
 }
 
 static void debug_tx_tx(const uart_transaction_t *trans)
@@ -95,71 +243,671 @@ void log_rn2483_transaction(uart_transaction_t* trans)
     ESP_LOGI(TAG, "%s", rx_ascii);
 }
 
+// time len bytes take on the wire at baud, 8N1
+static int64_t wire_us(size_t len, int baud)
+{
+    return baud > 0 ? (int64_t)len * 10000000 / baud : 0;
+}
+
+//
+// Read the response to trans until its frame is complete (or expect_len bytes
+// are in without one), blocking only for the bytes still missing. Waiting for
+// the first byte is limited by timeout_ms; once the response has started the
+// line going idle for gap_us ends it too, so a short or garbled answer does
+// not hold the port for the whole timeout. The driver only sees bytes when
+// the RX interrupt moves them, so the gap is at least what that can take.
+// Both limits are esp_timer times: a tick timeout ends at the next tick
+// interrupt, up to a tick early, so a wait that ends before its limit is
+// just waited again.
+//
+static int read_response(uart_port_t port, uart_transaction_t *trans)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t)trans->timeout_ms * 1000;
+    int64_t gap = trans->gap_us ? trans->gap_us : UART_GAP_DEFAULT_US;
+    int64_t rx_irq_us = wire_us(UART_RX_FULL_THRESH + UART_RX_TOUT, trans->baud);
+    if (gap < rx_irq_us)
+        gap = rx_irq_us;
+    size_t cap = sizeof(trans->rx_buf);
+    if (trans->frame == UART_FRAME_NONE && trans->expect_len && trans->expect_len < cap)
+        cap = trans->expect_len;
+    size_t len = 0;
+    int64_t last_rx = 0;
+    trans->end = UART_END_TIMEOUT;
+    while (1)
+    {
+        size_t missing = cap - len;
+        if (trans->frame != UART_FRAME_NONE)
+        {
+            size_t need = uart_frame_missing(trans->frame, trans->tx_buf, trans->tx_len, trans->rx_buf, len);
+            if (need == 0)
+            {
+                trans->end = UART_END_FRAME;
+                break;
+            }
+            if (need < missing)
+                missing = need;
+        }
+        if (missing == 0)
+        {
+            trans->end = len == trans->expect_len ? UART_END_LENGTH : UART_END_FULL;
+            break;
+        }
+        int64_t now = esp_timer_get_time();
+        bool idle_limit = len && last_rx + gap < deadline;
+        int64_t until = idle_limit ? last_rx + gap : deadline;
+        if (until <= now)
+        {
+            // nothing within the gap, the device is done talking
+            if (idle_limit)
+                trans->end = UART_END_IDLE;
+            break;
+        }
+
+        int n = uart_read_bytes(port, trans->rx_buf + len, missing, us_to_ticks(until - now));
+        if (n <= 0)
+            continue;
+        len += n;
+        last_rx = esp_timer_get_time();
+
+        // take whatever else already arrived without waiting
+        size_t buffered = 0;
+        uart_get_buffered_data_len(port, &buffered);
+        size_t space = cap - len;
+        if (buffered && space)
+        {
+            n = uart_read_bytes(port, trans->rx_buf + len, buffered < space ? buffered : space, 0);
+            if (n > 0)
+                len += n;
+        }
+    }
+    return (int)len;
+}
+
+//
+// Scheduling: each port's manager drains its queue into pending and runs
+// late transactions first, then ones for the device the port already talks
+// to (up to UART_BURST_MAX in a row, saving the switch and settle), then by
+// priority, then earliest deadline, then oldest
+//
+static void admit(uart_bus_t *bus, uart_transaction_t *trans)
+{
+    int64_t now = esp_timer_get_time();
+    trans->queued_us = now;
+    if (trans->priority == 0 && valid_device(trans->device))
+        trans->priority = default_priority[trans->device];
+    if (trans->deadline_us == 0)
+        trans->deadline_us = trans->period_ms ? now + (int64_t)trans->period_ms * 1000 : INT64_MAX;
+    bus->pending[bus->n_pending] = trans;
+    // read by uart_manager_backlog from the metrics task
+    __atomic_store_n(&bus->n_pending, bus->n_pending + 1, __ATOMIC_RELAXED);
+}
+
+static bool runs_before(const uart_bus_t *bus, const uart_transaction_t *a, const uart_transaction_t *b, int64_t now)
+{
+    // late, or will be once the mux and baud are switched to it
+    bool a_late = a->deadline_us <= now + switch_cost_us(bus, a);
+    bool b_late = b->deadline_us <= now + switch_cost_us(bus, b);
+    if (a_late != b_late)
+        return a_late;
+    if (bus->burst < UART_BURST_MAX)
+    {
+        bool a_here = a->device == bus->current, b_here = b->device == bus->current;
+        if (a_here != b_here)
+            return a_here;
+    }
+    if (!a_late && a->priority != b->priority)
+        return a->priority > b->priority;
+    if (a->deadline_us != b->deadline_us)
+        return a->deadline_us < b->deadline_us;
+    return a->queued_us < b->queued_us;
+}
+
+static uart_transaction_t *next_transaction(uart_bus_t *bus)
+{
+    int64_t now = esp_timer_get_time();
+    int best = 0;
+    for (int i = 1; i < bus->n_pending; i++)
+    {
+        if (runs_before(bus, bus->pending[i], bus->pending[best], now))
+            best = i;
+    }
+    uart_transaction_t *trans = bus->pending[best];
+    for (int i = best; i < bus->n_pending - 1; i++)
+        bus->pending[i] = bus->pending[i + 1];
+    __atomic_store_n(&bus->n_pending, bus->n_pending - 1, __ATOMIC_RELAXED);
+    return trans;
+}
+
+//
+// Response latency of trans: request out to answered, less the response's
+// bytes on the wire
+//
+static int64_t response_latency_us(const uart_transaction_t *trans)
+{
+    int64_t latency = trans->rx_done_us - trans->tx_done_us - wire_us(trans->rx_len, trans->baud);
+    return latency > 0 ? latency : 0;
+}
+
+static void account(const uart_transaction_t *trans, int64_t start_us, bool switched)
+{
+    if (!valid_device(trans->device))
+        return;
+    uart_sched_stats_t *s = &sched[trans->device];
+    int64_t wait = start_us - trans->queued_us;
+    bool answered = trans->end == UART_END_FRAME || trans->end == UART_END_LENGTH;
+    int64_t latency = answered ? response_latency_us(trans) : 0;
+
+    portENTER_CRITICAL(&sched_mux);
+    s->transactions++;
+    s->busy_us += trans->rx_done_us - start_us;
+    s->wait_us += wait;
+    if (wait > s->wait_us_max)
+        s->wait_us_max = (uint32_t)wait;
+    if (trans->rx_done_us > trans->deadline_us)
+        s->deadline_missed++;
+    if (trans->period_ms)
+        s->period_ms = trans->period_ms;
+    if (switched)
+        s->mux_switches++;
+    else
+        s->switches_saved++;
+
+    if (answered)
+    {
+        if (s->answered++ == 0)
+            s->latency_us = s->latency_us_usual = (uint32_t)latency;
+        s->latency_us += ((int32_t)latency - (int32_t)s->latency_us) / LATENCY_SHORT;
+        s->latency_us_usual += ((int32_t)latency - (int32_t)s->latency_us_usual) / LATENCY_USUAL;
+        if (latency > s->latency_us_max)
+            s->latency_us_max = (uint32_t)latency;
+        if (trans->frame != UART_FRAME_NONE && trans->expect_len && trans->rx_len != trans->expect_len)
+            s->len_mismatch++;
+    }
+    else if (trans->end == UART_END_TIMEOUT)
+        s->timeouts++;
+    else if (trans->end == UART_END_IDLE)
+        s->idle_ends++;
+    portEXIT_CRITICAL(&sched_mux);
+}
+
+// a switch to the GPS stream that no GPS transaction followed
+static void count_stream_switch()
+{
+    portENTER_CRITICAL(&sched_mux);
+    sched[GPS].mux_switches++;
+    portEXIT_CRITICAL(&sched_mux);
+}
+
+// warn about devices on bus answering much slower than they used to
+static void check_latency(const uart_bus_t *bus)
+{
+    for (int d = 0; d < UART_DEVICES; d++)
+    {
+        if (bus_of[d] != bus)
+            continue;
+        uart_sched_stats_t s;
+        uart_manager_get_stats((mux_device_t)d, &s);
+        if (s.answered >= LATENCY_WARMUP && s.latency_us > 2 * s.latency_us_usual + LATENCY_SLACK_US)
+            ESP_LOGW(TAG, "%s is slowing down: answers in %.1f ms, usually %.1f ms", device_names[d],
+                     s.latency_us / 1000.0, s.latency_us_usual / 1000.0);
+    }
+}
+
+// point the mux at the device of trans, its settle time starts now
+static void select_device(const uart_transaction_t *trans)
+{
+    if (valid_device(trans->device) && routes[trans->device].mux_addr >= 0)
+        mux_select(routes[trans->device].mux_addr);
+}
+
+//
+// Write the request once the device has settled and read the response.
+// selected_us is when select_device switched to it, 0 if it was not
+// switched. Returns when the write started.
+//
+static int64_t run_on_bus(uart_bus_t *bus, uart_transaction_t *trans, int64_t selected_us, uint32_t settle)
+{
+    ESP_LOGI(TAG, "Writing to device %d", trans->device);
+    if (selected_us)
+    {
+        int64_t left = selected_us + settle - esp_timer_get_time();
+        if (left > 0)
+            settle_wait(bus, (uint32_t)left);
+    }
+    uart_flush(bus->port);
+
+    // if device wants a different baudrate
+    if (trans->baud != bus->baud)
+        set_baud(bus, trans->baud);
+
+    int64_t write_us = esp_timer_get_time();
+    uart_write_bytes(bus->port,
+                     (const char*)trans->tx_buf,
+                     trans->tx_len);
+
+    // the answer cannot start before the request is out, and the mux may
+    // only switch away once it is
+    uart_wait_tx_done(bus->port, us_to_ticks(wire_us(trans->tx_len, trans->baud)) + 1);
+    trans->tx_done_us = esp_timer_get_time();
+
+    int len = read_response(bus->port, trans);
+    trans->rx_len = len > 0 ? len : 0;
+    trans->rx_done_us = esp_timer_get_time();
+    return write_us;
+}
+
+/* GNSS STREAMING */
+
+// true for the port the GPS is on when it streams
+static bool streaming(const uart_bus_t *bus)
+{
+    return g_gnss_stream && !g_uart_replay && bus == bus_of[GPS];
+}
+
+// move what the GPS sent since the last read into the stream ring
+static void stream_drain(uart_bus_t *bus)
+{
+    uint8_t buf[256];
+    size_t buffered = 0;
+    uart_get_buffered_data_len(bus->port, &buffered);
+    while (buffered)
+    {
+        int n = uart_read_bytes(bus->port, buf, buffered < sizeof(buf) ? buffered : sizeof(buf), 0);
+        if (n <= 0)
+            break;
+        uart_stream_write(buf, n, esp_timer_get_time());
+        buffered -= n;
+    }
+}
+
+//
+// Nothing queued: point the mux at the GPS and keep reading it until a
+// transaction arrives. True with it in *trans.
+//
+static bool stream_idle(uart_bus_t *bus, uart_transaction_t **trans)
+{
+    bool resumed = bus->current != GPS;
+    if (resumed)
+    {
+        // drop what is left of the last device, the GPS talks during the settle
+        if (routes[GPS].mux_addr >= 0)
+            mux_select(routes[GPS].mux_addr);
+        uart_flush(bus->port);
+        settle_wait(bus, device_settle_us(GPS));
+        bus->current = GPS;
+        bus->burst = 0;
+        bus->stream_switched = routes[GPS].mux_addr >= 0;
+    }
+    if (bus->baud != bus->gps_baud)
+        set_baud(bus, bus->gps_baud);
+
+    bool got = xQueueReceive(bus->queue, trans, UART_STREAM_IDLE_TICKS) == pdTRUE;
+    stream_drain(bus);
+    uart_stream_count_drain(resumed);
+    return got;
+}
+
+//
+// Hand trans back: mark it done, run its callback and wake its task. The
+// callback may free or pass on the transaction, so nothing touches it after.
+//
+static void complete(uart_transaction_t *trans)
+{
+    TaskHandle_t caller = trans->caller;
+    uart_done_cb_t on_done = trans->on_done;
+    __atomic_store_n(&trans->done, 1, __ATOMIC_RELEASE);
+    if (on_done)
+        on_done(trans, trans->done_arg);
+    if (caller)
+        xTaskNotifyGive(caller);
+}
+
+//
+// Account, trace and hand back the last transaction of bus. The manager
+// puts this off until it has switched the mux for the next one, so it runs
+// during the settle instead of in front of it.
+//
+static void finish(uart_bus_t *bus)
+{
+    uart_transaction_t *trans = bus->finished;
+    if (!trans)
+        return;
+    bus->finished = NULL;
+
+    ESP_LOGI(TAG, "DEV %d TX: %d bytes, RX: %d bytes", trans->device, trans->tx_len, trans->rx_len);
+    //debug_tx_tx(trans);
+    //log_rn2483_transaction(trans);
+    account(trans, bus->finished_start_us, bus->finished_switched);
+    uart_trace_record(trans, bus->port, bus->finished_start_us, bus->finished_write_us, bus->finished_switched);
+
+    int64_t done_us = trans->rx_done_us;
+    complete(trans);
+
+    if (done_us - bus->last_load_check > LOAD_CHECK_US)
+    {
+        bus->last_load_check = done_us;
+        uint32_t load = uart_manager_load_permille(bus->port);
+        if (load > 1000)
+            ESP_LOGW(TAG, "requested rates need %u.%u%% of uart%d", (unsigned)(load / 10), (unsigned)(load % 10), bus->port);
+        check_latency(bus);
+    }
+}
+
+/* CALIBRATION */
+
+static void load_settle_times()
+{
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return;
+    uint32_t stored[UART_DEVICES];
+    size_t len = sizeof(stored);
+    if (nvs_get_blob(nvs, NVS_SETTLE_KEY, stored, &len) == ESP_OK && len == sizeof(stored))
+    {
+        memcpy(settle_us, stored, sizeof(stored));
+        ESP_LOGI(TAG, "settle us from NVS: GPS %u PING %u FC %u LORA %u",
+                 (unsigned)settle_us[GPS], (unsigned)settle_us[PING], (unsigned)settle_us[FC], (unsigned)settle_us[LORA]);
+    }
+    nvs_close(nvs);
+}
+
+static void save_settle_times()
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, NVS_SETTLE_KEY, settle_us, sizeof(settle_us));
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Failed to store settle times (%s)", esp_err_to_name(err));
+}
+
+// a request each device answers, false for none
+static bool build_probe(mux_device_t dev, uart_transaction_t *trans)
+{
+    trans->timeout_ms = CALIB_TIMEOUT_MS;
+    switch (dev)
+    {
+    case GPS:
+    {
+        // MON-VER poll
+        static const uint8_t mon_ver[] = {0xB5, 0x62, 0x0A, 0x04, 0x00, 0x00, 0x0E, 0x34};
+        memcpy(trans->tx_buf, mon_ver, sizeof(mon_ver));
+        trans->tx_len = sizeof(mon_ver);
+        trans->baud = 115200;
+        trans->frame = UART_FRAME_UBX;
+        return true;
+    }
+    case PING:
+    {
+        // general_request for device_information
+        static const uint8_t info[] = {'B', 'R', 0x02, 0x00, 0x06, 0x00, 0x00, 0x00, 0x04, 0x00, 0xA0, 0x00};
+        memcpy(trans->tx_buf, info, sizeof(info));
+        trans->tx_len = sizeof(info);
+        trans->baud = DEFAULT_BAUD;
+        trans->frame = UART_FRAME_PING;
+        return true;
+    }
+    case LORA:
+    {
+        static const char ver[] = "sys get ver\r\n";
+        memcpy(trans->tx_buf, ver, sizeof(ver) - 1);
+        trans->tx_len = sizeof(ver) - 1;
+        trans->baud = 57600;
+        trans->frame = UART_FRAME_LINE;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// switch away and back with the given settle, true if the device answered
+static bool probe(uart_bus_t *bus, mux_device_t dev, uint32_t settle)
+{
+    uart_transaction_t *trans = uart_trans_alloc(dev, portMAX_DELAY);
+    bool answered = false;
+    if (build_probe(dev, trans))
+    {
+        mux_select(routes[dev].mux_addr == FC ? GPS : FC);
+        vTaskDelay(1);
+        bus->current = -1;
+        select_device(trans);
+        run_on_bus(bus, trans, esp_timer_get_time(), settle);
+        bus->current = dev;
+        answered = trans->end == UART_END_FRAME;
+    }
+    uart_trans_free(trans);
+    return answered;
+}
+
+//
+// For each device behind the mux, the shortest settle that still gets
+// CALIB_PROBES answers in a row, plus a margin, stored in NVS. Devices that
+// do not answer even at the longest step keep their current value.
+//
+static void calibrate(uart_bus_t *bus)
+{
+    ESP_LOGI(TAG, "Calibrating mux settle times");
+    for (int d = 0; d < UART_DEVICES; d++)
+    {
+        if (bus_of[d] != bus || routes[d].mux_addr < 0)
+            continue;
+        int passed = -1;
+        for (int step = 0; step < (int)(sizeof(calib_steps_us) / sizeof(calib_steps_us[0])); step++)
+        {
+            bool ok = true;
+            for (int i = 0; i < CALIB_PROBES && ok; i++)
+                ok = probe(bus, (mux_device_t)d, calib_steps_us[step]);
+            if (!ok)
+                break;
+            passed = step;
+        }
+        if (passed < 0)
+        {
+            ESP_LOGW(TAG, "%s did not answer, settle stays %u us", device_names[d], (unsigned)settle_us[d]);
+            continue;
+        }
+        uint32_t measured = calib_steps_us[passed];
+        uint32_t margin = measured * CALIB_MARGIN_PERCENT / 100;
+        if (margin < CALIB_MARGIN_MIN_US)
+            margin = CALIB_MARGIN_MIN_US;
+        settle_us[d] = measured + margin;
+        ESP_LOGI(TAG, "%s answers after %u us, settle %u us", device_names[d], (unsigned)measured, (unsigned)settle_us[d]);
+    }
+    save_settle_times();
+}
+
+//
+// The scheduler of one port, arg is its uart_bus_t
+//
 static void uart_manager_task(void *arg)
 {
+    uart_bus_t *bus = (uart_bus_t *)arg;
     uart_transaction_t *trans;
-    int currBaud = DEFAULT_BAUD;
+    bus->task = xTaskGetCurrentTaskHandle();
+
+    // the tasks' first requests must get the first recorded answers, not
+    // the "missing" ones given before sd_task has loaded the recording
+    if (g_uart_replay && !uart_replay_wait(UART_REPLAY_WAIT_MS))
+        ESP_LOGW(TAG, "No replay loaded, transactions get no answers");
+
+    if (g_uart_calibrate && !g_uart_replay && bus->mux)
+        calibrate(bus);
+
     while (1)
     {
+        // block only when there is nothing left to schedule, and not on a
+        // transaction that is not handed back yet
+        if (bus->n_pending == 0)
+        {
+            finish(bus);
+            if (streaming(bus))
+            {
+                if (stream_idle(bus, &trans))
+                    admit(bus, trans);
+            }
+            else if (xQueueReceive(bus->queue, &trans, portMAX_DELAY))
+                admit(bus, trans);
+        }
+        while (bus->n_pending < UART_QUEUE_LEN && xQueueReceive(bus->queue, &trans, 0))
+            admit(bus, trans);
+        if (bus->n_pending == 0)
+            continue;
+        trans = next_transaction(bus);
 
-        if (xQueueReceive(uart_queue, &trans, portMAX_DELAY))
+        int64_t start_us = esp_timer_get_time();
+        int64_t write_us = start_us;
+        bool switched = trans->device != bus->current;
+        // a switch back to the GPS for its stream is the next GPS
+        // transaction's, it is not a switch saved
+        bool counted = switched;
+        if (bus->stream_switched)
         {
-            ESP_LOGI(TAG, "Writing to device %d", trans->device);
-            mux_select(trans->device);
-            vTaskDelay(pdMS_TO_TICKS(10));
-            uart_flush(UART_PORT);
+            bus->stream_switched = false;
+            if (trans->device == GPS)
+                counted = true;
+            else
+                count_stream_switch();
+        }
 
-            // if device wants a different baudrate
-            if (trans->baud != currBaud)
+        if (g_uart_replay)
+        {
+            // answer from the capture, the devices are not touched
+            finish(bus);
+            uart_replay_transaction(trans);
+            trans->end = UART_END_NONE;
+            trans->rx_done_us = esp_timer_get_time();
+        }
+        else
+        {
+            // keep what the GPS streamed up to now, run_on_bus flushes the UART
+            if (streaming(bus) && bus->current == GPS)
+                stream_drain(bus);
+
+            // switch first and hand back the last transaction while the
+            // device settles: the write follows its response back to back
+            int64_t selected_us = 0;
+            if (switched)
             {
-                uart_set_baudrate(UART_PORT, trans->baud);
-                currBaud = trans->baud;
+                select_device(trans);
+                selected_us = esp_timer_get_time();
             }
+            finish(bus);
 
-            uart_write_bytes(UART_PORT,
-                             (const char*)trans->tx_buf,
-                             trans->tx_len);
+            write_us = run_on_bus(bus, trans, selected_us, device_settle_us(trans->device));
+            if (g_uart_capture)
+                uart_capture_record(trans, start_us);
+            if (trans->device == GPS)
+            {
+                bus->gps_baud = trans->baud;
+                if (streaming(bus))
+                    uart_stream_write(trans->rx_buf, trans->rx_len, trans->rx_done_us);
+            }
+        }
 
-            //uart_wait_tx_done(UART_PORT, pdMS_TO_TICKS(10));
-            
-            int len = uart_read_bytes(UART_PORT,
-                                      trans->rx_buf,
-                                      512,
-                                      pdMS_TO_TICKS(trans->timeout_ms));    
-            trans->rx_len = len;
+        bus->burst = switched ? 1 : bus->burst + 1;
+        bus->current = trans->device;
+        bus->finished = trans;
+        bus->finished_start_us = start_us;
+        bus->finished_write_us = write_us;
+        bus->finished_switched = counted;
+    }
+}
 
-            ESP_LOGI(TAG, "DEV %d TX: %d bytes, RX: %d bytes", trans->device, trans->tx_len, len);
-            //debug_tx_tx(trans);
-            //log_rn2483_transaction(trans);
+QueueHandle_t get_uart_queue(uart_port_t port)
+{
+    for (int i = 0; i < n_buses; i++)
+    {
+        if (buses[i].port == port)
+            return buses[i].queue;
+    }
+    return NULL;
+}
 
+int uart_manager_backlog(uart_port_t port)
+{
+    for (int i = 0; i < n_buses; i++)
+    {
+        if (buses[i].port == port)
+            return __atomic_load_n(&buses[i].n_pending, __ATOMIC_RELAXED) +
+                   (int)uxQueueMessagesWaiting(buses[i].queue);
+    }
+    return -1;
+}
 
+const char *uart_manager_task_name(uart_port_t port)
+{
+    for (int i = 0; i < n_buses; i++)
+    {
+        if (buses[i].port == port)
+            return buses[i].name;
+    }
+    return NULL;
+}
 
-            if (trans->caller)
-                xTaskNotifyGive(trans->caller);
+bool uart_submit(uart_transaction_t *trans, TickType_t wait)
+{
+    if (!valid_device(trans->device) || !bus_of[trans->device])
+        return false;
+    trans->done = 0;
+    if (!trans->on_done && !trans->caller)
+        trans->caller = xTaskGetCurrentTaskHandle();
+    return xQueueSend(bus_of[trans->device]->queue, &trans, wait) == pdTRUE;
+}
 
-        }
+bool uart_trans_done(const uart_transaction_t *trans)
+{
+    return __atomic_load_n(&trans->done, __ATOMIC_ACQUIRE) != 0;
+}
+
+bool uart_trans_wait(uart_transaction_t *trans, TickType_t wait)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (!uart_trans_done(trans))
+    {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (wait != portMAX_DELAY && waited >= wait)
+            return false;
+        // one notification per finished transaction of this task, not
+        // necessarily this one; counts left from earlier ones only loop again
+        ulTaskNotifyTake(pdFALSE, wait == portMAX_DELAY ? portMAX_DELAY : wait - waited);
     }
+    return true;
 }
 
-QueueHandle_t get_uart_queue()
+bool uart_transact(uart_transaction_t *trans)
 {
-    return uart_queue;
+    if (!uart_submit(trans, portMAX_DELAY))
+        return false;
+    return uart_trans_wait(trans, portMAX_DELAY);
 }
 
-void init_uart_manager()
+void uart_manager_set_route(mux_device_t dev, const uart_route_t *route)
 {
-    // TODO: Handle default baud rates and baud rate switching
-    gpio_set_direction(MUX_A0, GPIO_MODE_OUTPUT);
-    gpio_set_direction(MUX_A1, GPIO_MODE_OUTPUT);
-    gpio_set_direction(MUX_A2, GPIO_MODE_OUTPUT);
+    if (valid_device(dev) && !n_buses)
+        routes[dev] = *route;
+}
 
-    uart_queue = xQueueCreate(40, sizeof(uart_transaction_t*));
+void uart_manager_get_route(mux_device_t dev, uart_route_t *route)
+{
+    if (valid_device(dev))
+        *route = routes[dev];
+}
 
-    mux_select(PING);
+//
+// Install the driver for a port the first device on it brings up
+//
+static void install_port(uart_bus_t *bus, const uart_route_t *route)
+{
     const int UART_BUF_SIZE = 2048;
     // ESP_ERROR_CHECK(uart_driver_install(UART_PORT, UART_BUF_SIZE, UART_BUF_SIZE, 10, NULL, 0));
     ESP_ERROR_CHECK(uart_driver_install(
-                    UART_PORT,
+                    bus->port,
                     UART_BUF_SIZE,   // RX buffer
                     0,      // TX buffer disabled
                     0,      // no event queue
@@ -177,16 +925,157 @@ void init_uart_manager()
             .rx_flow_ctrl_thresh = 122,
     };
 
-    ESP_ERROR_CHECK(uart_param_config(UART_PORT, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(UART_PORT, UART_TX, UART_RX, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
-
-    xTaskCreatePinnedToCore(
-        uart_manager_task,
-        "uart_mgr",
-        4096,
-        NULL,
-        10,
-        NULL,
-        0
-    );
-}
\ No newline at end of file
+    ESP_ERROR_CHECK(uart_param_config(bus->port, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(bus->port, route->tx_pin, route->rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+    // the driver's 120 byte / 10 symbol defaults leave the end of a response
+    // in the FIFO for up to a millisecond or, mid-response, a full gap
+    ESP_ERROR_CHECK(uart_set_rx_full_threshold(bus->port, UART_RX_FULL_THRESH));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(bus->port, UART_RX_TOUT));
+}
+
+void init_uart_manager()
+{
+    // TODO: Handle default baud rates and baud rate switching
+    uart_pool_init();
+    load_settle_times();
+
+    for (int d = 0; d < UART_DEVICES; d++)
+    {
+        uart_bus_t *bus = NULL;
+        for (int i = 0; i < n_buses && !bus; i++)
+        {
+            if (buses[i].port == routes[d].port)
+                bus = &buses[i];
+        }
+        if (!bus)
+        {
+            bus = &buses[n_buses++];
+            bus->port = routes[d].port;
+            bus->current = -1;
+            bus->baud = DEFAULT_BAUD;
+            bus->baud_cost_us = 100;
+            bus->gps_baud = DEFAULT_BAUD;
+            bus->queue = xQueueCreate(UART_QUEUE_LEN, sizeof(uart_transaction_t*));
+            esp_timer_create_args_t timer_args = {
+                .callback = settle_timer_cb,
+                .arg = bus,
+                .dispatch_method = ESP_TIMER_TASK,
+                .name = "uart_settle",
+                .skip_unhandled_events = false,
+            };
+            ESP_ERROR_CHECK(esp_timer_create(&timer_args, &bus->settle_timer));
+            install_port(bus, &routes[d]);
+        }
+        if (routes[d].mux_addr >= 0)
+        {
+            // there is one mux, wired to one controller
+            for (int i = 0; i < n_buses; i++)
+            {
+                if (buses[i].mux && &buses[i] != bus)
+                    ESP_LOGE(TAG, "%s is on the mux but uart%d already has it", device_names[d], buses[i].port);
+            }
+            bus->mux = true;
+        }
+        bus_of[d] = bus;
+    }
+
+    for (int i = 0; i < n_buses; i++)
+    {
+        uart_bus_t *bus = &buses[i];
+        if (bus->mux)
+        {
+            gpio_set_direction(MUX_A0, GPIO_MODE_OUTPUT);
+            gpio_set_direction(MUX_A1, GPIO_MODE_OUTPUT);
+            gpio_set_direction(MUX_A2, GPIO_MODE_OUTPUT);
+            if (bus_of[PING] == bus && routes[PING].mux_addr >= 0)
+            {
+                mux_select(routes[PING].mux_addr);
+                bus->current = PING;
+            }
+        }
+        if (bus->port == UART_PORT)
+            snprintf(bus->name, sizeof(bus->name), "uart_mgr");
+        else
+            snprintf(bus->name, sizeof(bus->name), "uart_mgr%d", bus->port);
+
+        xTaskCreatePinnedToCore(
+            uart_manager_task,
+            bus->name,
+            4096,
+            bus,
+            10,
+            NULL,
+            0
+        );
+    }
+}
+
+void uart_manager_get_stats(mux_device_t dev, uart_sched_stats_t *stats)
+{
+    if (!valid_device(dev))
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    portENTER_CRITICAL(&sched_mux);
+    *stats = sched[dev];
+    portEXIT_CRITICAL(&sched_mux);
+    stats->port = routes[dev].port;
+    stats->priority = default_priority[dev];
+    stats->settle_us = device_settle_us(dev);
+}
+
+uint32_t uart_manager_load_permille(uart_port_t port)
+{
+    uint64_t load = 0;
+    for (int d = 0; d < UART_DEVICES; d++)
+    {
+        uart_sched_stats_t s;
+        uart_manager_get_stats((mux_device_t)d, &s);
+        if (s.port == port && s.period_ms && s.transactions)
+            load += s.busy_us / s.transactions * 1000 / ((uint64_t)s.period_ms * 1000);
+    }
+    return (uint32_t)load;
+}
+
+void uart_manager_print_schedule(FILE *out)
+{
+    fprintf(out, "%-5s %4s %4s %9s %7s %9s %7s %9s %9s %7s %8s %6s %9s\n",
+            "dev", "port", "prio", "period_ms", "count", "avg_ms", "load%", "wait_ms", "wait_max", "missed",
+            "switches", "saved", "settle_us");
+    for (int d = 0; d < UART_DEVICES; d++)
+    {
+        uart_sched_stats_t s;
+        uart_manager_get_stats((mux_device_t)d, &s);
+        if (!s.transactions)
+            continue;
+        double avg_ms = s.busy_us / 1000.0 / s.transactions;
+        fprintf(out, "%-5s %4d %4u %9u %7u %9.1f %7.1f %9.1f %9.1f %7u %8u %6u %9u\n",
+                device_names[d], s.port, s.priority, (unsigned)s.period_ms, (unsigned)s.transactions, avg_ms,
+                s.period_ms ? 100.0 * avg_ms / s.period_ms : 0.0,
+                s.wait_us / 1000.0 / s.transactions, s.wait_us_max / 1000.0,
+                (unsigned)s.deadline_missed, (unsigned)s.mux_switches, (unsigned)s.switches_saved,
+                (unsigned)s.settle_us);
+    }
+    fprintf(out, "%-5s %8s %9s %9s %9s %8s %6s %7s\n",
+            "dev", "answered", "lat_ms", "usual_ms", "lat_max", "timeouts", "idle", "len_err");
+    for (int d = 0; d < UART_DEVICES; d++)
+    {
+        uart_sched_stats_t s;
+        uart_manager_get_stats((mux_device_t)d, &s);
+        if (!s.transactions)
+            continue;
+        fprintf(out, "%-5s %8u %9.2f %9.2f %9.2f %8u %6u %7u\n",
+                device_names[d], (unsigned)s.answered, s.latency_us / 1000.0, s.latency_us_usual / 1000.0,
+                s.latency_us_max / 1000.0, (unsigned)s.timeouts, (unsigned)s.idle_ends, (unsigned)s.len_mismatch);
+    }
+    for (int i = 0; i < n_buses; i++)
+    {
+        const uart_bus_t *bus = &buses[i];
+        uint32_t load = uart_manager_load_permille(bus->port);
+        fprintf(out, "uart%d: periodic load %.1f%%%s, baud changes %u, %lld us each on average\n",
+                bus->port, load / 10.0, load > 1000 ? ", requested rates do not fit" : "",
+                (unsigned)bus->baud_switches, (long long)bus->baud_cost_us);
+    }
+}
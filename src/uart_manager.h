@@ -1,6 +1,17 @@
 #pragma once
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "driver/uart.h"
+#include <stdio.h>
+
+#define UART_QUEUE_LEN 40
+#define UART_DEVICES 4      // mux_device_t
+#define UART_SETTLE_DEFAULT_US 10000   // mux settle of a device not yet calibrated
+#define UART_SETTLE_SPIN_US 300        // end of a settle busy waited, esp_timer wake up latency
+#define UART_BURST_MAX 4    // transactions run back to back for one device before others are considered equally
+#define UART_GAP_DEFAULT_US 5000       // line idle that ends a started response, unless gap_us says otherwise
+#define UART_RX_FULL_THRESH 32  // the RX interrupt hands bytes to the driver every this many
+#define UART_RX_TOUT 3          // or this many symbol times after the line goes quiet
 
 typedef enum {
     GPS = 0,
@@ -9,16 +20,134 @@ typedef enum {
     LORA = 3
 } mux_device_t;
 
+// Where a device is wired. Devices on the same UART controller share one
+// scheduler task and take turns; devices on different controllers run in
+// parallel. The logger PCB has all of them on UART_PORT behind the 3-bit
+// mux, at the address of their mux_device_t.
 typedef struct {
+    uart_port_t port;
+    int mux_addr;           // address on the mux, -1: the device has the port to itself
+    int tx_pin;             // UART_PIN_NO_CHANGE keeps the controller's pins
+    int rx_pin;
+} uart_route_t;
+
+// how uart_manager knows a response is complete, see uart_frame.h
+typedef enum {
+    UART_FRAME_NONE = 0,    // read until rx_buf is full or timeout_ms
+    UART_FRAME_PING,
+    UART_FRAME_UBX,
+    UART_FRAME_LINE
+} uart_frame_t;
+
+// why uart_manager stopped reading a response
+typedef enum {
+    UART_END_NONE = 0,      // not read from the device (replayed)
+    UART_END_FRAME,         // the frame is complete
+    UART_END_LENGTH,        // expect_len bytes are in
+    UART_END_IDLE,          // the response started, then the line stayed idle gap_us
+    UART_END_TIMEOUT,       // timeout_ms ran out
+    UART_END_FULL           // rx_buf is full
+} uart_end_t;
+
+typedef struct uart_transaction uart_transaction_t;
+
+// runs on uart_mgr once the response is in, must not block
+typedef void (*uart_done_cb_t)(uart_transaction_t *trans, void *arg);
+
+// A request and its response. Taken from the pool (uart_pool.h) and
+// handed to uart_manager with uart_submit; the caller owns it again once
+// it is done and reads the response in place. The buffers are kept last so
+// a transaction can be reset without touching them.
+struct uart_transaction {
     mux_device_t device;
     int baud;
-    uint8_t tx_buf[512];
     size_t tx_len;
-    uint8_t rx_buf[512];
     size_t rx_len;
     uint32_t timeout_ms;
-    TaskHandle_t caller;
-}uart_transaction_t;
+    uart_frame_t frame;     // return as soon as this frame is in, timeout_ms is the limit
+    size_t expect_len;      // response length if known, 0 if not; ends reads without a frame,
+                            // framed responses of another length are counted as len_mismatch
+    uint32_t gap_us;        // longest pause inside a response, 0: UART_GAP_DEFAULT_US
+    uint8_t priority;       // higher goes first, 0 for the device default
+    uint32_t period_ms;     // the caller repeats this every period_ms, 0 if it does not
+    int64_t deadline_us;    // esp_timer time the response is due, 0: queued + period_ms
+    int64_t queued_us;      // set by uart_manager
+    TaskHandle_t caller;    // notified when done, uart_submit sets it unless on_done is set
+    uart_done_cb_t on_done; // called when done, the transaction is the callback's from then on
+    void *done_arg;
+    uint8_t done;           // set by uart_manager, read it with uart_trans_done
+    int64_t tx_done_us;     // esp_timer time the request had left the UART
+    int64_t rx_done_us;     // esp_timer time the response read finished
+    uart_end_t end;         // set by uart_manager
+    uint8_t tx_buf[512];
+    uint8_t rx_buf[512];
+};
 
-QueueHandle_t get_uart_queue();
+// bus use per device, as scheduled by uart_manager
+typedef struct {
+    uart_port_t port;
+    uint8_t priority;           // default for the device
+    uint32_t period_ms;         // of its last periodic transaction
+    uint32_t transactions;
+    uint32_t deadline_missed;   // response read after deadline_us
+    uint64_t busy_us;           // mux switch to response read
+    uint64_t wait_us;           // queued to started
+    uint32_t wait_us_max;
+    uint32_t mux_switches;      // transactions that had to select and settle the mux
+    uint32_t switches_saved;    // ran straight after one for the same device
+    uint32_t settle_us;         // wait after selecting the device, from NVS once calibrated
+    // response model: latency is request out (TX done) to response in, less
+    // the response's time on the wire at the baud
+    uint32_t answered;          // complete responses, the model is built from these
+    uint32_t latency_us;        // moving average over the last few responses
+    uint32_t latency_us_usual;  // the same over a long window, what the device normally does
+    uint32_t latency_us_max;
+    uint32_t timeouts;          // nothing or only part of a frame before timeout_ms
+    uint32_t idle_ends;         // cut short by the inter-byte gap
+    uint32_t len_mismatch;      // complete, but not expect_len long
+} uart_sched_stats_t;
+
+// the queue of the scheduler for port, NULL if no device is routed to it
+QueueHandle_t get_uart_queue(uart_port_t port);
+
+// Queue trans for the port of its device and return without waiting for it, false if
+// uart_queue stayed full for wait. A task may have several transactions in
+// flight and work on one response while the next is on the wire.
+bool uart_submit(uart_transaction_t *trans, TickType_t wait);
+
+// true once the response is in rx_buf
+bool uart_trans_done(const uart_transaction_t *trans);
+
+// Block the submitting task until trans is done, false if wait ran out first.
+// Notifications for its other transactions only wake it early.
+bool uart_trans_wait(uart_transaction_t *trans, TickType_t wait);
+
+// uart_submit and uart_trans_wait for the whole transaction
+bool uart_transact(uart_transaction_t *trans);
+
+// moves dev to another port or mux address, before init_uart_manager
+void uart_manager_set_route(mux_device_t dev, const uart_route_t *route);
+void uart_manager_get_route(mux_device_t dev, uart_route_t *route);
+
+// installs the UART driver and starts a scheduler task for every port a
+// device is routed to, loads the per device settle times from NVS
+// (nvs_flash_init first), and measures and stores them first when
+// g_uart_calibrate is set
 void init_uart_manager();
+
+void uart_manager_get_stats(mux_device_t dev, uart_sched_stats_t *stats);
+
+// transactions for port not run yet, taken off its queue or still in it;
+// -1 if no task serves port
+int uart_manager_backlog(uart_port_t port);
+
+// name of the task serving port, NULL if none does
+const char *uart_manager_task_name(uart_port_t port);
+
+// share of port the periodic devices on it ask for, average transaction
+// time over period; above 1000 the requested rates do not fit on it
+uint32_t uart_manager_load_permille(uart_port_t port);
+
+// per device port, rate, bus time, waits and misses, then the load per port
+// and the response model of each device
+void uart_manager_print_schedule(FILE *out);
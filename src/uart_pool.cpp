@@ -0,0 +1,72 @@
+#include "uart_pool.h"
+#include "esp_log.h"
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "UART_POOL";
+
+static uart_transaction_t pool[UART_POOL_SIZE];
+static QueueHandle_t free_list;
+static uart_pool_stats_t stats;
+static portMUX_TYPE pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void uart_pool_init()
+{
+    free_list = xQueueCreate(UART_POOL_SIZE, sizeof(uart_transaction_t *));
+    vQueueAddToRegistry(free_list, "uart_pool");
+    for (int i = 0; i < UART_POOL_SIZE; i++)
+    {
+        uart_transaction_t *trans = &pool[i];
+        xQueueSend(free_list, &trans, 0);
+    }
+}
+
+uart_transaction_t *uart_trans_alloc(mux_device_t dev, TickType_t wait)
+{
+    uart_transaction_t *trans;
+    bool waited = false;
+    if (xQueueReceive(free_list, &trans, 0) != pdTRUE)
+    {
+        waited = true;
+        if (xQueueReceive(free_list, &trans, wait) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "no free transaction for device %d", dev);
+            return NULL;
+        }
+    }
+
+    uart_trans_reset(trans, dev);
+
+    portENTER_CRITICAL(&pool_mux);
+    stats.allocs++;
+    if (waited)
+        stats.alloc_waits++;
+    stats.in_use++;
+    if (stats.in_use > stats.peak_in_use)
+        stats.peak_in_use = stats.in_use;
+    portEXIT_CRITICAL(&pool_mux);
+    return trans;
+}
+
+void uart_trans_free(uart_transaction_t *trans)
+{
+    if (!trans)
+        return;
+    portENTER_CRITICAL(&pool_mux);
+    stats.in_use--;
+    portEXIT_CRITICAL(&pool_mux);
+    xQueueSend(free_list, &trans, 0);
+}
+
+void uart_trans_reset(uart_transaction_t *trans, mux_device_t dev)
+{
+    memset(trans, 0, offsetof(uart_transaction_t, tx_buf));
+    trans->device = dev;
+}
+
+void uart_pool_get_stats(uart_pool_stats_t *out)
+{
+    portENTER_CRITICAL(&pool_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&pool_mux);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "uart_manager.h"
+
+// Fixed pool of uart_transaction_t shared by every task that talks over
+// the UART. A task takes one, fills tx_buf, hands the pointer to
+// uart_manager, parses rx_buf in place once notified, and gives it back.
+
+// the most transactions each user holds at once, so that every task gets
+// its next one without waiting on another: gnss the response it parses, the
+// next poll and a request of the driver's; ping the profile it parses and
+// the next request; lora one, its last response goes back before it takes
+// the next; calibration one probe per port's uart_manager
+#define UART_POOL_HOLD_GNSS 3
+#define UART_POOL_HOLD_PING 2
+#define UART_POOL_HOLD_LORA 1
+#define UART_POOL_HOLD_PROBES UART_NUM_MAX
+
+#define UART_POOL_SIZE 9
+static_assert(UART_POOL_SIZE >= UART_POOL_HOLD_GNSS + UART_POOL_HOLD_PING + UART_POOL_HOLD_LORA +
+                                UART_POOL_HOLD_PROBES,
+              "a task could wait for a transaction that another waiting task holds");
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t alloc_waits;       // found the pool empty and had to wait
+    uint32_t in_use;
+    uint32_t peak_in_use;
+} uart_pool_stats_t;
+
+// called by init_uart_manager
+void uart_pool_init();
+
+// a transaction for dev with every field but the buffers zeroed, NULL if
+// none came free within wait
+uart_transaction_t *uart_trans_alloc(mux_device_t dev, TickType_t wait);
+void uart_trans_free(uart_transaction_t *trans);
+
+// zero every field but the buffers, to reuse a transaction for another request
+void uart_trans_reset(uart_transaction_t *trans, mux_device_t dev);
+
+void uart_pool_get_stats(uart_pool_stats_t *stats);
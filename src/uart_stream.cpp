@@ -0,0 +1,90 @@
+#include "uart_stream.h"
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+static uint8_t ring[UART_STREAM_BUFFER];
+static size_t head;     // next write, uart_mgr only
+static size_t tail;     // next read, gnss only
+static int64_t last_us;
+static uart_stream_stats_t stats;
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//
+// head and tail only grow; the ring holds head - tail bytes. Each side
+// publishes its own index with release and reads the other's with acquire.
+//
+void uart_stream_write(const uint8_t *data, size_t len, int64_t at_us)
+{
+    size_t h = head;
+    size_t free_bytes = UART_STREAM_BUFFER - (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+    size_t n = len < free_bytes ? len : free_bytes;
+    size_t at = h % UART_STREAM_BUFFER;
+    size_t first = n < UART_STREAM_BUFFER - at ? n : UART_STREAM_BUFFER - at;
+    memcpy(&ring[at], data, first);
+    memcpy(ring, data + first, n - first);
+    __atomic_store_n(&head, h + n, __ATOMIC_RELEASE);
+
+    portENTER_CRITICAL(&stats_mux);
+    last_us = at_us;
+    stats.bytes += n;
+    stats.dropped_bytes += len - n;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+void uart_stream_count_drain(bool resumed)
+{
+    portENTER_CRITICAL(&stats_mux);
+    stats.drains++;
+    if (resumed)
+        stats.resumes++;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+size_t uart_stream_available()
+{
+    return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - tail;
+}
+
+size_t uart_stream_read(uint8_t *data, size_t len)
+{
+    size_t t = tail;
+    size_t avail = __atomic_load_n(&head, __ATOMIC_ACQUIRE) - t;
+    size_t n = len < avail ? len : avail;
+    size_t at = t % UART_STREAM_BUFFER;
+    size_t first = n < UART_STREAM_BUFFER - at ? n : UART_STREAM_BUFFER - at;
+    memcpy(data, &ring[at], first);
+    memcpy(data + first, ring, n - first);
+    __atomic_store_n(&tail, t + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+// the bytes from tail up to head or the end of the ring, whichever is first;
+// uart_mgr does not write over them until uart_stream_consume gives them back
+size_t uart_stream_peek(const uint8_t **data)
+{
+    size_t t = tail;
+    size_t avail = __atomic_load_n(&head, __ATOMIC_ACQUIRE) - t;
+    size_t at = t % UART_STREAM_BUFFER;
+    *data = &ring[at];
+    return avail < UART_STREAM_BUFFER - at ? avail : UART_STREAM_BUFFER - at;
+}
+
+void uart_stream_consume(size_t len)
+{
+    __atomic_store_n(&tail, tail + len, __ATOMIC_RELEASE);
+}
+
+int64_t uart_stream_last_us()
+{
+    portENTER_CRITICAL(&stats_mux);
+    int64_t us = last_us;
+    portEXIT_CRITICAL(&stats_mux);
+    return us;
+}
+
+void uart_stream_get_stats(uart_stream_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_mux);
+}
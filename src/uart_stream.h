@@ -0,0 +1,42 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// GNSS streaming (g_gnss_stream).
+//
+// Instead of polling the u-blox and reading a window after each poll,
+// uart_manager leaves the mux on the GPS whenever it has nothing else to
+// run and drains the UART into this ring. It switches away only for queued
+// transactions and empties the UART into the ring before it does, so frames
+// are not cut at window edges. gnss_task parses the ring as its byte
+// stream; responses to its own GPS transactions go through the ring too,
+// so the bytes stay in order.
+//
+// One writer (uart_mgr) and one reader (gnss), no lock.
+
+#define UART_STREAM_BUFFER 4096     // 350 ms of 115200 baud
+#define UART_STREAM_IDLE_TICKS 1    // uart_mgr drains this often while idle
+
+typedef struct {
+    uint64_t bytes;             // written to the ring
+    uint64_t dropped_bytes;     // ring full, gnss behind
+    uint32_t drains;            // reads of the UART while streaming
+    uint32_t resumes;           // mux switched back to the GPS to stream
+} uart_stream_stats_t;
+
+// uart_manager side
+void uart_stream_write(const uint8_t *data, size_t len, int64_t at_us);
+void uart_stream_count_drain(bool resumed);
+
+// gnss side
+size_t uart_stream_available();
+size_t uart_stream_read(uint8_t *data, size_t len);
+// parse in place: point data at the next bytes (one contiguous piece, so
+// up to the end of the ring) and return how many, then drop len of them
+size_t uart_stream_peek(const uint8_t **data);
+void uart_stream_consume(size_t len);
+
+// esp_timer time of the last bytes written, 0 if none yet
+int64_t uart_stream_last_us();
+
+void uart_stream_get_stats(uart_stream_stats_t *stats);
@@ -0,0 +1,170 @@
+#include "uart_trace.h"
+#include "esp_log.h"
+#include "config.h"
+#include "sd_task.h"
+#include <string.h>
+
+#define TRACE_PORTS 8
+
+static const char *TAG = "UART_TRACE";
+
+static_assert(sizeof(uart_trace_entry_t) == 48, "trace entries are written as they are");
+static_assert((UART_TRACE_ENTRIES & (UART_TRACE_ENTRIES - 1)) == 0, "UART_TRACE_ENTRIES must be a power of two");
+
+static uart_trace_entry_t ring[UART_TRACE_ENTRIES];
+static uint32_t next_seq;      // claimed by the writers, one per transaction
+
+static const char *device_names[] = {"GPS", "PING", "FC", "LORA"};
+static const char *end_names[] = {"none", "frame", "length", "idle", "timeout", "full"};
+
+//
+// A writer claims the next sequence number and owns its slot until it
+// stores the number + 1 back into seq. seq is 0 while the slot is being
+// written, so a reader that sees the same non-zero seq before and after
+// copying an entry has a whole one.
+//
+void uart_trace_record(const uart_transaction_t *trans, uart_port_t port, int64_t start_us, int64_t write_us,
+                       bool switched)
+{
+    uint32_t n = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    uart_trace_entry_t *e = &ring[n & (UART_TRACE_ENTRIES - 1)];
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    e->device = (uint8_t)trans->device;
+    e->port = (uint8_t)port;
+    e->end = (uint8_t)trans->end;
+    e->flags = switched ? UART_TRACE_SWITCHED : 0;
+    e->start_us = start_us;
+    e->write_us = (uint32_t)(write_us - start_us);
+    e->tx_done_us = trans->tx_done_us > start_us ? (uint32_t)(trans->tx_done_us - start_us) : e->write_us;
+    e->duration_us = (uint32_t)(trans->rx_done_us - start_us);
+    e->baud = (uint32_t)trans->baud;
+    e->tx_len = (uint16_t)trans->tx_len;
+    e->rx_len = (uint16_t)trans->rx_len;
+    memcpy(e->tx_head, trans->tx_buf, UART_TRACE_HEAD);
+    memcpy(e->rx_head, trans->rx_buf, UART_TRACE_HEAD);
+
+    __atomic_store_n(&e->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t uart_trace_recorded()
+{
+    return __atomic_load_n(&next_seq, __ATOMIC_RELAXED);
+}
+
+// copy of the entry for sequence number n, false if it was overwritten or is being written
+static bool read_entry(uint32_t n, uart_trace_entry_t *out)
+{
+    const uart_trace_entry_t *e = &ring[n & (UART_TRACE_ENTRIES - 1)];
+    if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != n + 1)
+        return false;
+    memcpy(out, e, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&e->seq, __ATOMIC_RELAXED) == n + 1 && out->seq == n + 1;
+}
+
+bool uart_trace_dump(FILE *out)
+{
+    uint32_t end = uart_trace_recorded();
+    uint32_t first = end > UART_TRACE_ENTRIES ? end - UART_TRACE_ENTRIES : 0;
+    uart_trace_header_t hdr = {UART_TRACE_MAGIC, UART_TRACE_VERSION, sizeof(uart_trace_entry_t), end};
+    if (fwrite(&hdr, 1, sizeof(hdr), out) != sizeof(hdr))
+        return false;
+    for (uint32_t n = first; n != end; n++)
+    {
+        uart_trace_entry_t e;
+        if (read_entry(n, &e) && fwrite(&e, 1, sizeof(e), out) != sizeof(e))
+            return false;
+    }
+    return true;
+}
+
+void uart_trace_save()
+{
+    if (!g_uart_trace_dump)
+        return;
+    g_uart_trace_dump = 0;
+    FILE *f = fopen(MOUNT_POINT "/" UART_TRACE_FILE, "w");
+    if (!f)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", UART_TRACE_FILE);
+        return;
+    }
+    if (!uart_trace_dump(f))
+        ESP_LOGE(TAG, "Failed to write %s", UART_TRACE_FILE);
+    fclose(f);
+    ESP_LOGI(TAG, "Dumped the last transactions of %u to %s", (unsigned)uart_trace_recorded(), UART_TRACE_FILE);
+}
+
+static void print_head(FILE *out, const uint8_t *head, uint16_t len)
+{
+    size_t n = len < UART_TRACE_HEAD ? len : UART_TRACE_HEAD;
+    for (size_t i = 0; i < n; i++)
+        fprintf(out, "%02X", head[i]);
+    for (size_t i = n; i < UART_TRACE_HEAD; i++)
+        fprintf(out, "  ");
+}
+
+// where the time of one port went, over the span of its traced transactions
+typedef struct {
+    uint32_t count;
+    int64_t first_us;
+    int64_t last_end_us;
+    uint64_t switch_us;     // start to write: mux switch, settle, baud change
+    uint64_t tx_us;         // write to request out
+    uint64_t rx_us;         // request out to response read
+} trace_port_use_t;
+
+bool uart_trace_decode(FILE *in, FILE *out)
+{
+    uart_trace_header_t hdr;
+    if (fread(&hdr, 1, sizeof(hdr), in) != sizeof(hdr) || hdr.magic != UART_TRACE_MAGIC ||
+        hdr.version != UART_TRACE_VERSION || hdr.entry_len != sizeof(uart_trace_entry_t))
+        return false;
+
+    fprintf(out, "%8s %12s %-5s %4s %7s %5s %5s %8s %8s %9s %-7s %-12s %-12s\n",
+            "seq", "start_ms", "dev", "port", "baud", "tx", "rx", "write_ms", "out_ms", "dur_ms", "end",
+            "tx_head", "rx_head");
+    trace_port_use_t use[TRACE_PORTS] = {};
+    uart_trace_entry_t e;
+    uint32_t count = 0;
+    while (fread(&e, 1, sizeof(e), in) == sizeof(e))
+    {
+        fprintf(out, "%8u %12.3f %-5s %4u %7u %5u %5u %8.3f %8.3f %9.3f %-7s ",
+                (unsigned)e.seq, e.start_us / 1000.0,
+                e.device < sizeof(device_names) / sizeof(device_names[0]) ? device_names[e.device] : "?",
+                e.port, (unsigned)e.baud, e.tx_len, e.rx_len, e.write_us / 1000.0, e.tx_done_us / 1000.0,
+                e.duration_us / 1000.0, e.end < sizeof(end_names) / sizeof(end_names[0]) ? end_names[e.end] : "?");
+        print_head(out, e.tx_head, e.tx_len);
+        fprintf(out, " ");
+        print_head(out, e.rx_head, e.rx_len);
+        fprintf(out, "%s\n", e.flags & UART_TRACE_SWITCHED ? " switched" : "");
+        count++;
+
+        if (e.port >= TRACE_PORTS)
+            continue;
+        trace_port_use_t *u = &use[e.port];
+        if (u->count++ == 0)
+            u->first_us = e.start_us;
+        u->last_end_us = e.start_us + e.duration_us;
+        u->switch_us += e.write_us;
+        u->tx_us += e.tx_done_us - e.write_us;
+        u->rx_us += e.duration_us - e.tx_done_us;
+    }
+    fprintf(out, "%u of %u transactions\n", (unsigned)count, (unsigned)hdr.recorded);
+
+    for (int port = 0; port < TRACE_PORTS; port++)
+    {
+        const trace_port_use_t *u = &use[port];
+        int64_t span = u->last_end_us - u->first_us;
+        if (!u->count || span <= 0)
+            continue;
+        uint64_t busy = u->switch_us + u->tx_us + u->rx_us;
+        fprintf(out, "uart%d: %u transactions in %.1f ms, busy %.1f%%: switching %.1f%%, request %.1f%%, "
+                "response %.1f%%\n",
+                port, (unsigned)u->count, span / 1000.0, 100.0 * busy / span, 100.0 * u->switch_us / span,
+                100.0 * u->tx_us / span, 100.0 * u->rx_us / span);
+    }
+    return true;
+}
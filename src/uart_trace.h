@@ -0,0 +1,68 @@
+#pragma once
+#include "uart_manager.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Always-on trace of uart_manager transactions.
+//
+// Every transaction leaves one fixed-size entry in a RAM ring: when it
+// started, device, port, baud, lengths, how long it took, why the read
+// ended and its first tx and rx bytes. The newest UART_TRACE_ENTRIES are
+// kept. Recording is a slot claim and a few stores with no lock, so it
+// stays on in the field where logging every byte would not.
+//
+// When the logging switch (TOGGLE_SW) is turned off, or g_uart_trace_dump
+// is set, sd_task writes the ring to UART_TRACE_FILE and clears the flag. uart_trace_decode turns a dump back into text
+// (usv_host --decode-trace), with the share of each port's time spent
+// switching, on transactions and idle between them.
+
+#define UART_TRACE_FILE "uart.trc"
+#define UART_TRACE_ENTRIES 256          // power of two
+#define UART_TRACE_HEAD 6               // first bytes kept of each direction
+#define UART_TRACE_MAGIC 0x43525455     // "UTRC"
+#define UART_TRACE_VERSION 2
+
+#define UART_TRACE_SWITCHED 0x01        // the mux was switched to the device first
+
+// start of a dump, then the entries oldest first up to the end of the file
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_len;                 // sizeof(uart_trace_entry_t)
+    uint32_t recorded;                  // since start, older ones than the dump holds were overwritten
+} uart_trace_header_t;
+
+// one transaction, no padding so it is also the dump format
+typedef struct {
+    uint32_t seq;                       // 1 for the first transaction, 0 in a slot not written yet
+    uint8_t device;
+    uint8_t port;
+    uint8_t end;                        // uart_end_t
+    uint8_t flags;                      // UART_TRACE_*
+    int64_t start_us;                   // taken off the queue
+    uint32_t write_us;                  // start_us -> write started, the mux switch, settle and baud change
+    uint32_t tx_done_us;                // start_us -> request out
+    uint32_t duration_us;               // start_us -> response read finished
+    uint32_t baud;
+    uint16_t tx_len;
+    uint16_t rx_len;
+    uint8_t tx_head[UART_TRACE_HEAD];
+    uint8_t rx_head[UART_TRACE_HEAD];
+} uart_trace_entry_t;
+
+// uart_manager side, safe from several of its tasks at once
+void uart_trace_record(const uart_transaction_t *trans, uart_port_t port, int64_t start_us, int64_t write_us,
+                       bool switched);
+
+// transactions recorded since start
+uint32_t uart_trace_recorded();
+
+// binary dump of the ring, header and entries; false on a write error
+bool uart_trace_dump(FILE *out);
+
+// sd_task side: dump to UART_TRACE_FILE if g_uart_trace_dump asks for it
+void uart_trace_save();
+
+// one line per entry of a dump in in, then how busy each port was; false
+// if in is not a dump
+bool uart_trace_decode(FILE *in, FILE *out);